@@ -0,0 +1,199 @@
+// Accuracy and speed of the fast_math.h approximations against the standard library, and of
+// the rejection-free direction sampling against the rejection loops.
+
+#include "utils.h"
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+namespace
+{
+const size_t count = 1 << 20; // Arguments per function
+
+volatile double sink; // Keeps the timed loops from being optimized away
+
+double nanoseconds_per_call(const std::function<double()> &run)
+{
+    // Best of five runs, to keep other processes out of the numbers.
+    double best = infinity;
+    for (int attempt = 0; attempt < 5; attempt++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        sink = run();
+        auto stop = std::chrono::steady_clock::now();
+        best = std::fmin(best, std::chrono::duration<double, std::nano>(stop - start).count() / count);
+    }
+    return best;
+}
+
+void report(const char *name, double min, double max, double abs_error, double rel_error, double exact_ns,
+            double fast_ns)
+{
+    std::printf("%-10s [%9.3g, %9.3g]  abs %.2e  rel %.2e  std %6.2f ns  fast %6.2f ns  (%.1fx)\n", name, min, max,
+                abs_error, rel_error, exact_ns, fast_ns, exact_ns / fast_ns);
+}
+
+void compare(const char *name, double min, double max, double (*exact)(double), double (*fast)(double),
+             void (*fast_batch)(const double *, double *, size_t) = nullptr)
+{
+    // Sweeps [min,max] evenly.
+    std::vector<double> xs(count), ys(count);
+    for (size_t i = 0; i < count; i++)
+        xs[i] = min + (max - min) * (i + 0.5) / count;
+
+    double abs_error = 0, rel_error = 0;
+    for (auto x : xs)
+    {
+        auto e = exact(x), f = fast(x);
+        abs_error = std::fmax(abs_error, std::fabs(f - e));
+        if (e != 0)
+            rel_error = std::fmax(rel_error, std::fabs((f - e) / e));
+    }
+
+    auto exact_ns = nanoseconds_per_call([&] {
+        double sum = 0;
+        for (auto x : xs)
+            sum += exact(x);
+        return sum; });
+    auto fast_ns = nanoseconds_per_call([&] {
+        double sum = 0;
+        for (auto x : xs)
+            sum += fast(x);
+        return sum; });
+    report(name, min, max, abs_error, rel_error, exact_ns, fast_ns);
+
+    if (fast_batch)
+    {
+        fast_batch(xs.data(), ys.data(), count);
+        abs_error = rel_error = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            auto e = exact(xs[i]);
+            abs_error = std::fmax(abs_error, std::fabs(ys[i] - e));
+            if (e != 0)
+                rel_error = std::fmax(rel_error, std::fabs((ys[i] - e) / e));
+        }
+
+        auto batch_ns = nanoseconds_per_call([&] {
+            fast_batch(xs.data(), ys.data(), count);
+            return ys[count / 2]; });
+        report("  batch", min, max, abs_error, rel_error, exact_ns, batch_ns);
+    }
+}
+
+void compare_atan2()
+{
+    // Points all around the unit circle, so every octant gets exercised.
+    std::vector<double> ys(count), xs(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        auto angle = -pi + 2 * pi * (i + 0.5) / count;
+        ys[i] = std::sin(angle);
+        xs[i] = std::cos(angle);
+    }
+
+    double abs_error = 0, rel_error = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        auto e = std::atan2(ys[i], xs[i]), f = fast_atan2(ys[i], xs[i]);
+        abs_error = std::fmax(abs_error, std::fabs(f - e));
+        rel_error = std::fmax(rel_error, std::fabs((f - e) / e));
+    }
+
+    auto exact_ns = nanoseconds_per_call([&] {
+        double sum = 0;
+        for (size_t i = 0; i < count; i++)
+            sum += std::atan2(ys[i], xs[i]);
+        return sum; });
+    auto fast_ns = nanoseconds_per_call([&] {
+        double sum = 0;
+        for (size_t i = 0; i < count; i++)
+            sum += fast_atan2(ys[i], xs[i]);
+        return sum; });
+    report("atan2", -pi, pi, abs_error, rel_error, exact_ns, fast_ns);
+}
+
+double sin_exact(double x) { return std::sin(x); }
+double cos_exact(double x) { return std::cos(x); }
+double log_exact(double x) { return std::log(x); }
+double acos_exact(double x) { return std::acos(x); }
+double pow5_exact(double x) { return std::pow(x, 5); }
+
+// The rejection samplers vec3.h uses without RT_FAST_MATH.
+
+vec3 rejection_unit_vector()
+{
+    while (true)
+    {
+        auto p = vec3::random(-1, 1);
+        auto lensq = p.length_squared();
+        if (1e-160 < lensq && lensq <= 1)
+            return p / sqrt(lensq);
+    }
+}
+
+vec3 rejection_unit_disk()
+{
+    while (true)
+    {
+        auto p = vec3(random_double(-1, 1), random_double(-1, 1), 0);
+        if (p.length_squared() < 1)
+            return p;
+    }
+}
+
+void compare_sampling(const char *name, vec3 (*rejection)(), vec3 (*mapped)(double, double), double second_moment)
+{
+    // Checks that the mapped samples have mean 0 and the expected E[x^2], and times both
+    // samplers, random number generation included.
+    vec3 mean(0, 0, 0), second(0, 0, 0);
+    for (size_t i = 0; i < count; i++)
+    {
+        auto u1 = random_double();
+        auto p = mapped(u1, random_double());
+        mean += p;
+        second += p * p;
+    }
+    mean /= count;
+    second /= count;
+
+    auto rejection_ns = nanoseconds_per_call([&] {
+        double sum = 0;
+        for (size_t i = 0; i < count; i++)
+            sum += rejection().x();
+        return sum; });
+    auto mapped_ns = nanoseconds_per_call([&] {
+        double sum = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            auto u1 = random_double();
+            sum += mapped(u1, random_double()).x();
+        }
+        return sum; });
+
+    std::printf("%-12s mean (%+.4f %+.4f %+.4f)  E[x^2] %.4f (expect %.4f)  rejection %6.2f ns  mapped %6.2f ns\n",
+                name, mean.x(), mean.y(), mean.z(), second.x(), second_moment, rejection_ns, mapped_ns);
+}
+} // namespace
+
+int main()
+{
+#ifdef RT_FAST_MATH
+    std::printf("Built with RT_FAST_MATH: the renderer uses the approximations\n\n");
+#else
+    std::printf("Built without RT_FAST_MATH: the renderer uses the standard library\n\n");
+#endif
+
+    compare("sin", -100, 100, sin_exact, fast_sin, fast_sin);
+    compare("cos", 0, 2 * pi, cos_exact, fast_cos);
+    compare("log", 1e-12, 1, log_exact, fast_log, fast_log);
+    compare("acos", -1, 1, acos_exact, fast_acos);
+    compare_atan2();
+    compare("pow5", 0, 1, pow5_exact, pow5);
+
+    std::printf("\n");
+    compare_sampling("unit vector", rejection_unit_vector, sample_unit_vector, 1.0 / 3);
+    compare_sampling("unit disk", rejection_unit_disk, sample_unit_disk, 0.25);
+}
@@ -0,0 +1,473 @@
+// Microbenchmarks of the intersection, traversal, noise and transform kernels on seeded random
+// inputs, with repeat statistics and optional JSON output for tracking them over time.
+//
+//   bench [--json FILE] [--filter TEXT] [--reps N] [--count N] [--seed N] [--perf]
+//
+// With --perf, hardware counters (see perf_counters.h) are read over the timed runs and
+// reported per operation.
+
+#include "utils.h"
+
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable_list.h"
+#include "json.h"
+#include "material.h"
+#include "matrix.h"
+#include "perf_counters.h"
+#include "perlin.h"
+#include "quad.h"
+#include "scene_compiler.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace
+{
+volatile size_t sink; // Keeps the timed loops from being optimized away
+
+struct benchmark
+{
+    std::string name;
+    const char *unit;            // What one operation is: "rays" or "calls"
+    size_t ops;                  // Operations per run
+    std::function<size_t()> run; // Returns a checksum (usually the hit count) of one run
+};
+
+struct result
+{
+    std::string name;
+    const char *unit;
+    size_t ops;
+    size_t checksum;
+    std::vector<double> ns_per_op; // One per repetition
+    double min, median, mean, stddev;
+    double perf_per_op[perf_counters::event_count]; // Over all timed runs, -1 where not counted
+};
+
+struct bench_settings
+{
+    size_t count = 1 << 16; // Rays or calls per run
+    int reps = 15;          // Timed runs per benchmark, after one untimed warm-up run
+    uint64_t seed = 1;
+    std::string filter; // Only benchmarks whose name contains this
+    std::string json;   // File for the JSON report, "-" for standard output
+    bool perf = false;  // Read hardware counters
+};
+
+// Inputs. Every set is drawn from its own seeded stream, so adding a benchmark does not change
+// the inputs of the others.
+
+std::vector<ray> make_rays(size_t count, uint64_t seed, uint64_t stream)
+{
+    // From random points around the scene towards random points inside it, so most rays cross
+    // the region the objects are in.
+    seed_random(seed, stream);
+    std::vector<ray> rays;
+    rays.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        point3 from = 20 * random_unit_vector();
+        point3 to = point3::random(-6, 6);
+        rays.emplace_back(from, to - from);
+    }
+    return rays;
+}
+
+std::vector<point3> random_points(size_t count, double min, double max, uint64_t seed, uint64_t stream)
+{
+    seed_random(seed, stream);
+    std::vector<point3> points(count);
+    for (auto &p : points)
+        p = point3::random(min, max);
+    return points;
+}
+
+const size_t shape_count = 256; // Objects the single-primitive kernels cycle through
+
+template <typename Make>
+std::vector<shared_ptr<hittable>> make_objects(size_t count, uint64_t seed, uint64_t stream, Make make)
+{
+    seed_random(seed, stream);
+    std::vector<shared_ptr<hittable>> objects;
+    for (size_t i = 0; i < count; i++)
+        objects.push_back(make());
+    return objects;
+}
+
+shared_ptr<material> grey() { return make_shared<lambertian>(color(.5, .5, .5)); }
+
+shared_ptr<hittable> random_sphere(const shared_ptr<material> &mat)
+{
+    return make_shared<sphere>(point3::random(-8, 8), random_double(0.2, 1.5), mat);
+}
+
+shared_ptr<hittable> random_quad(const shared_ptr<material> &mat)
+{
+    return make_shared<quad>(point3::random(-8, 8), vec3::random(-2, 2), vec3::random(-2, 2), mat);
+}
+
+shared_ptr<hittable> random_triangle(const shared_ptr<material> &mat)
+{
+    return make_shared<triangle>(point3::random(-8, 8), vec3::random(-2, 2), vec3::random(-2, 2), mat);
+}
+
+template <typename Object>
+size_t hit_each(const std::vector<ray> &rays, const std::vector<Object> &objects)
+{
+    // Ray i against object i modulo their number, through the concrete type so the call is not
+    // virtual.
+    size_t hits = 0;
+    hit_record rec;
+    for (size_t i = 0; i < rays.size(); i++)
+        hits += objects[i % objects.size()].hit(rays[i], interval(0.001, infinity), rec);
+    return hits;
+}
+
+std::vector<benchmark> make_benchmarks(const bench_settings &settings)
+{
+    std::vector<benchmark> benchmarks;
+    const auto n = settings.count;
+    const auto seed = settings.seed;
+    auto rays = make_shared<std::vector<ray>>(make_rays(n, seed, 0));
+    auto mat = grey();
+
+    // Single primitives
+
+    {
+        auto boxes = make_shared<std::vector<aabb>>();
+        seed_random(seed, 1);
+        for (size_t i = 0; i < shape_count; i++)
+        {
+            auto center = point3::random(-8, 8);
+            auto half = vec3::random(0.2, 2);
+            boxes->emplace_back(center - half, center + half);
+        }
+        benchmarks.push_back({"aabb::hit", "rays", n, [rays, boxes]
+                              {
+                                  size_t hits = 0;
+                                  for (size_t i = 0; i < rays->size(); i++)
+                                      hits += (*boxes)[i % boxes->size()].hit((*rays)[i], interval(0.001, infinity));
+                                  return hits;
+                              }});
+    }
+
+    auto concrete = [&](auto type_tag, uint64_t stream, shared_ptr<hittable> (*make)(const shared_ptr<material> &))
+    {
+        using Object = typename decltype(type_tag)::type;
+        auto objects = make_shared<std::vector<Object>>();
+        for (const auto &object : make_objects(shape_count, seed, stream, [&] { return make(mat); }))
+            objects->push_back(static_cast<const Object &>(*object));
+        return objects;
+    };
+
+    struct sphere_tag { using type = sphere; };
+    struct quad_tag { using type = quad; };
+    struct triangle_tag { using type = triangle; };
+
+    auto spheres = concrete(sphere_tag(), 2, random_sphere);
+    benchmarks.push_back({"sphere::hit", "rays", n, [rays, spheres] { return hit_each(*rays, *spheres); }});
+    auto quads = concrete(quad_tag(), 3, random_quad);
+    benchmarks.push_back({"quad::hit", "rays", n, [rays, quads] { return hit_each(*rays, *quads); }});
+    auto triangles = concrete(triangle_tag(), 4, random_triangle);
+    benchmarks.push_back({"triangle::hit", "rays", n, [rays, triangles] { return hit_each(*rays, *triangles); }});
+
+    // Traversal of a mixed scene, through each accelerator
+
+    hittable_list world;
+    seed_random(seed, 5);
+    for (int i = 0; i < 4096; i++)
+    {
+        auto choose = random_double();
+        world.add(choose < 0.5 ? random_sphere(mat) : choose < 0.75 ? random_quad(mat) : random_triangle(mat));
+    }
+
+    auto tree = make_shared<bvh_node>(world);
+    scene_compiler compiler;
+    compiler.verbose = false;
+    shared_ptr<hittable> flat = compiler.compile(world);
+
+    auto traverse = [rays](const shared_ptr<hittable> &accelerator)
+    {
+        return [rays, accelerator]
+        {
+            size_t hits = 0;
+            hit_record rec;
+            for (const auto &r : *rays)
+                hits += accelerator->hit(r, interval(0.001, infinity), rec);
+            return hits;
+        };
+    };
+    auto occlude = [rays](const shared_ptr<hittable> &accelerator)
+    {
+        return [rays, accelerator]
+        {
+            size_t blocked = 0;
+            for (const auto &r : *rays)
+                blocked += accelerator->occluded(r, interval(0.001, infinity));
+            return blocked;
+        };
+    };
+    benchmarks.push_back({"bvh_node::hit", "rays", n, traverse(tree)});
+    benchmarks.push_back({"bvh_node::occluded", "rays", n, occlude(tree)});
+    benchmarks.push_back({"flat_bvh::hit", "rays", n, traverse(flat)});
+    benchmarks.push_back({"flat_bvh::occluded", "rays", n, occlude(flat)});
+
+    // Noise
+
+    seed_random(seed, 6);
+    auto noise = make_shared<perlin>();
+    auto noise_points = make_shared<std::vector<point3>>(random_points(n, -50, 50, seed, 7));
+    benchmarks.push_back({"perlin::turb", "calls", n, [noise, noise_points]
+                          {
+                              double sum = 0;
+                              for (const auto &p : *noise_points)
+                                  sum += noise->turb(p, 7);
+                              return size_t(sum);
+                          }});
+    benchmarks.push_back({"perlin::turb batch", "calls", n, [noise, noise_points]
+                          {
+                              std::vector<double> values(noise_points->size());
+                              noise->turb(noise_points->data(), values.data(), values.size(), 7);
+                              double sum = 0;
+                              for (auto v : values)
+                                  sum += v;
+                              return size_t(sum);
+                          }});
+
+    // Transforms
+
+    seed_random(seed, 8);
+    auto transforms = make_shared<std::vector<matrix>>();
+    for (size_t i = 0; i < shape_count; i++)
+        transforms->push_back(matrix(vec3::random(-180, 180), vec3::random(-10, 10)));
+    auto points = make_shared<std::vector<point3>>(random_points(n, -10, 10, seed, 9));
+
+    benchmarks.push_back({"matrix transform_point", "calls", n, [transforms, points]
+                          {
+                              double sum = 0;
+                              for (size_t i = 0; i < points->size(); i++)
+                                  sum += transform_point((*transforms)[i % transforms->size()], (*points)[i]).x();
+                              return size_t(std::fabs(sum));
+                          }});
+    benchmarks.push_back({"matrix operator*", "calls", n, [transforms, n]
+                          {
+                              double sum = 0;
+                              auto count = transforms->size();
+                              for (size_t i = 0; i < n; i++)
+                                  sum += ((*transforms)[i % count] * (*transforms)[(i + 1) % count]).m[0][0];
+                              return size_t(std::fabs(sum));
+                          }});
+    benchmarks.push_back({"matrix inverse", "calls", n, [transforms, n]
+                          {
+                              double sum = 0;
+                              auto count = transforms->size();
+                              for (size_t i = 0; i < n; i++)
+                                  sum += (*transforms)[i % count].inverse().m[3][0];
+                              return size_t(std::fabs(sum));
+                          }});
+
+    return benchmarks;
+}
+
+result measure(const benchmark &bench, int reps, perf_counters *counters)
+{
+    // One untimed run to warm the caches, then reps timed ones. The median is the headline
+    // number: unlike the mean it ignores the odd run another process got in the way of.
+    result out = {bench.name, bench.unit, bench.ops, bench.run(), {}, 0, 0, 0, 0, {}};
+
+    if (counters)
+        counters->start();
+    for (int rep = 0; rep < reps; rep++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        sink = bench.run();
+        auto stop = std::chrono::steady_clock::now();
+        out.ns_per_op.push_back(std::chrono::duration<double, std::nano>(stop - start).count() / bench.ops);
+    }
+    if (counters)
+        counters->stop();
+    for (int e = 0; e < perf_counters::event_count; e++)
+    {
+        auto event = perf_counters::event(e);
+        out.perf_per_op[e] = counters && counters->has(event) ? counters->count(event) / (double(reps) * bench.ops) : -1;
+    }
+
+    auto sorted = out.ns_per_op;
+    std::sort(sorted.begin(), sorted.end());
+    out.min = sorted.front();
+    out.median = sorted.size() % 2 ? sorted[sorted.size() / 2]
+                                   : 0.5 * (sorted[sorted.size() / 2 - 1] + sorted[sorted.size() / 2]);
+
+    double sum = 0, squares = 0;
+    for (auto x : sorted)
+        sum += x;
+    out.mean = sum / sorted.size();
+    for (auto x : sorted)
+        squares += (x - out.mean) * (x - out.mean);
+    out.stddev = sorted.size() > 1 ? std::sqrt(squares / (sorted.size() - 1)) : 0;
+    return out;
+}
+
+void write_json(std::ostream &out, const bench_settings &settings, const std::vector<result> &results)
+{
+    json_writer json(out);
+    json.begin_object();
+    json.value("count", uint64_t(settings.count));
+    json.value("reps", settings.reps);
+    json.value("seed", settings.seed);
+#ifdef RT_FAST_MATH
+    json.value("fast_math", true);
+#else
+    json.value("fast_math", false);
+#endif
+#ifdef __VERSION__
+    json.value("compiler", __VERSION__);
+#endif
+
+    json.begin_array("benchmarks");
+    for (const auto &r : results)
+    {
+        json.begin_object();
+        json.value("name", r.name);
+        json.value("unit", r.unit);
+        json.value("ops", uint64_t(r.ops));
+        json.value("checksum", uint64_t(r.checksum));
+        json.value("ns_per_op_min", r.min);
+        json.value("ns_per_op_median", r.median);
+        json.value("ns_per_op_mean", r.mean);
+        json.value("ns_per_op_stddev", r.stddev);
+        json.value("ops_per_second", 1e9 / r.median);
+        if (settings.perf)
+        {
+            json.begin_object("perf_per_op"); // null where the counter is not available
+            for (int e = 0; e < perf_counters::event_count; e++)
+                json.value(perf_counters::name(perf_counters::event(e)), r.perf_per_op[e] >= 0 ? r.perf_per_op[e] : NAN);
+            json.end_object();
+        }
+        json.begin_array("ns_per_op");
+        for (auto x : r.ns_per_op)
+            json.value(nullptr, x);
+        json.end_array();
+        json.end_object();
+    }
+    json.end_array();
+    json.end_object();
+}
+
+bool parse_arguments(int argc, char **argv, bench_settings &settings)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--perf")
+        {
+            settings.perf = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            std::fprintf(stderr, "ERROR: Option %s needs a value.\n", arg.c_str());
+            return false;
+        }
+        std::string value = argv[++i];
+
+        auto number = [&](auto &out, long long min)
+        {
+            long long parsed;
+            auto result = std::from_chars(value.data(), value.data() + value.size(), parsed);
+            if (result.ec != std::errc() || result.ptr != value.data() + value.size() || parsed < min)
+            {
+                std::fprintf(stderr, "ERROR: Option %s needs an integer of at least %lld.\n", arg.c_str(), min);
+                return false;
+            }
+            out = static_cast<std::remove_reference_t<decltype(out)>>(parsed);
+            return true;
+        };
+
+        bool ok = true;
+        if (arg == "--json")
+            settings.json = value;
+        else if (arg == "--filter")
+            settings.filter = value;
+        else if (arg == "--reps")
+            ok = number(settings.reps, 1);
+        else if (arg == "--count")
+            ok = number(settings.count, 1);
+        else if (arg == "--seed")
+            ok = number(settings.seed, 0);
+        else
+        {
+            std::fprintf(stderr, "ERROR: Unknown option %s.\n", arg.c_str());
+            ok = false;
+        }
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    bench_settings settings;
+    if (!parse_arguments(argc, argv, settings))
+    {
+        std::fprintf(stderr, "Usage: bench [--json FILE] [--filter TEXT] [--reps N] [--count N] [--seed N] [--perf]\n");
+        return 2;
+    }
+
+    // With the JSON report on standard output, the table goes to standard error.
+    FILE *table = settings.json == "-" ? stderr : stdout;
+    perf_counters counters;
+    bool counting = settings.perf && counters.open();
+    if (settings.perf && !counting)
+        std::fprintf(table, "Hardware counters unavailable (%s)\n\n", counters.error().c_str());
+
+    std::fprintf(table, "%zu operations per run, %d runs, seed %llu\n\n", settings.count, settings.reps,
+                 static_cast<unsigned long long>(settings.seed));
+    std::fprintf(table, "%-24s %10s %10s %10s %7s %14s %12s\n", "benchmark", "median ns", "min ns", "mean ns",
+                 "rsd", "per second", "checksum");
+
+    std::vector<result> results;
+    for (const auto &bench : make_benchmarks(settings))
+    {
+        if (bench.name.find(settings.filter) == std::string::npos)
+            continue;
+
+        results.push_back(measure(bench, settings.reps, counting ? &counters : nullptr));
+        const auto &r = results.back();
+        std::fprintf(table, "%-24s %10.2f %10.2f %10.2f %6.1f%% %8.2f M%-5s %12zu\n", r.name.c_str(), r.median, r.min,
+                     r.mean, 100 * r.stddev / r.mean, 1e3 / r.median, r.unit, r.checksum);
+        if (counting)
+        {
+            auto line = perf_counters::describe(r.perf_per_op, std::strcmp(r.unit, "rays") == 0 ? "ray" : "call");
+            std::fprintf(table, "%24s %s\n", "", line.c_str());
+        }
+    }
+
+    if (settings.json == "-")
+        write_json(std::cout, settings, results);
+    else if (!settings.json.empty())
+    {
+        std::ofstream out(settings.json);
+        write_json(out, settings, results);
+        if (!out)
+        {
+            std::fprintf(stderr, "ERROR: Could not write '%s'.\n", settings.json.c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
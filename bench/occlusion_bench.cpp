@@ -0,0 +1,144 @@
+// Shadow rays through closest-hit hit() against the any-hit occluded() query, on every
+// accelerator the renderer can use.
+
+#include "utils.h"
+
+#include "aligned_box.h"
+#include "bvh.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "quad.h"
+#include "scene_compiler.h"
+#include "sphere.h"
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+namespace
+{
+const size_t count = 1 << 18; // Shadow rays per run
+
+volatile size_t sink; // Keeps the timed loops from being optimized away
+
+double nanoseconds_per_ray(const std::function<size_t()> &run)
+{
+    // Best of five runs, to keep other processes out of the numbers.
+    double best = infinity;
+    for (int attempt = 0; attempt < 5; attempt++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        sink = run();
+        auto stop = std::chrono::steady_clock::now();
+        best = std::fmin(best, std::chrono::duration<double, std::nano>(stop - start).count() / count);
+    }
+    return best;
+}
+
+hittable_list make_scene()
+{
+    // A field of small spheres, boxes and triangles under an area light, in the spirit of the
+    // book scenes, with some of it rotated so the transform wrappers take part too.
+    hittable_list world;
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+
+    world.add(box(point3(-12, -1, -12), point3(12, 0, 12), white));
+
+    for (int a = -11; a < 11; a++)
+    {
+        for (int b = -11; b < 11; b++)
+        {
+            point3 center(a + 0.9 * random_double(), 0.2 + 2 * random_double(), b + 0.9 * random_double());
+            auto choose = random_double();
+            if (choose < 0.6)
+                world.add(make_shared<sphere>(center, 0.2, white));
+            else if (choose < 0.8)
+                world.add(box(center - vec3(0.2, 0.2, 0.2), center + vec3(0.2, 0.2, 0.2), white));
+            else
+                world.add(make_shared<rotate>(
+                    make_shared<triangle>(center, vec3(0.4, 0, 0), vec3(0, 0.4, 0.1), white),
+                    vec3(0, 360 * random_double(), 0)));
+        }
+    }
+
+    hittable_list cluster;
+    for (int i = 0; i < 200; i++)
+        cluster.add(make_shared<sphere>(point3::random(-1.5, 1.5), 0.15, white));
+    world.add(make_shared<translate>(make_shared<bvh_node>(cluster), vec3(0, 4, 0)));
+
+    return world;
+}
+
+struct shadow_ray
+{
+    ray r;
+    interval span; // From just off the shading point to just short of the light
+};
+
+std::vector<shadow_ray> make_shadow_rays()
+{
+    // Points just above the ground between the objects, each connected to a random point on
+    // a wide, low light quad, so that a good part of them is blocked.
+    std::vector<shadow_ray> rays;
+    rays.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        point3 from(random_double(-11, 11), random_double(0, 0.5), random_double(-11, 11));
+        point3 light(random_double(-10, 10), 5, random_double(-10, 10));
+        rays.push_back({ray(from, light - from), interval(0.001, 0.999)});
+    }
+    return rays;
+}
+
+void compare(const char *name, const hittable &world, const std::vector<shadow_ray> &rays)
+{
+    // Both queries have to agree on every ray before their timings mean anything.
+    size_t blocked = 0, mismatches = 0;
+    for (const auto &shadow : rays)
+    {
+        hit_record rec;
+        bool hit = world.hit(shadow.r, shadow.span, rec);
+        bool occluded = world.occluded(shadow.r, shadow.span);
+        blocked += hit;
+        mismatches += hit != occluded;
+    }
+
+    auto hit_ns = nanoseconds_per_ray([&] {
+        size_t total = 0;
+        for (const auto &shadow : rays)
+        {
+            hit_record rec;
+            total += world.hit(shadow.r, shadow.span, rec);
+        }
+        return total; });
+    auto occluded_ns = nanoseconds_per_ray([&] {
+        size_t total = 0;
+        for (const auto &shadow : rays)
+            total += world.occluded(shadow.r, shadow.span);
+        return total; });
+
+    std::printf("%-12s blocked %5.1f%%  mismatches %zu  hit %7.1f ns  occluded %7.1f ns  (%.2fx)  %.2f Mrays/s\n",
+                name, 100.0 * blocked / rays.size(), mismatches, hit_ns, occluded_ns, hit_ns / occluded_ns,
+                1e3 / occluded_ns);
+}
+} // namespace
+
+int main()
+{
+    seed_random(0, 0);
+    auto world = make_scene();
+    auto rays = make_shadow_rays();
+
+    scene_compiler compiler;
+    compiler.verbose = false;
+    auto flat = compiler.compile(world);
+    compiler.typed_leaves = false;
+    auto tree = compiler.compile(world);
+    bvh_node uncompiled(world);
+
+    std::printf("%zu shadow rays\n\n", rays.size());
+    compare("flat_bvh", *flat, rays);
+    compare("bvh_node", *tree, rays);
+    compare("uncompiled", uncompiled, rays);
+}
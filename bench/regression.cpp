@@ -0,0 +1,754 @@
+// End-to-end regression harness: renders every scene in scenes/ at a fixed resolution, sample
+// count and seed, and checks speed and image quality against stored references.
+//
+//   regression [--update] [--filter TEXT] [--width N] [--spp N] [--seed N] [--threads N] [--reps N]
+//              [--references DIR] [--output DIR] [--report FILE]
+//              [--max-slowdown X] [--max-relmse X] [--max-flip X] [--perf]
+//
+// With --update the renders become the new references: one PFM per scene plus baseline.json
+// with the settings and timings they were made with. Without it every scene is compared with
+// its reference. A scene passes on speed when its wall time is at most (1 + max-slowdown) times
+// the baseline one, and on quality when its relMSE and FLIP-like error are within the limits.
+// Timings are only compared when the thread counts match; they are only meaningful on the
+// machine the baseline was made on.
+//
+// The report (JSON, default OUTPUT/report.json) has the settings and, per scene, the timings,
+// rays per second, peak RSS, errors and verdicts. Rays are all rays traced in builds with
+// RT_STATS, the camera rays otherwise. With --perf it also has hardware counters (see
+// perf_counters.h) over the tile rendering, per ray. The exit code is 0 when every scene
+// passes, 1 when one fails and 2 for bad arguments or missing references.
+
+#include "utils.h"
+
+#include "camera.h"
+#include "json.h"
+#include "perf_counters.h"
+#include "scene_file.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+struct harness_settings
+{
+    int width = 160; // Image width; the height follows from each scene's aspect ratio
+    int spp = 16;
+    uint64_t seed = 0;
+    int threads = 0; // 0 for one per hardware thread
+    int reps = 1;    // Renders per scene; the fastest one counts
+    bool update = false;
+    bool perf = false; // Read hardware counters
+    std::string filter; // Only scenes whose name contains this
+    std::string references = "regression/references";
+    std::string output = "regression/latest";
+    std::string report; // Defaults to OUTPUT/report.json
+    double max_slowdown = 0.15;
+    double max_relmse = 0.02;
+    double max_flip = 0.05;
+};
+
+struct scene_result
+{
+    std::string name;
+    bool rendered = false;
+    int width = 0, height = 0;
+    double wall_ms = 0; // Loading, compiling, rendering and writing, fastest of the reps
+    double load_ms = 0;
+    render_times times;
+    double rays = 0; // All rays with RT_STATS, camera rays only without
+    render_stats stats;
+    double peak_rss_mb = 0;
+    bool rss_per_scene = false; // Otherwise the peak is that of the whole process so far
+    double perf[perf_counters::event_count] = {-1, -1, -1, -1, -1, -1}; // Over the tiles, -1 if not counted
+
+    double baseline_ms = NAN;
+    double rmse = NAN, relmse = NAN, flip = NAN;
+    bool speed_pass = true, quality_pass = true;
+    std::string reason; // Why the scene failed, empty if it passed
+
+    bool passed() const { return rendered && speed_pass && quality_pass; }
+};
+
+double milliseconds(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+{
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+// Peak resident set size. On Linux the high-water mark can be reset, so it is measured for each
+// scene on its own; elsewhere getrusage() only gives the peak of the process so far.
+
+bool reset_peak_rss()
+{
+#ifdef __linux__
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5";
+    clear_refs.flush();
+    return bool(clear_refs);
+#else
+    return false;
+#endif
+}
+
+double peak_rss_mb(bool since_reset)
+{
+#ifdef __linux__
+    if (since_reset)
+    {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line))
+        {
+            if (line.compare(0, 6, "VmHWM:") == 0)
+                return std::strtod(line.c_str() + 6, nullptr) / 1024; // In kB
+        }
+    }
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss / (1024.0 * 1024.0); // In bytes
+#else
+    return usage.ru_maxrss / 1024.0; // In kB
+#endif
+#else
+    (void)since_reset;
+    return 0;
+#endif
+}
+
+// Reference images
+
+struct float_image
+{
+    int width = 0, height = 0;
+    std::vector<color> pixels; // Rows from the top
+};
+
+bool read_pfm(const std::string &filename, float_image &image)
+{
+    // Reads the color PFM files camera writes: little-endian floats, rows bottom to top.
+    std::ifstream in(filename, std::ios::binary);
+    std::string magic;
+    double scale;
+    in >> magic >> image.width >> image.height >> scale;
+    in.get(); // The single whitespace character before the data
+    if (!in || magic != "PF" || image.width <= 0 || image.height <= 0 || scale >= 0)
+        return false;
+
+    image.pixels.assign(size_t(image.width) * image.height, color(0, 0, 0));
+    std::vector<float> row(3 * size_t(image.width));
+    for (int y = image.height - 1; y >= 0; y--)
+    {
+        in.read(reinterpret_cast<char *>(row.data()), std::streamsize(row.size() * sizeof(float)));
+        for (int x = 0; x < image.width; x++)
+            image.pixels[size_t(y) * image.width + x] = color(row[3 * x], row[3 * x + 1], row[3 * x + 2]);
+    }
+    return bool(in);
+}
+
+// Error metrics. RMSE and relMSE are taken on the linear radiance, relMSE with the usual 0.01 in
+// the denominator so dark pixels do not dominate. The FLIP-like error is a simplification of
+// NVIDIA's FLIP: both images are clamped to displayable values and slightly blurred, as the eye
+// would at a normal viewing distance, then compared per pixel by HyAB distance in CIELAB,
+// normalized to [0, 1] by the largest distance between sRGB colors (green to blue) and
+// compressed with FLIP's 0.7 exponent.
+//
+// Renders are deterministic for a given seed, so an unchanged renderer reproduces its references
+// exactly. The default limits leave room for floating-point differences (another compiler,
+// RT_FAST_MATH); a change to the sampling gives a fresh draw of the noise instead, which at 16
+// samples per pixel is a relMSE of 0.01 to 1.5 and a FLIP-like error of 0.01 to 0.1 depending on
+// the scene, and calls for new references once the images have been checked.
+
+vec3 linear_srgb_to_lab(const color &c)
+{
+    // D65 white point.
+    double x = (0.4124564 * c.x() + 0.3575761 * c.y() + 0.1804375 * c.z()) / 0.95047;
+    double y = 0.2126729 * c.x() + 0.7151522 * c.y() + 0.0721750 * c.z();
+    double z = (0.0193339 * c.x() + 0.1191920 * c.y() + 0.9503041 * c.z()) / 1.08883;
+
+    auto f = [](double t) { return t > 216.0 / 24389 ? std::cbrt(t) : (24389.0 / 27 * t + 16) / 116; };
+    double fx = f(x), fy = f(y), fz = f(z);
+    return vec3(116 * fy - 16, 500 * (fx - fy), 200 * (fy - fz));
+}
+
+double hyab(const vec3 &a, const vec3 &b)
+{
+    double da = a.y() - b.y(), db = a.z() - b.z();
+    return std::fabs(a.x() - b.x()) + std::sqrt(da * da + db * db);
+}
+
+std::vector<vec3> perceptual(const std::vector<color> &pixels, int width, int height)
+{
+    // Clamps to [0, 1], blurs with a separable 1-4-6-4-1 binomial filter, and converts to CIELAB.
+    static const double weights[5] = {1 / 16.0, 4 / 16.0, 6 / 16.0, 4 / 16.0, 1 / 16.0};
+    auto at = [&](const std::vector<color> &image, int x, int y)
+    {
+        x = std::clamp(x, 0, width - 1);
+        y = std::clamp(y, 0, height - 1);
+        return image[size_t(y) * width + x];
+    };
+
+    std::vector<color> clamped(pixels.size()), across(pixels.size());
+    for (size_t i = 0; i < pixels.size(); i++)
+    {
+        for (int c = 0; c < 3; c++)
+            clamped[i][c] = std::clamp(pixels[i][c], 0.0, 1.0);
+    }
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            color sum(0, 0, 0);
+            for (int k = -2; k <= 2; k++)
+                sum += weights[k + 2] * at(clamped, x + k, y);
+            across[size_t(y) * width + x] = sum;
+        }
+    }
+
+    std::vector<vec3> lab(pixels.size());
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            color sum(0, 0, 0);
+            for (int k = -2; k <= 2; k++)
+                sum += weights[k + 2] * at(across, x, y + k);
+            lab[size_t(y) * width + x] = linear_srgb_to_lab(sum);
+        }
+    }
+    return lab;
+}
+
+void compare(const std::vector<color> &test, const float_image &reference, scene_result &result)
+{
+    double squares = 0, relative = 0;
+    for (size_t i = 0; i < test.size(); i++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            double difference = test[i][c] - reference.pixels[i][c];
+            squares += difference * difference;
+            relative += difference * difference / (reference.pixels[i][c] * reference.pixels[i][c] + 0.01);
+        }
+    }
+    result.rmse = std::sqrt(squares / (3 * test.size()));
+    result.relmse = relative / (3 * test.size());
+
+    auto test_lab = perceptual(test, reference.width, reference.height);
+    auto reference_lab = perceptual(reference.pixels, reference.width, reference.height);
+    const double max_distance = hyab(linear_srgb_to_lab(color(0, 1, 0)), linear_srgb_to_lab(color(0, 0, 1)));
+    double error = 0;
+    for (size_t i = 0; i < test_lab.size(); i++)
+        error += std::pow(std::min(1.0, hyab(test_lab[i], reference_lab[i]) / max_distance), 0.7);
+    result.flip = error / test_lab.size();
+}
+
+// Baseline of the references: the settings they were rendered with and their timings
+
+struct baseline
+{
+    int width = 0, spp = 0, threads = 0;
+    uint64_t seed = 0;
+    std::vector<std::pair<std::string, double>> wall_ms;
+
+    double find(const std::string &name) const
+    {
+        for (const auto &entry : wall_ms)
+        {
+            if (entry.first == name)
+                return entry.second;
+        }
+        return NAN;
+    }
+};
+
+bool read_baseline(const std::string &filename, baseline &out)
+{
+    std::ifstream in(filename, std::ios::binary);
+    std::stringstream text;
+    text << in.rdbuf();
+    if (!in)
+    {
+        std::cerr << "ERROR: Could not read '" << filename << "'; make the references with --update first.\n";
+        return false;
+    }
+
+    json_value root;
+    std::string error;
+    auto data = text.str();
+    if (!json_parser().parse(data.data(), data.size(), root, error))
+    {
+        std::cerr << "ERROR: " << filename << ":" << error << "\n";
+        return false;
+    }
+
+    auto number = [&](const char *key, double &value)
+    {
+        auto member = root.is_object() ? root.find(key) : nullptr;
+        if (!member || !member->is_number())
+            return false;
+        value = member->number;
+        return true;
+    };
+    double width, spp, seed, threads;
+    auto scenes = root.is_object() ? root.find("scenes") : nullptr;
+    if (!number("width", width) || !number("spp", spp) || !number("seed", seed) || !number("threads", threads) ||
+        !scenes || !scenes->is_array())
+    {
+        std::cerr << "ERROR: " << filename << " is not a baseline written by --update.\n";
+        return false;
+    }
+    out.width = int(width);
+    out.spp = int(spp);
+    out.seed = uint64_t(seed);
+    out.threads = int(threads);
+
+    for (const auto &scene : scenes->items)
+    {
+        auto name = scene.is_object() ? scene.find("name") : nullptr;
+        auto wall = scene.is_object() ? scene.find("wall_ms") : nullptr;
+        if (name && name->is_string() && wall && wall->is_number())
+            out.wall_ms.emplace_back(name->string, wall->number);
+    }
+    return true;
+}
+
+bool write_baseline(const std::string &filename, const harness_settings &settings, int threads,
+                    const std::vector<scene_result> &results, const baseline &previous)
+{
+    // Scenes left out by --filter keep their previous timings if those were made with the
+    // same settings.
+    std::vector<std::pair<std::string, double>> wall_ms;
+    for (const auto &r : results)
+        wall_ms.emplace_back(r.name, r.wall_ms);
+    if (previous.width == settings.width && previous.spp == settings.spp && previous.seed == settings.seed &&
+        previous.threads == threads)
+    {
+        for (const auto &entry : previous.wall_ms)
+        {
+            bool rendered = false;
+            for (const auto &r : results)
+                rendered = rendered || r.name == entry.first;
+            if (!rendered)
+                wall_ms.push_back(entry);
+        }
+        std::sort(wall_ms.begin(), wall_ms.end());
+    }
+
+    std::ofstream out(filename);
+    json_writer json(out);
+    json.begin_object();
+    json.value("width", settings.width);
+    json.value("spp", settings.spp);
+    json.value("seed", settings.seed);
+    json.value("threads", threads);
+    json.begin_array("scenes");
+    for (const auto &entry : wall_ms)
+    {
+        json.begin_object();
+        json.value("name", entry.first);
+        json.value("wall_ms", entry.second);
+        json.end_object();
+    }
+    json.end_array();
+    json.end_object();
+    out << "\n";
+    return bool(out);
+}
+
+// Rendering
+
+bool render_scene(const std::string &filename, const harness_settings &settings, perf_counters *counters,
+                  scene_result &result)
+{
+    // Renders the scene settings.reps times into OUTPUT/<name>.pfm, keeping the fastest timings
+    // and their counters. The camera's progress output is silenced; errors still reach std::cerr.
+    result.rss_per_scene = reset_peak_rss();
+
+    for (int rep = 0; rep < settings.reps; rep++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        scene_file scene;
+        if (!scene.load(filename))
+            return false;
+        auto loaded = std::chrono::steady_clock::now();
+
+        auto &cam = scene.cam;
+        cam.image_width = settings.width;
+        cam.samples_per_pixel = settings.spp;
+        cam.seed = settings.seed;
+        cam.threads = settings.threads;
+        cam.bvh_cache.clear(); // The build is part of what is timed
+        cam.output = (std::filesystem::path(settings.output) / (result.name + ".pfm")).string();
+        cam.format = image_format::pfm;
+        cam.tile_counters = counters;
+
+        auto log = std::clog.rdbuf(nullptr);
+        bool ok = cam.render(scene.world);
+        std::clog.rdbuf(log);
+        std::clog.clear();
+        if (!ok)
+            return false;
+        auto stop = std::chrono::steady_clock::now();
+
+        double wall = milliseconds(start, stop);
+        if (rep == 0 || wall < result.wall_ms)
+        {
+            result.wall_ms = wall;
+            result.load_ms = milliseconds(start, loaded);
+            result.times = cam.last_times();
+            for (int e = 0; counters && e < perf_counters::event_count; e++)
+            {
+                auto event = perf_counters::event(e);
+                result.perf[e] = counters->has(event) ? counters->count(event) : -1;
+            }
+        }
+        result.width = cam.image_width;
+        result.height = cam.rendered_height();
+        result.stats = cam.last_stats();
+        result.rays = render_stats::enabled ? double(result.stats.rays())
+                                            : double(result.width) * result.height * cam.samples_per_pixel;
+    }
+
+    result.peak_rss_mb = peak_rss_mb(result.rss_per_scene);
+    result.rendered = true;
+    return true;
+}
+
+void check(const harness_settings &settings, const baseline &base, bool compare_speed, scene_result &result)
+{
+    float_image reference;
+    auto reference_file = (std::filesystem::path(settings.references) / (result.name + ".pfm")).string();
+    auto rendered_file = (std::filesystem::path(settings.output) / (result.name + ".pfm")).string();
+    float_image rendered;
+    if (!read_pfm(reference_file, reference))
+    {
+        result.quality_pass = false;
+        result.reason = "no reference image";
+    }
+    else if (!read_pfm(rendered_file, rendered) || rendered.width != reference.width ||
+             rendered.height != reference.height)
+    {
+        result.quality_pass = false;
+        result.reason = "image size differs from the reference";
+    }
+    else
+    {
+        compare(rendered.pixels, reference, result);
+        result.quality_pass = result.relmse <= settings.max_relmse && result.flip <= settings.max_flip;
+        if (!result.quality_pass)
+            result.reason = "image differs from the reference";
+    }
+
+    result.baseline_ms = base.find(result.name);
+    if (compare_speed && std::isfinite(result.baseline_ms))
+    {
+        result.speed_pass = result.wall_ms <= (1 + settings.max_slowdown) * result.baseline_ms;
+        if (!result.speed_pass)
+            result.reason += std::string(result.reason.empty() ? "" : ", ") + "slower than the baseline";
+    }
+}
+
+void write_report(std::ostream &out, const harness_settings &settings, int threads, bool compare_speed,
+                  const std::vector<scene_result> &results)
+{
+    bool passed = true;
+    for (const auto &r : results)
+        passed = passed && (settings.update ? r.rendered : r.passed());
+
+    json_writer json(out);
+    json.begin_object();
+    json.value("mode", settings.update ? "update" : "check");
+    json.value("passed", passed);
+    json.begin_object("settings");
+    json.value("width", settings.width);
+    json.value("spp", settings.spp);
+    json.value("seed", settings.seed);
+    json.value("threads", threads);
+    json.value("reps", settings.reps);
+    json.value("max_slowdown", settings.max_slowdown);
+    json.value("max_relmse", settings.max_relmse);
+    json.value("max_flip", settings.max_flip);
+    json.value("speed_compared", compare_speed);
+#ifdef RT_FAST_MATH
+    json.value("fast_math", true);
+#else
+    json.value("fast_math", false);
+#endif
+#ifdef __VERSION__
+    json.value("compiler", __VERSION__);
+#endif
+    json.end_object();
+
+    json.begin_array("scenes");
+    for (const auto &r : results)
+    {
+        json.begin_object();
+        json.value("name", r.name);
+        json.value("passed", settings.update ? r.rendered : r.passed());
+        json.value("reason", r.rendered ? r.reason : std::string("render failed"));
+        json.value("width", r.width);
+        json.value("height", r.height);
+        json.value("wall_ms", r.wall_ms);
+        json.value("load_ms", r.load_ms);
+        json.value("compile_ms", r.times.compile);
+        json.value("texture_wait_ms", r.times.texture_wait);
+        json.value("render_ms", r.times.render);
+        json.value("write_ms", r.times.write);
+        json.value("rays", r.rays);
+        json.value("rays_counted", render_stats::enabled ? "all" : "primary");
+        json.value("rays_per_second", r.times.render > 0 ? 1e3 * r.rays / r.times.render : NAN);
+        if (render_stats::enabled)
+        {
+            json.value("bvh_nodes_per_ray", r.rays > 0 ? double(r.stats.bvh_nodes) / r.rays : NAN);
+            json.value("primitive_tests_per_ray", r.rays > 0 ? double(r.stats.primitive_tests()) / r.rays : NAN);
+        }
+        json.value("peak_rss_mb", r.peak_rss_mb);
+        if (settings.perf)
+        {
+            json.begin_object("perf_per_ray"); // null where the counter is not available
+            for (int e = 0; e < perf_counters::event_count; e++)
+            {
+                double per_ray = r.perf[e] >= 0 && r.rays > 0 ? r.perf[e] / r.rays : NAN;
+                json.value(perf_counters::name(perf_counters::event(e)), per_ray);
+            }
+            json.end_object();
+        }
+        json.value("peak_rss_scope", r.rss_per_scene ? "scene" : "process");
+        json.value("baseline_wall_ms", r.baseline_ms);
+        json.value("slowdown", r.wall_ms / r.baseline_ms - 1);
+        json.value("speed_pass", r.speed_pass);
+        json.value("rmse", r.rmse);
+        json.value("relmse", r.relmse);
+        json.value("flip", r.flip);
+        json.value("quality_pass", r.quality_pass);
+        json.end_object();
+    }
+    json.end_array();
+    json.end_object();
+    out << "\n";
+}
+
+bool parse_arguments(int argc, char **argv, harness_settings &settings)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--update")
+        {
+            settings.update = true;
+            continue;
+        }
+        if (arg == "--perf")
+        {
+            settings.perf = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            std::fprintf(stderr, "ERROR: Option %s needs a value.\n", arg.c_str());
+            return false;
+        }
+        std::string value = argv[++i];
+
+        auto number = [&](auto &out, long long min)
+        {
+            long long parsed;
+            auto result = std::from_chars(value.data(), value.data() + value.size(), parsed);
+            if (result.ec != std::errc() || result.ptr != value.data() + value.size() || parsed < min)
+            {
+                std::fprintf(stderr, "ERROR: Option %s needs an integer of at least %lld.\n", arg.c_str(), min);
+                return false;
+            }
+            out = static_cast<std::remove_reference_t<decltype(out)>>(parsed);
+            return true;
+        };
+        auto limit = [&](double &out)
+        {
+            char *end;
+            out = std::strtod(value.c_str(), &end);
+            if (value.empty() || *end != '\0' || !(out >= 0))
+            {
+                std::fprintf(stderr, "ERROR: Option %s needs a non-negative number.\n", arg.c_str());
+                return false;
+            }
+            return true;
+        };
+
+        bool ok = true;
+        if (arg == "--filter")
+            settings.filter = value;
+        else if (arg == "--width")
+            ok = number(settings.width, 1);
+        else if (arg == "--spp")
+            ok = number(settings.spp, 1);
+        else if (arg == "--seed")
+            ok = number(settings.seed, 0);
+        else if (arg == "--threads")
+            ok = number(settings.threads, 0);
+        else if (arg == "--reps")
+            ok = number(settings.reps, 1);
+        else if (arg == "--references")
+            settings.references = value;
+        else if (arg == "--output")
+            settings.output = value;
+        else if (arg == "--report")
+            settings.report = value;
+        else if (arg == "--max-slowdown")
+            ok = limit(settings.max_slowdown);
+        else if (arg == "--max-relmse")
+            ok = limit(settings.max_relmse);
+        else if (arg == "--max-flip")
+            ok = limit(settings.max_flip);
+        else
+        {
+            std::fprintf(stderr, "ERROR: Unknown option %s.\n", arg.c_str());
+            ok = false;
+        }
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    harness_settings settings;
+    if (!parse_arguments(argc, argv, settings))
+    {
+        std::fprintf(stderr, "Usage: regression [--update] [--filter TEXT] [--width N] [--spp N] [--seed N] "
+                             "[--threads N] [--reps N] [--references DIR] [--output DIR] [--report FILE] "
+                             "[--max-slowdown X] [--max-relmse X] [--max-flip X] [--perf]\n");
+        return 2;
+    }
+    if (settings.report.empty())
+        settings.report = (std::filesystem::path(settings.output) / "report.json").string();
+    int threads = settings.threads > 0 ? settings.threads : int(std::max(1u, std::thread::hardware_concurrency()));
+
+    auto directory = scene_file::directory();
+    if (directory.empty())
+    {
+        std::fprintf(stderr, "ERROR: Could not find the scenes directory; set RTW_SCENES.\n");
+        return 2;
+    }
+    std::vector<std::filesystem::path> scene_files;
+    for (const auto &entry : std::filesystem::directory_iterator(directory))
+    {
+        auto name = entry.path().stem().string();
+        if (entry.is_regular_file() && entry.path().extension() == ".json" &&
+            name.find(settings.filter) != std::string::npos)
+            scene_files.push_back(entry.path());
+    }
+    std::sort(scene_files.begin(), scene_files.end());
+
+    std::error_code ec;
+    std::filesystem::create_directories(settings.output, ec);
+    if (settings.update)
+        std::filesystem::create_directories(settings.references, ec);
+
+    baseline base;
+    auto baseline_file = (std::filesystem::path(settings.references) / "baseline.json").string();
+    if (settings.update)
+    {
+        if (std::filesystem::exists(baseline_file, ec))
+            read_baseline(baseline_file, base);
+    }
+    else
+    {
+        if (!read_baseline(baseline_file, base))
+            return 2;
+        if (base.width != settings.width || base.spp != settings.spp || base.seed != settings.seed)
+        {
+            std::fprintf(stderr, "ERROR: The references were rendered at width %d, %d spp, seed %llu; run with "
+                                 "those settings or make new references with --update.\n",
+                         base.width, base.spp, static_cast<unsigned long long>(base.seed));
+            return 2;
+        }
+    }
+    bool compare_speed = !settings.update && base.threads == threads;
+    if (!settings.update && !compare_speed)
+        std::printf("The baseline was timed on %d threads, not %d; only checking quality.\n", base.threads, threads);
+
+    perf_counters counters;
+    bool counting = settings.perf && counters.open();
+    if (settings.perf && !counting)
+        std::printf("Hardware counters unavailable (%s)\n", counters.error().c_str());
+
+    std::printf("%zu scenes at width %d, %d spp, seed %llu, %d threads\n\n", scene_files.size(), settings.width,
+                settings.spp, static_cast<unsigned long long>(settings.seed), threads);
+    std::printf("%-20s %10s %10s %9s %8s %10s %10s %8s  %s\n", "scene", "wall ms", "base ms", "Mrays/s", "RSS MB",
+                "RMSE", "relMSE", "FLIP", "result");
+
+    std::vector<scene_result> results;
+    bool passed = true;
+    for (const auto &file : scene_files)
+    {
+        scene_result r;
+        r.name = file.stem().string();
+        if (render_scene(file.string(), settings, counting ? &counters : nullptr, r))
+        {
+            if (settings.update)
+            {
+                auto rendered = std::filesystem::path(settings.output) / (r.name + ".pfm");
+                auto reference = std::filesystem::path(settings.references) / (r.name + ".pfm");
+                if (!std::filesystem::copy_file(rendered, reference, std::filesystem::copy_options::overwrite_existing, ec))
+                {
+                    std::fprintf(stderr, "ERROR: Could not write '%s'.\n", reference.string().c_str());
+                    r.rendered = false;
+                }
+            }
+            else
+                check(settings, base, compare_speed, r);
+        }
+
+        bool ok = settings.update ? r.rendered : r.passed();
+        passed = passed && ok;
+        std::printf("%-20s %10.1f %10.1f %9.3f %8.1f %10.4g %10.4g %8.4f  %s\n", r.name.c_str(), r.wall_ms,
+                    r.baseline_ms, r.times.render > 0 ? 1e-3 * r.rays / r.times.render : 0.0, r.peak_rss_mb,
+                    r.rmse, r.relmse, r.flip,
+                    !r.rendered ? "render failed" : settings.update ? "updated" : ok ? "pass" : r.reason.c_str());
+        if (counting && r.rendered && r.rays > 0)
+        {
+            double per_ray[perf_counters::event_count];
+            for (int e = 0; e < perf_counters::event_count; e++)
+                per_ray[e] = r.perf[e] >= 0 ? r.perf[e] / r.rays : -1;
+            std::printf("%20s %s\n", "", perf_counters::describe(per_ray, "ray").c_str());
+        }
+        std::fflush(stdout);
+        results.push_back(r);
+    }
+
+    if (settings.update && passed && !write_baseline(baseline_file, settings, threads, results, base))
+    {
+        std::fprintf(stderr, "ERROR: Could not write '%s'.\n", baseline_file.c_str());
+        passed = false;
+    }
+
+    std::ofstream report(settings.report);
+    write_report(report, settings, threads, compare_speed, results);
+    if (!report)
+    {
+        std::fprintf(stderr, "ERROR: Could not write '%s'.\n", settings.report.c_str());
+        return 1;
+    }
+    std::printf("\n%s; report in %s\n", passed ? "Passed" : "FAILED", settings.report.c_str());
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,325 @@
+#ifndef ALIGNED_BOX_H
+#define ALIGNED_BOX_H
+
+#include "hittable.h"
+#include "quad.h"
+
+struct box_shape // Plain geometry of a solid axis-aligned box: just its two extreme corners
+{
+    point3 bmin, bmax;
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const
+    {
+        // Fills in everything about the hit except the material.
+        RT_STAT(thread_stats().tests[stat_box]++);
+
+        const point3 &orig = r.origin();
+        const vec3 &dir = r.direction();
+
+        // The ray enters the box through the last near plane it crosses and leaves it through
+        // the first far plane. Remember which axis each of those planes belongs to.
+        double t_near = -infinity, t_far = infinity;
+        int near_axis = 0, far_axis = 0;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const double adinv = 1.0 / dir[axis];
+
+            auto t0 = (bmin[axis] - orig[axis]) * adinv;
+            auto t1 = (bmax[axis] - orig[axis]) * adinv;
+            if (t1 < t0)
+                std::swap(t0, t1);
+
+            if (t0 > t_near)
+            {
+                t_near = t0;
+                near_axis = axis;
+            }
+            if (t1 < t_far)
+            {
+                t_far = t1;
+                far_axis = axis;
+            }
+        }
+
+        if (t_far < t_near)
+            return false;
+
+        // Prefer the entry point; fall back to the exit point when the ray starts inside.
+        double t;
+        int axis;
+        bool entering;
+        if (ray_t.contains(t_near))
+        {
+            t = t_near;
+            axis = near_axis;
+            entering = true;
+        }
+        else if (ray_t.contains(t_far))
+        {
+            t = t_far;
+            axis = far_axis;
+            entering = false;
+        }
+        else
+            return false;
+
+        // Entering through a face means travelling against its outward normal.
+        bool max_side = entering ? dir[axis] < 0 : dir[axis] > 0;
+        vec3 outward_normal(0, 0, 0);
+        outward_normal[axis] = max_side ? 1 : -1;
+
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.set_face_normal(r, outward_normal);
+        get_face_uv(rec.p, axis, max_side, rec.u, rec.v);
+
+        // Every face maps its whole extent to the unit square.
+        auto a1 = (axis + 1) % 3, a2 = (axis + 2) % 3;
+        rec.uv_area = 1 / ((bmax[a1] - bmin[a1]) * (bmax[a2] - bmin[a2]));
+        RT_STAT(thread_stats().hits[stat_box]++);
+        return true;
+    }
+
+    bool occluded(const ray &r, interval ray_t) const
+    {
+        // The slab test alone: whether the entry or exit point lies within ray_t.
+
+        const point3 &orig = r.origin();
+        const vec3 &dir = r.direction();
+        double t_near = -infinity, t_far = infinity;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const double adinv = 1.0 / dir[axis];
+
+            auto t0 = (bmin[axis] - orig[axis]) * adinv;
+            auto t1 = (bmax[axis] - orig[axis]) * adinv;
+            if (t1 < t0)
+                std::swap(t0, t1);
+
+            t_near = std::fmax(t_near, t0);
+            t_far = std::fmin(t_far, t1);
+        }
+
+        return t_near <= t_far && (ray_t.contains(t_near) || ray_t.contains(t_far));
+    }
+
+    void get_face_uv(const point3 &p, int axis, bool max_side, double &u, double &v) const
+    {
+        // Reproduces the UV layout of the six quads built by box_sides(), so that textured
+        // boxes look the same whichever representation is used.
+
+        auto x = fraction(p, 0);
+        auto y = fraction(p, 1);
+        auto z = fraction(p, 2);
+
+        switch (axis)
+        {
+        case 0: // right (+X) / left (-X)
+            u = max_side ? 1 - z : z;
+            v = y;
+            break;
+        case 1: // top (+Y) / bottom (-Y)
+            u = x;
+            v = max_side ? 1 - z : z;
+            break;
+        default: // front (+Z) / back (-Z)
+            u = max_side ? x : 1 - x;
+            v = y;
+            break;
+        }
+    }
+
+    double fraction(const point3 &p, int axis) const
+    {
+        // Position of p along the given axis, as a fraction of the box extent.
+        auto extent = bmax[axis] - bmin[axis];
+        return extent > 0 ? (p[axis] - bmin[axis]) / extent : 0;
+    }
+};
+
+struct oriented_box_shape // A box_shape in a frame of its own, turned and moved into place
+{
+    box_shape box; // In the box frame
+    vec3 axes[3];  // Axes of the box frame in world space, orthonormal
+    point3 origin; // Origin of the box frame in world space
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const
+    {
+        // The slab test runs in the box frame. A rigid motion leaves the ray parameter, the
+        // face UVs and their areas as they are; only the point and normal go back to world space.
+        if (!box.hit(to_box(r), ray_t, rec))
+            return false;
+
+        rec.p = r.at(rec.t);
+        rec.normal = to_world(rec.normal);
+        return true;
+    }
+
+    bool occluded(const ray &r, interval ray_t) const { return box.occluded(to_box(r), ray_t); }
+
+    aabb bounding_box() const
+    {
+        aabb bounds = aabb::empty;
+        for (int corner = 0; corner < 8; corner++)
+        {
+            point3 p(corner & 1 ? box.bmax.x() : box.bmin.x(), corner & 2 ? box.bmax.y() : box.bmin.y(),
+                     corner & 4 ? box.bmax.z() : box.bmin.z());
+            point3 q = origin + to_world(p);
+            bounds = aabb(bounds, aabb(q, q));
+        }
+        return bounds;
+    }
+
+    ray to_box(const ray &r) const { return ray(to_local(r.origin() - origin), to_local(r.direction()), r.time()); }
+    vec3 to_local(const vec3 &v) const { return vec3(dot(v, axes[0]), dot(v, axes[1]), dot(v, axes[2])); }
+    vec3 to_world(const vec3 &v) const { return v.x() * axes[0] + v.y() * axes[1] + v.z() * axes[2]; }
+};
+
+class aligned_box : public hittable // Solid axis-aligned box, intersected with a single slab test
+{
+public:
+    aligned_box(const point3 &a, const point3 &b, shared_ptr<material> mat) : mat(mat)
+    {
+        // Treat the two points a and b as opposite corners, so we don't require a particular
+        // minimum/maximum coordinate order.
+        for (int axis = 0; axis < 3; axis++)
+        {
+            shape.bmin[axis] = std::fmin(a[axis], b[axis]);
+            shape.bmax[axis] = std::fmax(a[axis], b[axis]);
+        }
+        bbox = aabb(shape.bmin, shape.bmax);
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        if (!shape.hit(r, ray_t, rec))
+            return false;
+
+        rec.mat = mat.get();
+        return true;
+    }
+
+    bool occluded(const ray &r, interval ray_t) const override { return shape.occluded(r, ray_t); }
+
+    aabb bounding_box() const override { return bbox; }
+    vec3 center() const override { return 0.5 * (shape.bmin + shape.bmax); }
+
+    bool bake(const matrix &trans, std::vector<shared_ptr<hittable>> &out) const override;
+
+    const box_shape &geometry() const { return shape; }
+    const shared_ptr<material> &material_ptr() const { return mat; }
+
+private:
+    box_shape shape;
+    shared_ptr<material> mat;
+    aabb bbox;
+};
+
+class oriented_box : public hittable // Solid box baked from a rotation, intersected in its own frame
+{
+public:
+    oriented_box(const oriented_box_shape &shape, shared_ptr<material> mat)
+        : shape(shape), mat(mat), bbox(shape.bounding_box()) {}
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        if (!shape.hit(r, ray_t, rec))
+            return false;
+
+        rec.mat = mat.get();
+        return true;
+    }
+
+    bool occluded(const ray &r, interval ray_t) const override { return shape.occluded(r, ray_t); }
+
+    aabb bounding_box() const override { return bbox; }
+    vec3 center() const override { return shape.origin + shape.to_world(0.5 * (shape.box.bmin + shape.box.bmax)); }
+
+    bool bake(const matrix &trans, std::vector<shared_ptr<hittable>> &out) const override
+    {
+        // Further rotations, uniform scaling and translations move the frame and scale the box.
+        // Anything else turns it into six baked quads.
+        if (typeid(*this) != typeid(oriented_box))
+            return false;
+
+        double s;
+        if (!uniform_scale_of(trans, s))
+        {
+            matrix placement(shape.axes[0], shape.axes[1], shape.axes[2]);
+            for (int axis = 0; axis < 3; axis++)
+                placement.m[3][axis] = shape.origin[axis];
+            auto sides = box_sides(shape.box.bmin, shape.box.bmax, mat);
+            for (const auto &side : sides->objects)
+                side->bake(trans * placement, out);
+            return true;
+        }
+
+        oriented_box_shape baked;
+        baked.box.bmin = s * shape.box.bmin;
+        baked.box.bmax = s * shape.box.bmax;
+        for (int axis = 0; axis < 3; axis++)
+            baked.axes[axis] = transform_vector(trans, shape.axes[axis]) / s;
+        baked.origin = transform_point(trans, shape.origin);
+        out.push_back(make_shared<oriented_box>(baked, mat));
+        return true;
+    }
+
+    const oriented_box_shape &geometry() const { return shape; }
+    const shared_ptr<material> &material_ptr() const { return mat; }
+
+private:
+    oriented_box_shape shape;
+    shared_ptr<material> mat;
+    aabb bbox;
+};
+
+inline bool aligned_box::bake(const matrix &trans, std::vector<shared_ptr<hittable>> &out) const
+{
+    // A positive per-axis scale plus translation keeps the box axis-aligned, with the same
+    // faces and UVs. Rotations with a uniform scale make an oriented_box, which keeps the single
+    // slab test; anything else (mirroring, shearing) turns the box into six baked quads.
+    if (typeid(*this) != typeid(aligned_box))
+        return false;
+
+    bool axis_aligned = true;
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            if (i == j ? trans.m[i][j] <= 0 : trans.m[i][j] != 0)
+                axis_aligned = false;
+
+    if (axis_aligned)
+    {
+        out.push_back(make_shared<aligned_box>(
+            transform_point(trans, shape.bmin), transform_point(trans, shape.bmax), mat));
+        return true;
+    }
+
+    double s;
+    if (uniform_scale_of(trans, s))
+    {
+        oriented_box_shape baked;
+        baked.box.bmin = s * shape.bmin;
+        baked.box.bmax = s * shape.bmax;
+        baked.axes[0] = transform_vector(trans, vec3(1, 0, 0)) / s;
+        baked.axes[1] = transform_vector(trans, vec3(0, 1, 0)) / s;
+        baked.axes[2] = transform_vector(trans, vec3(0, 0, 1)) / s;
+        baked.origin = transform_point(trans, point3(0, 0, 0));
+        out.push_back(make_shared<oriented_box>(baked, mat));
+        return true;
+    }
+
+    auto sides = box_sides(shape.bmin, shape.bmax, mat);
+    for (const auto &side : sides->objects)
+        side->bake(trans, out);
+    return true;
+}
+
+inline shared_ptr<hittable> box(const point3 &a, const point3 &b, shared_ptr<material> mat)
+{
+    // Returns the solid 3D box that contains the two opposite vertices a & b.
+    return make_shared<aligned_box>(a, b, mat);
+}
+
+#endif
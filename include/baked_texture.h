@@ -0,0 +1,355 @@
+#ifndef BAKED_TEXTURE_H
+#define BAKED_TEXTURE_H
+
+#include "aabb.h"
+#include "texture.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <string>
+#include <vector>
+
+class baked_texture : public texture // Procedural texture sampled once into a grid, then looked up with filtering
+{
+public:
+    // Maps the UV coordinates of a primitive to its surface point, as the surface_point()
+    // member of its shape does.
+    using surface_map = std::function<point3(double u, double v)>;
+
+    baked_texture(shared_ptr<texture> source, const aabb &bounds, int resolution, const std::string &cache_name = "")
+        : source(source)
+    {
+        // Volume bake: samples the source on a grid of cubic cells over `bounds`, `resolution`
+        // cells along its longest side. Lookups ignore u,v, so this is for solid textures that
+        // only depend on the point (noise, checkers); points outside the bounds fall back to
+        // evaluating the source. A non-empty cache name stores the grid on disk under that name;
+        // it is baked again when the source texture or its parameters change, and not cached at
+        // all for sources texture::describe() cannot identify.
+        pending = asset_pool().submit([source, bounds, resolution, cache_name]
+                                      {
+                                          RT_TRACE_ZONE("bake volume texture", cache_name);
+                                          return bake_volume(*source, bounds, resolution, cache_name);
+                                      }).share();
+    }
+
+    baked_texture(shared_ptr<texture> source, surface_map surface, int width, int height,
+                  const std::string &cache_name = "")
+        : source(source)
+    {
+        // Surface bake: samples the source over the UV domain of one primitive, whose surface
+        // points `surface` provides, into a mip-mapped image. Only use it on that primitive; the
+        // cache cannot tell when the primitive changes.
+        pending = asset_pool().submit([source, surface, width, height, cache_name]
+                                      {
+                                          RT_TRACE_ZONE("bake surface texture", cache_name);
+                                          return bake_surface(*source, surface, width, height, cache_name);
+                                      }).share();
+    }
+
+    color value(double u, double v, const point3 &p) const override
+    {
+        return value(u, v, p, 0);
+    }
+
+    color value(double u, double v, const point3 &p, double footprint) const override
+    {
+        const baked_grid &grid = loaded_grid();
+
+        if (grid.image)
+        {
+            // Same conventions as image_texture.
+            u = interval(0, 1).clamp(u);
+            v = 1.0 - interval(0, 1).clamp(v);
+
+            auto texels = footprint * std::sqrt(double(grid.image->width()) * grid.image->height());
+            auto lod = texels > 1 ? std::log2(texels) : 0.0;
+            return grid.image->sample(u, v, lod, texture_filter::trilinear);
+        }
+
+        if (!grid.covers(p))
+            return source->value(u, v, p, footprint);
+        return grid.volume_sample(p);
+    }
+
+private:
+    struct baked_grid
+    {
+        shared_ptr<const rtw_image> image; // Surface bakes
+
+        // Volume bakes: RGB samples at the cell centers, stored in bricks of 4x4x4 samples (like
+        // the tiles of rtw_image) so the corners of a lookup mostly share a cache line or two.
+        point3 origin;
+        double cell = 0;
+        int size[3] = {0, 0, 0};
+        std::vector<float> texels;
+
+        static const int brick = 4;
+
+        size_t texel_index(int x, int y, int z) const
+        {
+            int bricks_x = (size[0] + brick - 1) / brick, bricks_y = (size[1] + brick - 1) / brick;
+            size_t brick_index = (size_t(z / brick) * bricks_y + y / brick) * bricks_x + x / brick;
+            int within = ((z % brick) * brick + y % brick) * brick + x % brick;
+            return 3 * (brick_index * brick * brick * brick + within);
+        }
+
+        size_t texel_count() const
+        {
+            // Samples including the padding of the bricks at the far sides.
+            size_t count = 1;
+            for (int axis = 0; axis < 3; axis++)
+                count *= size_t((size[axis] + brick - 1) / brick * brick);
+            return count;
+        }
+
+        bool covers(const point3 &p) const
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                auto x = (p[axis] - origin[axis]) / cell;
+                if (!(x >= 0 && x <= size[axis]))
+                    return false;
+            }
+            return true;
+        }
+
+        color volume_sample(const point3 &p) const
+        {
+            // Trilinear interpolation between the eight samples around p.
+            int i0[3], i1[3];
+            double t[3];
+            for (int axis = 0; axis < 3; axis++)
+            {
+                auto x = (p[axis] - origin[axis]) / cell - 0.5;
+                auto fx = std::floor(x);
+                t[axis] = x - fx;
+                i0[axis] = std::min(std::max(int(fx), 0), size[axis] - 1);
+                i1[axis] = std::min(std::max(int(fx) + 1, 0), size[axis] - 1);
+            }
+
+            color result(0, 0, 0);
+            for (int c = 0; c < 8; c++)
+            {
+                int x = c & 1 ? i1[0] : i0[0];
+                int y = c & 2 ? i1[1] : i0[1];
+                int z = c & 4 ? i1[2] : i0[2];
+                auto weight = (c & 1 ? t[0] : 1 - t[0]) * (c & 2 ? t[1] : 1 - t[1]) * (c & 4 ? t[2] : 1 - t[2]);
+                const float *texel = &texels[texel_index(x, y, z)];
+                result += weight * color(texel[0], texel[1], texel[2]);
+            }
+            return result;
+        }
+    };
+
+    // Bake file layout: the header, then the float RGB samples.
+    struct bake_file_header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t kind; // 0: volume, 1: surface
+        int32_t size[3];
+        uint32_t reserved;
+        double origin[3];
+        double cell;
+        uint64_t source_hash; // See texture::describe()
+    };
+
+    static constexpr char bake_file_magic[8] = {'R', 'T', 'W', 'B', 'A', 'K', 'E', '\0'};
+    static const uint32_t bake_file_version = 2;
+
+    shared_ptr<texture> source;
+    std::shared_future<shared_ptr<const baked_grid>> pending;
+    mutable std::atomic<const baked_grid *> ready{nullptr}; // Set once the bake has finished
+
+    const baked_grid &loaded_grid() const
+    {
+        auto loaded = ready.load(std::memory_order_acquire);
+        if (loaded == nullptr)
+        {
+            // The future keeps the grid alive, so the raw pointer stays valid.
+            loaded = pending.get().get();
+            ready.store(loaded, std::memory_order_release);
+        }
+        return *loaded;
+    }
+
+    static shared_ptr<const baked_grid> bake_volume(const texture &source, const aabb &bounds, int resolution,
+                                                    const std::string &cache_name)
+    {
+        auto grid = make_shared<baked_grid>();
+
+        auto longest = bounds.axis_interval(bounds.longest_axis()).size();
+        grid->cell = longest / std::max(1, resolution);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const interval &extent = bounds.axis_interval(axis);
+            grid->origin[axis] = extent.min;
+            grid->size[axis] = std::max(1, int(std::ceil(extent.size() / grid->cell)));
+        }
+
+        std::string cache;
+        bake_file_header header = make_header(source, cache_name, 0, grid->size, grid->origin, grid->cell, cache);
+        auto count = grid->texel_count();
+        if (read_bake_file(cache, header, count, grid->texels))
+            return grid;
+
+        // One row of samples per batch.
+        int nx = grid->size[0];
+        std::vector<double> u(nx, 0.0), v(nx, 0.0);
+        std::vector<point3> points(nx);
+        std::vector<color> values(nx);
+        grid->texels.resize(3 * count);
+
+        for (int z = 0; z < grid->size[2]; z++)
+        {
+            for (int y = 0; y < grid->size[1]; y++)
+            {
+                for (int x = 0; x < nx; x++)
+                    points[x] = grid->origin + grid->cell * vec3(x + 0.5, y + 0.5, z + 0.5);
+
+                source.values(u.data(), v.data(), points.data(), values.data(), nx);
+                for (int x = 0; x < nx; x++)
+                    store_texel(values[x], &grid->texels[grid->texel_index(x, y, z)]);
+            }
+        }
+
+        write_bake_file(cache, header, grid->texels);
+        return grid;
+    }
+
+    static shared_ptr<const baked_grid> bake_surface(const texture &source, const surface_map &surface, int width,
+                                                     int height, const std::string &cache_name)
+    {
+        auto grid = make_shared<baked_grid>();
+        width = std::max(1, width);
+        height = std::max(1, height);
+
+        int size[3] = {width, height, 1};
+        std::string cache;
+        bake_file_header header = make_header(source, cache_name, 1, size, point3(0, 0, 0), 0, cache);
+
+        std::vector<float> pixels;
+        if (!read_bake_file(cache, header, size_t(width) * height, pixels))
+        {
+            // Rows run top to bottom, so v decreases along the image as in image_texture.
+            std::vector<double> u(width), v(width);
+            std::vector<point3> points(width);
+            std::vector<color> values(width);
+            pixels.resize(3 * size_t(width) * height);
+
+            for (int y = 0; y < height; y++)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    u[x] = (x + 0.5) / width;
+                    v[x] = 1 - (y + 0.5) / height;
+                    points[x] = surface(u[x], v[x]);
+                }
+
+                source.values(u.data(), v.data(), points.data(), values.data(), width);
+                for (int x = 0; x < width; x++)
+                    store_texel(values[x], &pixels[3 * (size_t(y) * width + x)]);
+            }
+
+            write_bake_file(cache, header, pixels);
+        }
+
+        grid->image = make_shared<rtw_image>(pixels.data(), width, height);
+        return grid;
+    }
+
+    static void store_texel(const color &value, float *out)
+    {
+        out[0] = float(value.x());
+        out[1] = float(value.y());
+        out[2] = float(value.z());
+    }
+
+    static bake_file_header make_header(const texture &source, const std::string &cache_name, uint32_t kind,
+                                        const int size[3], const point3 &origin, double cell, std::string &cache)
+    {
+        // Also sets `cache` to the cache name to use: none for sources that cannot tell whether
+        // an earlier bake of them is still up to date.
+        bake_file_header header = {};
+        std::memcpy(header.magic, bake_file_magic, sizeof header.magic);
+        header.version = bake_file_version;
+        header.kind = kind;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            header.size[axis] = size[axis];
+            header.origin[axis] = origin[axis];
+        }
+        header.cell = cell;
+
+        content_hasher hash;
+        cache = source.describe(hash) ? cache_name : std::string();
+        header.source_hash = hash.value;
+        return header;
+    }
+
+    static std::string bake_filename(const std::string &cache_name)
+    {
+        // Bake files go to the RTW_TEXTURE_CACHE directory if set, the current one otherwise.
+        auto cachedir = getenv("RTW_TEXTURE_CACHE");
+        return (cachedir ? std::string(cachedir) + "/" : std::string()) + cache_name + ".bake";
+    }
+
+    static bool read_bake_file(const std::string &cache_name, const bake_file_header &expected, size_t count,
+                               std::vector<float> &texels)
+    {
+        // Loads the samples of an earlier bake of the same source with exactly the same grid,
+        // if there is one.
+        if (cache_name.empty())
+            return false;
+
+        std::ifstream in(bake_filename(cache_name), std::ios::binary);
+        bake_file_header header;
+        if (!in.read(reinterpret_cast<char *>(&header), sizeof header) ||
+            std::memcmp(&header, &expected, sizeof header) != 0)
+            return false;
+
+        texels.resize(3 * count);
+        if (!in.read(reinterpret_cast<char *>(texels.data()), texels.size() * sizeof(float)))
+        {
+            texels.clear();
+            return false;
+        }
+        return true;
+    }
+
+    static void write_bake_file(const std::string &cache_name, const bake_file_header &header,
+                                const std::vector<float> &texels)
+    {
+        // Like mip files, bake files go through a temporary file, and failing to write one only
+        // means baking again next time.
+        if (cache_name.empty())
+            return;
+
+        auto filename = bake_filename(cache_name);
+        auto temp_filename = filename + ".tmp";
+        {
+            std::ofstream out(temp_filename, std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char *>(&header), sizeof header);
+            out.write(reinterpret_cast<const char *>(texels.data()), texels.size() * sizeof(float));
+            if (!out)
+            {
+                out.close();
+                std::remove(temp_filename.c_str());
+                return;
+            }
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(temp_filename, filename, ec);
+        if (ec)
+            std::remove(temp_filename.c_str());
+    }
+};
+
+#endif
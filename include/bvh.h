@@ -26,9 +26,9 @@ public:
         }
         int axis = bbox.longest_axis();
 
-        auto comparator = (axis = 0)   ? box_x_compare
-                          : (axis = 1) ? box_y_compare
-                                       : box_z_compare;
+        auto comparator = (axis == 0)   ? box_x_compare
+                          : (axis == 1) ? box_y_compare
+                                        : box_z_compare;
 
         size_t object_span = end - start;
 
@@ -46,31 +46,52 @@ public:
             std::sort(std::begin(objects) + start, std::begin(objects) + end, comparator);
 
             auto mid = start + object_span / 2;
-            left = make_shared<bvh_node>(objects, start, mid);
-            right = make_shared<bvh_node>(objects, mid, end);
+            auto left_node = make_shared<bvh_node>(objects, start, mid);
+            auto right_node = make_shared<bvh_node>(objects, mid, end);
+            node_total += left_node->node_count() + right_node->node_count();
+            left = left_node;
+            right = right_node;
         }
     }
 
     bool hit(const ray &r, interval ray_t, hit_record &rec) const override
     {
+        RT_STAT(thread_stats().bvh_nodes++);
         if (!bbox.hit(r, ray_t))
         {
             return false;
         }
 
         bool hit_left = left->hit(r, ray_t, rec);
-        bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+        bool hit_right = right != left && right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
         return hit_left || hit_right;
     }
 
+    bool occluded(const ray &r, interval ray_t) const override
+    {
+        // Any hit will do, so there is no interval to shrink between the children.
+        return bbox.hit(r, ray_t) && (left->occluded(r, ray_t) || (right != left && right->occluded(r, ray_t)));
+    }
+
     aabb bounding_box() const override { return bbox; }
     vec3 center() const override { return vec3(0, 0, 0); }
     //a bvh_node does not return center by default, for its copy of hittable_list is implicit.
 
+    size_t flatten(const shared_ptr<hittable> &self, std::vector<shared_ptr<hittable>> &out) const override
+    {
+        size_t dissolved = 1 + left->flatten(left, out);
+        if (right != left)
+            dissolved += right->flatten(right, out);
+        return dissolved;
+    }
+
+    size_t node_count() const { return node_total; }
+
 private:
     shared_ptr<hittable> left;
     shared_ptr<hittable> right;
     aabb bbox;
+    size_t node_total = 1; // Number of bvh_nodes in this subtree, including this one
 
     static bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis_index)
     {
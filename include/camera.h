@@ -3,6 +3,29 @@
 
 #include "hittable.h"
 #include "material.h"
+#include "medium_stack.h"
+#include "perf_counters.h"
+#include "scene_compiler.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Taken during static initialization, so startup timings include building the scene.
+inline const auto program_start = std::chrono::steady_clock::now();
+
+enum class image_format
+{
+    ppm,        // Plain text PPM (P3), gamma corrected
+    ppm_binary, // Binary PPM (P6), gamma corrected
+    pfm         // Portable float map, linear radiance without clamping
+};
 
 class camera
 {
@@ -21,31 +44,170 @@ public:
     double defocus_angle = 0; // Variation angle of rays through each pixel
     double focus_dist = 10;   // Distance from camera lookfrom point to plane of perfect focus
 
-    void render(const hittable &world)
+    double fog_density = 0;              // Density of a homogeneous medium filling the scene, 0 for none
+    color fog_albedo = color(1, 1, 1);   // Fraction of light the fog scatters rather than absorbs
+    point3 fog_center = point3(0, 0, 0); // Center of the ball the fog is confined to
+    double fog_radius = infinity;        // Radius of that ball, unbounded by default
+
+    bool accelerate = true;   // Compile the scene into a single BVH before rendering
+    bool typed_leaves = true; // With accelerate, build a flat_bvh rather than a bvh_node tree
+    bool track_media = true;  // With accelerate, follow paths through homogeneous media boundaries
+                              // instead of intersecting each medium's boundary twice per ray
+    std::string bvh_cache;    // With a flat_bvh, file it is kept in between runs, empty for none
+
+    int threads = 0;     // Render threads, 0 for one per hardware thread
+    int tile_size = 32;  // Width and height of the square tiles the image is rendered in
+    uint64_t seed = 0;   // Seed of the random sequences; each tile gets its own
+
+    std::string output;                      // Image file to write, standard output if empty
+    image_format format = image_format::ppm; // Format of the image written
+    std::string stats_output;                // With RT_STATS, JSON file for the statistics, empty for none
+    std::string heatmaps;                    // Prefix of the per-pixel cost maps to write, empty for none;
+                                             // see write_heatmaps()
+    perf_counters *tile_counters = nullptr;  // Opened counters to count the tile rendering with, if any
+
+    bool render(const hittable &scene)
     {
+        // Renders the scene and writes the image, returning false if the image could not be
+        // written. An output file that cannot be created is reported before rendering starts.
+        auto render_start = std::chrono::steady_clock::now();
+
+        std::ofstream file;
+        if (!output.empty())
+        {
+            file.open(output, std::ios::binary | std::ios::trunc);
+            if (!file)
+            {
+                std::cerr << "ERROR: Could not create image file '" << output << "'.\n";
+                return false;
+            }
+        }
+
         initialize();
 
-        std::cout << "P3\n"
-                  << image_width << ' ' << image_height << "\n255\n";
+        // Textures keep loading in the background while the scene compiles, and the tiles
+        // only start once they are all in.
+        media.clear();
+        scene_compiler compiler;
+        compiler.typed_leaves = typed_leaves;
+        compiler.cache_filename = bvh_cache;
+        auto compiled = accelerate ? compiler.compile(scene, track_media ? &media : nullptr) : nullptr;
+        const hittable &world = compiled ? *compiled : scene;
+        camera_media = media_containing(center);
+        auto compile_end = std::chrono::steady_clock::now();
+
+        {
+            RT_TRACE_ZONE("wait for textures");
+            asset_pool().wait_idle();
+        }
+        auto assets_end = std::chrono::steady_clock::now();
+
+        framebuffer.assign(size_t(image_width) * image_height, color(0, 0, 0));
+        for (auto &map : heat)
+            map.assign(heatmaps.empty() ? 0 : framebuffer.size(), 0.0f);
+
+        int tiles_x = (image_width + tile_size - 1) / tile_size;
+        int tiles_y = (image_height + tile_size - 1) / tile_size;
+        int tile_count = tiles_x * tiles_y;
+
+        std::atomic<int> next_tile{0};
+        std::mutex progress_mutex;
+        int tiles_done = 0;
+        std::chrono::steady_clock::time_point first_tile_end;
+        stats = render_stats();
 
-        for (int j = 0; j < image_height; j++)
+        auto worker = [&]
         {
-            std::clog << "\rScanlines remaining: " << (image_height - j) << ' ' << std::flush;
-            for (int i = 0; i < image_width; i++)
+            RT_STAT(thread_stats() = render_stats());
+            for (int tile = next_tile++; tile < tile_count; tile = next_tile++)
             {
-                color pixel_color(0, 0, 0);
-                for (int sample = 0; sample < samples_per_pixel; sample++)
                 {
-                    ray r = get_ray(i, j);
-                    pixel_color += ray_color(r, max_depth, world);
+                    RT_TRACE_ZONE("tile", std::to_string(tile));
+                    seed_random(seed, uint64_t(tile));
+                    render_tile(world, (tile % tiles_x) * tile_size, (tile / tiles_x) * tile_size);
                 }
-                write_color(std::cout, pixel_samples_scale * pixel_color);
+
+                std::lock_guard<std::mutex> lock(progress_mutex);
+                if (tiles_done++ == 0)
+                    first_tile_end = std::chrono::steady_clock::now();
+                std::clog << "\rTiles remaining: " << (tile_count - tiles_done) << ' ' << std::flush;
             }
+
+#ifdef RT_STATS
+            std::lock_guard<std::mutex> lock(progress_mutex);
+            stats.add(thread_stats());
+#endif
+        };
+
+        int thread_count = threads > 0 ? threads : int(std::max(1u, std::thread::hardware_concurrency()));
+        thread_count = std::min(thread_count, tile_count);
+
+        // The counters count the render threads because they are started after this.
+        if (tile_counters)
+            tile_counters->start();
+
+        std::vector<std::thread> helpers;
+        for (int i = 1; i < thread_count; i++)
+        {
+            helpers.emplace_back([&worker, i]
+                                 {
+                                     RT_TRACE_THREAD("render thread " + std::to_string(i));
+                                     worker();
+                                 });
         }
+        worker();
+        for (auto &helper : helpers)
+            helper.join();
+        if (tile_counters)
+            tile_counters->stop();
+        auto render_end = std::chrono::steady_clock::now();
 
         std::clog << "\rDone.                 \n";
+
+        std::ostream &out = output.empty() ? std::cout : file;
+        {
+            RT_TRACE_ZONE("write image", output.empty() ? "<stdout>" : output);
+            write_image(out);
+            out.flush();
+        }
+        if (!out)
+            std::cerr << "ERROR: Could not write image file '" << (output.empty() ? "<stdout>" : output) << "'.\n";
+        bool heatmaps_written = heatmaps.empty() || write_heatmaps();
+        auto write_end = std::chrono::steady_clock::now();
+
+        times.compile = milliseconds(render_start, compile_end);
+        times.texture_wait = milliseconds(compile_end, assets_end);
+        times.render = milliseconds(assets_end, render_end);
+        times.write = milliseconds(render_end, write_end);
+
+        std::clog << "Startup: scene setup " << milliseconds(program_start, render_start)
+                  << " ms, scene compile " << times.compile
+                  << " ms, texture wait " << times.texture_wait
+                  << " ms, first tile done at " << milliseconds(program_start, first_tile_end) << " ms\n";
+        std::clog << "Render: " << times.render << " ms, " << tile_count
+                  << " tiles on " << thread_count << " threads\n";
+
+        bool stats_written = true;
+        if (render_stats::enabled)
+        {
+            stats.write_table(std::clog, times);
+            if (!stats_output.empty())
+            {
+                std::ofstream stats_file(stats_output);
+                stats.write_json(stats_file, times);
+                stats_written = bool(stats_file);
+                if (!stats_written)
+                    std::cerr << "ERROR: Could not write statistics file '" << stats_output << "'.\n";
+            }
+        }
+        return bool(out) && stats_written && heatmaps_written;
     }
 
+    // Results of the last render()
+    int rendered_height() const { return image_height; }
+    const render_times &last_times() const { return times; }
+    const render_stats &last_stats() const { return stats; } // All zero without RT_STATS
+
 private:
     int image_height;           // Rendered image height
     double pixel_samples_scale; // Color scale factor for a sum of pixel samples
@@ -56,6 +218,225 @@ private:
     vec3 u, v, w;               // Camera frame basis vectors
     vec3 defocus_disk_u;        // Defocus disk horizontal radius
     vec3 defocus_disk_v;        // Defocus disk vertical radius
+    double pixel_spread;        // Angle subtended by one pixel, the spread of the camera ray cones
+    std::vector<color> framebuffer; // Averaged pixel colors, row by row
+    render_times times;             // Of the last render()
+    render_stats stats;             // Of the last render(), added up over its threads
+
+    enum heat_metric
+    {
+        heat_nodes,       // BVH nodes visited per sample
+        heat_tests,       // Primitive intersection tests per sample
+        heat_time,        // Nanoseconds per sample
+        heat_path_length, // Rays traced per sample
+        heat_metric_count
+    };
+    std::vector<float> heat[heat_metric_count]; // Per pixel, row by row, when writing heatmaps
+
+    struct pixel_cost // Running totals of the calling thread, to take differences of
+    {
+        uint64_t nodes = 0, tests = 0, rays = 0;
+        std::chrono::steady_clock::time_point time;
+    };
+    shared_ptr<material> fog_material; // Phase function of the global fog
+
+    std::vector<shared_ptr<const constant_medium>> media; // Media taken out of the compiled scene
+    medium_stack camera_media;                            // Those of them the camera is inside of
+
+    struct boundary_crossing
+    {
+        int medium;
+        vec3 outward_normal;
+        bool entering;
+    };
+
+    static const int max_crossings = 4; // Boundaries crossed at the same point that are tracked
+
+    struct timed_crossing
+    {
+        double t;
+        boundary_crossing crossing;
+    };
+
+    static std::vector<timed_crossing> &crossing_scratch()
+    {
+        // Per thread, so ray_color() does not allocate for every ray. A path is done with it
+        // before it recurses.
+        thread_local std::vector<timed_crossing> crossings;
+        return crossings;
+    }
+
+    void render_tile(const hittable &world, int x0, int y0)
+    {
+        // Renders the pixels of the tile with its top left corner at x0, y0 into the framebuffer.
+        int x1 = std::min(x0 + tile_size, image_width);
+        int y1 = std::min(y0 + tile_size, image_height);
+
+        bool record_costs = !heatmaps.empty();
+
+        for (int j = y0; j < y1; j++)
+        {
+            for (int i = x0; i < x1; i++)
+            {
+                pixel_cost before;
+                if (record_costs)
+                    before = current_cost();
+
+                color pixel_color(0, 0, 0);
+                for (int sample = 0; sample < samples_per_pixel; sample++)
+                {
+                    ray r = get_ray(i, j);
+                    pixel_color += ray_color(r, max_depth, world, camera_media);
+                }
+                auto index = size_t(j) * image_width + i;
+                framebuffer[index] = pixel_samples_scale * pixel_color;
+
+                if (record_costs)
+                {
+                    auto after = current_cost();
+                    heat[heat_nodes][index] = float(pixel_samples_scale * double(after.nodes - before.nodes));
+                    heat[heat_tests][index] = float(pixel_samples_scale * double(after.tests - before.tests));
+                    heat[heat_time][index] = float(pixel_samples_scale *
+                                                   std::chrono::duration<double, std::nano>(after.time - before.time).count());
+                    heat[heat_path_length][index] = float(pixel_samples_scale * double(after.rays - before.rays));
+                }
+            }
+        }
+    }
+
+    static pixel_cost current_cost()
+    {
+        pixel_cost cost;
+#ifdef RT_STATS
+        const auto &counts = thread_stats();
+        cost.nodes = counts.bvh_nodes;
+        cost.tests = counts.primitive_tests();
+        cost.rays = counts.rays();
+#endif
+        cost.time = std::chrono::steady_clock::now();
+        return cost;
+    }
+
+    bool write_heatmaps() const
+    {
+        // Writes each per-pixel cost as <heatmaps>_<metric>.pfm, the raw values in a grayscale
+        // float map, and <heatmaps>_<metric>.ppm, a false-color image running from black
+        // through purple and orange to pale yellow at the 99th percentile of the values, so a
+        // few extreme pixels do not wash out the rest. The counts need RT_STATS; without it
+        // only the time map is written.
+        RT_TRACE_ZONE("write heatmaps", heatmaps);
+        static const char *names[heat_metric_count] = {"nodes", "tests", "time", "path_length"};
+        static const char *units[heat_metric_count] = {"BVH nodes", "primitive tests", "ns", "rays"};
+
+        bool ok = true;
+        for (int metric = 0; metric < heat_metric_count; metric++)
+        {
+            if (!render_stats::enabled && metric != heat_time)
+                continue;
+
+            const auto &values = heat[metric];
+            auto sorted = values;
+            auto percentile = sorted.begin() + std::ptrdiff_t(0.99 * double(sorted.size() - 1));
+            std::nth_element(sorted.begin(), percentile, sorted.end());
+            double scale = *percentile > 0 ? *percentile : *std::max_element(values.begin(), values.end());
+
+            auto base = heatmaps + "_" + names[metric];
+            std::ofstream raw(base + ".pfm", std::ios::binary | std::ios::trunc);
+            raw << "Pf\n"
+                << image_width << ' ' << image_height << "\n-1.0\n";
+            for (int y = image_height - 1; y >= 0; y--)
+                raw.write(reinterpret_cast<const char *>(&values[size_t(y) * image_width]),
+                          std::streamsize(image_width * sizeof(float)));
+
+            std::ofstream false_color(base + ".ppm", std::ios::binary | std::ios::trunc);
+            false_color << "P6\n"
+                        << image_width << ' ' << image_height << "\n255\n";
+            for (auto value : values)
+            {
+                unsigned char rgb[3];
+                heat_color(scale > 0 ? value / scale : 0, rgb);
+                false_color.write(reinterpret_cast<const char *>(rgb), 3);
+            }
+
+            raw.flush();
+            false_color.flush();
+            if (!raw || !false_color)
+            {
+                std::cerr << "ERROR: Could not write heatmap '" << base << "'.\n";
+                ok = false;
+                continue;
+            }
+            std::clog << "Heatmap " << base << ": " << units[metric] << " per sample, 0 to " << scale
+                      << " from black to yellow\n";
+        }
+        if (!render_stats::enabled)
+            std::clog << "Heatmaps of BVH nodes, tests and path lengths need a build with RT_STATS.\n";
+        return ok;
+    }
+
+    static void heat_color(double x, unsigned char rgb[3])
+    {
+        // Piecewise linear approximation of the "inferno" color map over [0, 1].
+        static const double stops[5][3] = {
+            {0, 0, 4}, {87, 16, 110}, {188, 55, 84}, {249, 142, 9}, {252, 255, 164}};
+        x = 4 * std::clamp(x, 0.0, 1.0);
+        int i = std::min(int(x), 3);
+        double f = x - i;
+        for (int c = 0; c < 3; c++)
+            rgb[c] = static_cast<unsigned char>(stops[i][c] + f * (stops[i + 1][c] - stops[i][c]) + 0.5);
+    }
+
+    static double milliseconds(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+    {
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    }
+
+    void write_image(std::ostream &out) const
+    {
+        switch (format)
+        {
+        case image_format::ppm:
+            out << "P3\n"
+                << image_width << ' ' << image_height << "\n255\n";
+            for (const auto &pixel : framebuffer)
+                write_color(out, pixel);
+            break;
+
+        case image_format::ppm_binary:
+        {
+            out << "P6\n"
+                << image_width << ' ' << image_height << "\n255\n";
+            std::vector<unsigned char> row(3 * size_t(image_width));
+            for (int y = 0; y < image_height; y++)
+            {
+                for (int x = 0; x < image_width; x++)
+                    color_to_bytes(framebuffer[size_t(y) * image_width + x], &row[3 * size_t(x)]);
+                out.write(reinterpret_cast<const char *>(row.data()), std::streamsize(row.size()));
+            }
+            break;
+        }
+
+        case image_format::pfm:
+        {
+            // Rows go bottom to top; the negative scale marks little-endian floats, which is
+            // what every platform we build on writes.
+            out << "PF\n"
+                << image_width << ' ' << image_height << "\n-1.0\n";
+            std::vector<float> row(3 * size_t(image_width));
+            for (int y = image_height - 1; y >= 0; y--)
+            {
+                for (int x = 0; x < image_width; x++)
+                {
+                    const color &pixel = framebuffer[size_t(y) * image_width + x];
+                    for (int c = 0; c < 3; c++)
+                        row[3 * size_t(x) + c] = float(pixel[c]);
+                }
+                out.write(reinterpret_cast<const char *>(row.data()), std::streamsize(row.size() * sizeof(float)));
+            }
+            break;
+        }
+        }
+    }
 
     void initialize()
     {
@@ -84,6 +465,7 @@ private:
         // Calculate the horizontal and vertical delta vectors from pixel to pixel.
         pixel_delta_u = viewport_u / image_width;
         pixel_delta_v = viewport_v / image_height;
+        pixel_spread = std::atan(2 * h / image_height);
 
         // Calculate the location of the upper left pixel.
         auto viewport_upper_left =
@@ -94,6 +476,79 @@ private:
         auto defocus_radius = focus_dist * std::tan(degrees_to_radians(defocus_angle / 2));
         defocus_disk_u = u * defocus_radius;
         defocus_disk_v = v * defocus_radius;
+
+        fog_material = make_shared<isotropic>(fog_albedo);
+    }
+
+    medium_stack media_containing(const point3 &p) const
+    {
+        // A point is inside a closed boundary if a ray from it leaves the boundary first.
+        medium_stack inside;
+        ray probe(p, vec3(0.5773, 0.5774, 0.5775));
+        for (size_t i = 0; i < media.size(); i++)
+        {
+            hit_record rec;
+            if (media[i]->boundary_geometry().hit(probe, interval(0, infinity), rec) && !rec.front_face)
+                inside.enter(int(i));
+        }
+        return inside;
+    }
+
+    static void medium_hit(const ray &r, double t, const material *mat, hit_record &rec)
+    {
+        // Turns rec into a scattering event inside a medium at distance t along r.
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.normal = vec3(1, 0, 0); // arbitary
+        rec.front_face = true;      // also arbitary
+        rec.uv_area = 0;            // No surface to map a texture onto
+        rec.mat = mat;
+    }
+
+    bool fog_scatter(const ray &r, double t_max, hit_record &rec) const
+    {
+        // Samples where along r, before t_max, the global fog scatters it. The span of the ray
+        // inside the fog ball is solved for directly rather than intersected as geometry.
+        if (fog_density <= 0)
+            return false;
+
+        auto t0 = 0.001, t1 = t_max;
+        if (fog_radius < infinity)
+        {
+            vec3 oc = fog_center - r.origin();
+            auto a = r.direction().length_squared();
+            auto h = dot(r.direction(), oc);
+            auto c = oc.length_squared() - fog_radius * fog_radius;
+            auto discriminant = h * h - a * c;
+            if (discriminant <= 0)
+                return false;
+
+            auto sqrtd = std::sqrt(discriminant);
+            t0 = std::fmax(t0, (h - sqrtd) / a);
+            t1 = std::fmin(t1, (h + sqrtd) / a);
+        }
+        if (t0 >= t1)
+            return false;
+
+        auto t = t0 - shading_log(1 - random_double()) / (fog_density * r.direction().length());
+        if (t >= t1)
+            return false;
+
+        medium_hit(r, t, fog_material.get(), rec);
+        return true;
+    }
+
+    int pick_scattering_medium(const medium_stack &path_media, double total_density) const
+    {
+        // Overlapping media scatter in proportion to their densities.
+        auto pick = random_double() * total_density;
+        for (int i = 0; i < path_media.size() - 1; i++)
+        {
+            pick -= media[path_media[i]]->density();
+            if (pick < 0)
+                return path_media[i];
+        }
+        return path_media[path_media.size() - 1];
     }
 
     ray get_ray(int i, int j)
@@ -108,7 +563,7 @@ private:
         auto ray_direction = pixel_sample - ray_origin;
         auto ray_time = random_double();
 
-        return ray(ray_origin, ray_direction, ray_time);
+        return ray(ray_origin, ray_direction, ray_time, ray_cone{0, pixel_spread});
     }
 
     vec3 sample_square() const
@@ -124,16 +579,111 @@ private:
         return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
     }
 
-    color ray_color(const ray &r, int depth, const hittable &world) const
+    color ray_color(const ray &r, int depth, const hittable &world, medium_stack path_media) const
     {
         // If we've exceeded the ray bounce limit, no more light is gathered.
         if (depth <= 0)
+        {
+            RT_STAT(thread_stats().end_path(render_stats::depth_limit, max_depth));
             return color(0, 0, 0);
+        }
+        RT_STAT(depth == max_depth ? thread_stats().primary_rays++ : thread_stats().secondary_rays++);
 
         hit_record rec;
+        bool hit_surface = world.hit(r, interval(0.001, infinity), rec);
+        if (fog_scatter(r, hit_surface ? rec.t : infinity, rec))
+            hit_surface = true;
+
+        // Tracked media boundaries crossed at the surface hit: which side of them the path ends
+        // up on depends on where the surface scatters it.
+        boundary_crossing at_surface[max_crossings];
+        int at_surface_count = 0;
+
+        if (!media.empty())
+        {
+            // Crossings this close together count as the same point, relative to how far along
+            // the ray they are.
+            auto tolerance = [](double t) { return 1e-6 * std::fmax(1.0, t); };
+            auto t_surface = hit_surface ? rec.t : infinity;
+            auto t_limit = hit_surface ? t_surface + tolerance(t_surface) : infinity;
+            auto length = r.direction().length();
+            auto t = 0.001;
+
+            // The tracked media boundary crossings along the ray, up to the surface or the point
+            // the global fog scatters it at, in order. Boundaries are convex, as constant_medium
+            // assumes too, so a ray crosses one at most twice: once it enters, the exit is the
+            // next hit after that and there is nothing beyond. Media whose bounding box the ray
+            // misses are not queried at all.
+            auto &crossings = crossing_scratch();
+            crossings.clear();
+            for (size_t i = 0; i < media.size(); i++)
+            {
+                const hittable &boundary = media[i]->boundary_geometry();
+                hit_record first, second;
+                if (!media[i]->bounding_box().hit(r, interval(t, t_limit)) ||
+                    !boundary.hit(r, interval(t, t_limit), first))
+                    continue;
+
+                crossings.push_back({first.t, {int(i), first.front_face ? first.normal : -first.normal, first.front_face}});
+                if (first.front_face && boundary.hit(r, interval(first.t + tolerance(first.t), t_limit), second))
+                    crossings.push_back({second.t, {int(i), second.front_face ? second.normal : -second.normal,
+                                                    second.front_face}});
+            }
+            std::sort(crossings.begin(), crossings.end(),
+                      [](const timed_crossing &a, const timed_crossing &b) { return a.t < b.t; });
+
+            size_t next = 0;
+            while (true)
+            {
+                // The next crossings, with those at the same point as the closest one.
+                auto t_crossing = next < crossings.size() ? crossings[next].t : infinity;
+                size_t next_end = next;
+                while (next_end < crossings.size() && crossings[next_end].t <= t_crossing + tolerance(t_crossing))
+                    next_end++;
+
+                bool crossing_first = !hit_surface ? t_crossing < infinity
+                                                   : t_crossing < t_surface - tolerance(t_surface);
+                auto t_event = crossing_first ? t_crossing : t_surface;
+
+                // Free flight through the media the path is in, up to that crossing or the surface.
+                double density = 0;
+                for (int i = 0; i < path_media.size(); i++)
+                    density += media[path_media[i]]->density();
+
+                if (density > 0)
+                {
+                    // One medium test per stretch of free flight, however many media overlap.
+                    RT_STAT(thread_stats().tests[stat_medium]++);
+                    auto t_scatter = t - shading_log(1 - random_double()) / (density * length);
+                    if (t_scatter < t_event)
+                    {
+                        RT_STAT(thread_stats().hits[stat_medium]++);
+                        auto &medium = media[pick_scattering_medium(path_media, density)];
+                        medium_hit(r, t_scatter, medium->material_ptr().get(), rec);
+                        hit_surface = true;
+                        break;
+                    }
+                }
+
+                if (!crossing_first)
+                {
+                    for (size_t i = next; i < next_end && at_surface_count < max_crossings; i++)
+                        at_surface[at_surface_count++] = crossings[i].crossing;
+                    break;
+                }
+
+                // Pass through the boundary; the surface hit further along stays the same.
+                for (size_t i = next; i < next_end; i++)
+                    path_media.set(crossings[i].crossing.medium, crossings[i].crossing.entering);
+                t = t_crossing + tolerance(t_crossing);
+                next = next_end;
+            }
+        }
+
         // If the ray hits nothing, return the background color.
-        if (!world.hit(r, interval(0.001, infinity), rec))
+        if (!hit_surface)
         {
+            RT_STAT(thread_stats().end_path(render_stats::escaped, max_depth - depth + 1));
             vec3 unit_direction = unit_vector(r.direction());
             auto a = 0.5 * (unit_direction.y() + 1.0);
             return (1.0 - a) * color(1.0, 1.0, 1.0) + a * color(0.5, 0.7, 1.0);
@@ -141,9 +691,11 @@ private:
             return background;
         }
 
+        rec.set_footprint(r);
+
         ray scattered;
         color attenuation;
-        color color_from_emission = rec.mat->emitted(rec.u, rec.v, rec.p);
+        color color_from_emission = rec.mat->emitted(rec);
 
         // return face orientation for debug
         // if (rec.front_face)
@@ -159,9 +711,15 @@ private:
         // return 0.5 * (rec.normal + color(1,1,1));
 
         if (!rec.mat->scatter(r, rec, attenuation, scattered))
+        {
+            RT_STAT(thread_stats().end_path(render_stats::absorbed, max_depth - depth + 1));
             return color_from_emission;
+        }
+
+        for (int i = 0; i < at_surface_count; i++)
+            path_media.set(at_surface[i].medium, dot(scattered.direction(), at_surface[i].outward_normal) < 0);
 
-        color color_from_scatter = attenuation * ray_color(scattered, depth - 1, world);
+        color color_from_scatter = attenuation * ray_color(scattered, depth - 1, world, path_media);
 
         return color_from_emission + color_from_scatter;
     }
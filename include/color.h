@@ -14,25 +14,22 @@ inline double linear_to_gamma(double linear_component)
     return 0;
 }
 
-void write_color(std::ostream &out, const color &pixel_color)
+inline void color_to_bytes(const color &pixel_color, unsigned char bytes[3])
 {
-    auto r = pixel_color.x();
-    auto g = pixel_color.y();
-    auto b = pixel_color.z();
-
-    // Apply a linear to gamma transform for gamma 2
-    r = linear_to_gamma(r);
-    g = linear_to_gamma(g);
-    b = linear_to_gamma(b);
-
-    // Translate the [0,1] component values to the byte range [0,255].
+    // Apply a linear to gamma transform for gamma 2, then translate the [0,1] component
+    // values to the byte range [0,255].
     static const interval intensity(0.000, 0.999);
-    int rbyte = int(256 * intensity.clamp(r));
-    int gbyte = int(256 * intensity.clamp(g));
-    int bbyte = int(256 * intensity.clamp(b));
+    for (int i = 0; i < 3; i++)
+        bytes[i] = static_cast<unsigned char>(256 * intensity.clamp(linear_to_gamma(pixel_color[i])));
+}
+
+void write_color(std::ostream &out, const color &pixel_color)
+{
+    unsigned char bytes[3];
+    color_to_bytes(pixel_color, bytes);
 
     // Write out the pixel color components.
-    out << rbyte << ' ' << gbyte << ' ' << bbyte << '\n';
+    out << int(bytes[0]) << ' ' << int(bytes[1]) << ' ' << int(bytes[2]) << '\n';
 }
 
 #endif
\ No newline at end of file
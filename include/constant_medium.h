@@ -1,6 +1,7 @@
 #ifndef CONSTANT_MEDIUM_H
 #define CONSTANT_MEDIUM_H
 
+#include "bvh.h"
 #include "hittable.h"
 #include "material.h"
 #include "texture.h"
@@ -20,8 +21,74 @@ public:
     {
     }
 
+    constant_medium(shared_ptr<hittable> boundary, double density, shared_ptr<material> phase_function)
+        : boundary(boundary), neg_inv_density(-1 / density), phase_function(phase_function)
+    {
+    }
+
     bool hit(const ray &r, interval ray_t, hit_record &rec) const override
     {
+        RT_STAT(thread_stats().tests[stat_medium]++);
+        double t;
+        if (!sample_scatter(r, ray_t, t))
+            return false;
+
+        RT_STAT(thread_stats().hits[stat_medium]++);
+        rec.t = t;
+        rec.p = r.at(rec.t);
+
+        rec.normal = vec3(1, 0, 0); // arbitary
+        rec.front_face = true;      // also arbitary
+        rec.uv_area = 0;            // No surface to map a texture onto
+        rec.mat = phase_function.get();
+
+        return true;
+    }
+
+    bool occluded(const ray &r, interval ray_t) const override
+    {
+        // A medium blocks a ray at random, just as often as hit() would scatter it.
+        double t;
+        return sample_scatter(r, ray_t, t);
+    }
+
+    aabb bounding_box() const override { return boundary->bounding_box(); }
+    vec3 center() const override { return boundary->center(); }
+
+    // For integrators that track the media a path is in instead of calling hit().
+    const hittable &boundary_geometry() const { return *boundary; }
+    double density() const { return -1 / neg_inv_density; }
+    const shared_ptr<material> &material_ptr() const { return phase_function; }
+
+    size_t flatten(const shared_ptr<hittable> &self, std::vector<shared_ptr<hittable>> &out) const override
+    {
+        // The medium stays one object, but its boundary gets compiled like any other geometry
+        // so that transforms wrapped around it are baked away.
+        std::vector<shared_ptr<hittable>> parts;
+        auto dissolved = boundary->flatten(boundary, parts);
+        if (dissolved == 0)
+        {
+            out.push_back(self);
+            return 0;
+        }
+
+        if (parts.empty())
+            return dissolved; // An empty boundary never scatters anything
+
+        shared_ptr<hittable> compiled = parts.size() == 1 ? parts[0] : make_shared<bvh_node>(parts, 0, parts.size());
+        out.push_back(make_shared<constant_medium>(compiled, -1 / neg_inv_density, phase_function));
+        return dissolved;
+    }
+
+private:
+    shared_ptr<hittable> boundary;
+    double neg_inv_density;
+    shared_ptr<material> phase_function;
+
+    bool sample_scatter(const ray &r, interval ray_t, double &t) const
+    {
+        // Samples the distance at which the ray scatters inside the boundary, if it does
+        // within ray_t.
         hit_record rec1, rec2;
 
         if (!boundary->hit(r, interval::universe, rec1))
@@ -30,33 +97,29 @@ public:
         if (!boundary->hit(r, interval(rec1.t + 0.0001, infinity), rec2))
             return false;
 
+        // Only the part of the boundary span inside the queried interval may scatter, otherwise
+        // the medium would override closer hits depending on the order objects are tested in.
+        if (rec1.t < ray_t.min)
+            rec1.t = ray_t.min;
+        if (rec2.t > ray_t.max)
+            rec2.t = ray_t.max;
+
+        if (rec1.t >= rec2.t)
+            return false;
+
         if (rec1.t < 0)
             rec1.t = 0;
 
         auto ray_length = r.direction().length();
         auto distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
-        auto hit_distance = neg_inv_density * std::log(random_double());
+        auto hit_distance = neg_inv_density * shading_log(random_double());
 
         if (hit_distance > distance_inside_boundary)
             return false;
 
-        rec.t = rec1.t + hit_distance / ray_length;
-        rec.p = r.at(rec.t);
-
-        rec.normal = vec3(1, 0, 0); // arbitary
-        rec.front_face = true;      // also arbitary
-        rec.mat = phase_function;
-
+        t = rec1.t + hit_distance / ray_length;
         return true;
     }
-
-    aabb bounding_box() const override { return boundary->bounding_box(); }
-    vec3 center() const override { return boundary->center(); }
-
-private:
-    shared_ptr<hittable> boundary;
-    double neg_inv_density;
-    shared_ptr<material> phase_function;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,64 @@
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include "utils.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+struct content_hasher // FNV-1a over whole 64-bit words, each premixed so every bit reaches the result
+{
+    uint64_t value = 14695981039346656037ull;
+
+    void add(uint64_t word)
+    {
+        word ^= word >> 33;
+        word *= 0xff51afd7ed558ccdull;
+        word ^= word >> 33;
+        value = (value ^ word) * 1099511628211ull;
+    }
+
+    void add(double x)
+    {
+        uint64_t word;
+        std::memcpy(&word, &x, sizeof word);
+        add(word);
+    }
+
+    void add(const vec3 &v)
+    {
+        for (int axis = 0; axis < 3; axis++)
+            add(v[axis]);
+    }
+
+    void add(const std::string &text)
+    {
+        add(uint64_t(text.size()));
+        add_bytes(text.data(), text.size());
+    }
+
+    void add_bytes(const void *data, size_t size)
+    {
+        // The last word is padded with zeros; callers that need it add the size themselves.
+        auto bytes = static_cast<const unsigned char *>(data);
+        for (size_t offset = 0; offset < size; offset += sizeof(uint64_t))
+        {
+            uint64_t word = 0;
+            std::memcpy(&word, bytes + offset, std::min(sizeof word, size - offset));
+            add(word);
+        }
+    }
+
+    template <typename Shape>
+    void add_shape(const Shape &shape)
+    {
+        static_assert(std::is_trivially_copyable<Shape>::value && sizeof(Shape) % sizeof(uint64_t) == 0,
+                      "shapes are hashed as plain arrays of words");
+        add_bytes(&shape, sizeof shape);
+    }
+};
+
+#endif
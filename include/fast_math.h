@@ -0,0 +1,298 @@
+#ifndef FAST_MATH_H
+#define FAST_MATH_H
+
+// Approximations of the transcendentals on the shading path, with bounded error. The
+// fast_* functions are always the approximations; the shading_* functions are what the
+// renderer calls, and are exact unless RT_FAST_MATH is defined. bench/fast_math_bench.cpp
+// measures the errors and speedups; the bounds quoted below are what it found.
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FAST_MATH_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Constants of the range reductions; pi itself comes from utils.h.
+const double fast_math_sqrt2 = 1.4142135623730950488;
+const double fast_math_ln2 = 0.69314718055994530942;
+const double fast_math_pi_hi = 3.14159265346825122834;     // Leading 33 bits of pi, so k * pi_hi is
+const double fast_math_pi_lo = 1.215420101301238449864e-10; // exact for the k that occur
+const double fast_math_round_magic = 6755399441055744.0;   // x + this - this rounds x < 2^51
+const double fast_math_reduction_limit = 1e5;              // Beyond this, fast_sin() uses std::sin()
+
+inline double fast_sin_poly(double r)
+{
+    // Taylor series of sin up to r^15, for |r| <= pi/2.
+    auto r2 = r * r;
+    auto p = -7.6471637318198164759e-13;
+    p = p * r2 + 1.6059043836821614599e-10;
+    p = p * r2 - 2.5052108385441718775e-8;
+    p = p * r2 + 2.7557319223985890653e-6;
+    p = p * r2 - 1.9841269841269841270e-4;
+    p = p * r2 + 8.3333333333333333333e-3;
+    p = p * r2 - 1.6666666666666666667e-1;
+    return r + r * r2 * p;
+}
+
+inline double fast_sin(double x)
+{
+    // Absolute error below 1e-11.
+    if (!(std::fabs(x) < fast_math_reduction_limit))
+        return std::sin(x);
+
+    // x = k pi + r with |r| <= pi/2, and sin(x) = (-1)^k sin(r).
+    auto k = (x / pi + fast_math_round_magic) - fast_math_round_magic;
+    auto r = (x - k * fast_math_pi_hi) - k * fast_math_pi_lo;
+    auto s = fast_sin_poly(r);
+    return (int64_t(k) & 1) ? -s : s;
+}
+
+inline double fast_cos(double x)
+{
+    return fast_sin(x + pi / 2);
+}
+
+inline void fast_sincos(double x, double &sin_x, double &cos_x)
+{
+    // Both at the cost of one range reduction; the same error as fast_sin().
+    if (!(std::fabs(x) < fast_math_reduction_limit))
+    {
+        sin_x = std::sin(x);
+        cos_x = std::cos(x);
+        return;
+    }
+
+    auto k = (x / pi + fast_math_round_magic) - fast_math_round_magic;
+    auto r = (x - k * fast_math_pi_hi) - k * fast_math_pi_lo;
+
+    // Taylor series of cos up to r^16.
+    auto r2 = r * r;
+    auto p = 4.7794773323873852974e-14;
+    p = p * r2 - 1.1470745597729724714e-11;
+    p = p * r2 + 2.0876756987868098979e-9;
+    p = p * r2 - 2.7557319223985890653e-7;
+    p = p * r2 + 2.4801587301587301587e-5;
+    p = p * r2 - 1.3888888888888888889e-3;
+    p = p * r2 + 4.1666666666666666667e-2;
+    p = p * r2 - 0.5;
+    auto c = 1 + r2 * p;
+
+    auto s = fast_sin_poly(r);
+    bool odd = int64_t(k) & 1;
+    sin_x = odd ? -s : s;
+    cos_x = odd ? -c : c;
+}
+
+inline double fast_log(double x)
+{
+    // Relative error below 1e-10 for normal positive x; anything else goes to std::log().
+
+    uint64_t bits;
+    std::memcpy(&bits, &x, sizeof bits);
+    int exponent = int(bits >> 52) - 1023;
+    if (!(x > 0) || exponent == -1023 || exponent == 1024)
+        return std::log(x);
+
+    // x = 2^e m with m in [sqrt(1/2), sqrt(2)), and log(m) = 2 atanh((m-1)/(m+1)).
+    bits = (bits & 0x000fffffffffffffull) | 0x3ff0000000000000ull;
+    double m;
+    std::memcpy(&m, &bits, sizeof m);
+    if (m > fast_math_sqrt2)
+    {
+        m *= 0.5;
+        exponent++;
+    }
+
+    auto s = (m - 1) / (m + 1);
+    auto z = s * s;
+    auto p = 1.0 / 11;
+    p = p * z + 1.0 / 9;
+    p = p * z + 1.0 / 7;
+    p = p * z + 1.0 / 5;
+    p = p * z + 1.0 / 3;
+    return exponent * fast_math_ln2 + 2 * s + 2 * s * z * p;
+}
+
+inline double fast_acos(double x)
+{
+    // Abramowitz and Stegun 4.4.46: absolute error below 3e-8 on [-1,1].
+    auto a = std::fmin(std::fabs(x), 1.0);
+    auto p = -0.0012624911;
+    p = p * a + 0.0066700901;
+    p = p * a - 0.0170881256;
+    p = p * a + 0.0308918810;
+    p = p * a - 0.0501743046;
+    p = p * a + 0.0889789874;
+    p = p * a - 0.2145988016;
+    p = p * a + 1.5707963050;
+    auto r = p * std::sqrt(1 - a);
+    return x < 0 ? pi - r : r;
+}
+
+inline double fast_atan2(double y, double x)
+{
+    // Minimax polynomial for atan on [0,1], extended by symmetry: absolute error below 2e-6.
+
+    auto ax = std::fabs(x), ay = std::fabs(y);
+    auto big = std::fmax(ax, ay), small = std::fmin(ax, ay);
+    auto a = big > 0 ? small / big : 0.0;
+    auto s = a * a;
+
+    auto p = -0.01172120;
+    p = p * s + 0.05265332;
+    p = p * s - 0.11643287;
+    p = p * s + 0.19354346;
+    p = p * s - 0.33262347;
+    p = p * s + 0.99997726;
+    auto r = a * p;
+
+    r = ay > ax ? pi / 2 - r : r;
+    r = x < 0 ? pi - r : r;
+    return std::copysign(r, y);
+}
+
+inline double pow5(double x)
+{
+    // Exact up to rounding, and cheaper than std::pow.
+    auto x2 = x * x;
+    return x2 * x2 * x;
+}
+
+#ifdef FAST_MATH_SSE2
+inline __m128 fast_sin_reduced_ps(__m128 r, __m128i odd)
+{
+    // Single precision sin of four reduced arguments |r| <= pi/2 (Taylor series up to r^11),
+    // negated where `odd` is set.
+    __m128 r2 = _mm_mul_ps(r, r);
+    __m128 p = _mm_set1_ps(-2.5052108e-8f);
+    p = _mm_add_ps(_mm_mul_ps(p, r2), _mm_set1_ps(2.7557319e-6f));
+    p = _mm_add_ps(_mm_mul_ps(p, r2), _mm_set1_ps(-1.9841270e-4f));
+    p = _mm_add_ps(_mm_mul_ps(p, r2), _mm_set1_ps(8.3333333e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, r2), _mm_set1_ps(-1.6666667e-1f));
+    __m128 s = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(r, r2), p));
+    return _mm_xor_ps(s, _mm_castsi128_ps(_mm_slli_epi32(odd, 31)));
+}
+
+inline __m128 fast_log_ps(__m128 x)
+{
+    // Single precision log of four positive floats; zero and negative lanes give -infinity.
+    __m128i bits = _mm_castps_si128(x);
+    __m128i exponent = _mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127));
+    __m128 m = _mm_castsi128_ps(
+        _mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)), _mm_set1_epi32(0x3f800000)));
+
+    __m128 above = _mm_cmpgt_ps(m, _mm_set1_ps(float(fast_math_sqrt2)));
+    m = _mm_sub_ps(m, _mm_and_ps(above, _mm_mul_ps(m, _mm_set1_ps(0.5f))));
+    exponent = _mm_sub_epi32(exponent, _mm_castps_si128(above)); // A set mask is -1
+
+    __m128 one = _mm_set1_ps(1);
+    __m128 s = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+    __m128 z = _mm_mul_ps(s, s);
+    __m128 p = _mm_set1_ps(1.0f / 9);
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(1.0f / 7));
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(1.0f / 5));
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(1.0f / 3));
+    __m128 two_s = _mm_add_ps(s, s);
+    __m128 result = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(exponent), _mm_set1_ps(float(fast_math_ln2))),
+                               _mm_add_ps(two_s, _mm_mul_ps(_mm_mul_ps(two_s, z), p)));
+
+    __m128 positive = _mm_cmpgt_ps(x, _mm_setzero_ps());
+    return _mm_or_ps(_mm_and_ps(positive, result), _mm_andnot_ps(positive, _mm_set1_ps(-INFINITY)));
+}
+#endif
+
+inline void fast_sin(const double *x, double *out, size_t count)
+{
+    // Batch fast_sin(), four values per vector: the range reduction runs in double precision
+    // and the polynomial in single, for an absolute error below 2e-7.
+    size_t i = 0;
+
+#ifdef FAST_MATH_SSE2
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128d x01 = _mm_loadu_pd(x + i), x23 = _mm_loadu_pd(x + i + 2);
+        __m128d limit = _mm_set1_pd(fast_math_reduction_limit);
+        __m128d abs_mask = _mm_castsi128_pd(_mm_set1_epi64x(0x7fffffffffffffffll));
+        __m128d in_range = _mm_and_pd(_mm_cmplt_pd(_mm_and_pd(x01, abs_mask), limit),
+                                      _mm_cmplt_pd(_mm_and_pd(x23, abs_mask), limit));
+        if (_mm_movemask_pd(in_range) != 3)
+        {
+            for (int l = 0; l < 4; l++)
+                out[i + l] = fast_sin(x[i + l]);
+            continue;
+        }
+
+        __m128i k01 = _mm_cvtpd_epi32(_mm_mul_pd(x01, _mm_set1_pd(1 / pi)));
+        __m128i k23 = _mm_cvtpd_epi32(_mm_mul_pd(x23, _mm_set1_pd(1 / pi)));
+        __m128d kd01 = _mm_cvtepi32_pd(k01), kd23 = _mm_cvtepi32_pd(k23);
+        __m128d r01 = _mm_sub_pd(_mm_sub_pd(x01, _mm_mul_pd(kd01, _mm_set1_pd(fast_math_pi_hi))),
+                                 _mm_mul_pd(kd01, _mm_set1_pd(fast_math_pi_lo)));
+        __m128d r23 = _mm_sub_pd(_mm_sub_pd(x23, _mm_mul_pd(kd23, _mm_set1_pd(fast_math_pi_hi))),
+                                 _mm_mul_pd(kd23, _mm_set1_pd(fast_math_pi_lo)));
+
+        __m128 r = _mm_movelh_ps(_mm_cvtpd_ps(r01), _mm_cvtpd_ps(r23));
+        __m128i k = _mm_unpacklo_epi64(k01, k23);
+        __m128 s = fast_sin_reduced_ps(r, k);
+
+        _mm_storeu_pd(out + i, _mm_cvtps_pd(s));
+        _mm_storeu_pd(out + i + 2, _mm_cvtps_pd(_mm_movehl_ps(s, s)));
+    }
+#endif
+
+    for (; i < count; i++)
+        out[i] = fast_sin(x[i]);
+}
+
+inline void fast_log(const double *x, double *out, size_t count)
+{
+    // Batch fast_log(), four values per vector in single precision: relative error below 3e-7
+    // for x in the float range.
+    size_t i = 0;
+
+#ifdef FAST_MATH_SSE2
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(x + i)), hi = _mm_cvtpd_ps(_mm_loadu_pd(x + i + 2));
+        __m128 l = fast_log_ps(_mm_movelh_ps(lo, hi));
+        _mm_storeu_pd(out + i, _mm_cvtps_pd(l));
+        _mm_storeu_pd(out + i + 2, _mm_cvtps_pd(_mm_movehl_ps(l, l)));
+    }
+#endif
+
+    for (; i < count; i++)
+        out[i] = fast_log(x[i]);
+}
+
+// The functions the renderer calls.
+
+#ifdef RT_FAST_MATH
+inline double shading_sin(double x) { return fast_sin(x); }
+inline double shading_cos(double x) { return fast_cos(x); }
+inline void shading_sincos(double x, double &s, double &c) { fast_sincos(x, s, c); }
+inline double shading_log(double x) { return fast_log(x); }
+inline double shading_acos(double x) { return fast_acos(x); }
+inline double shading_atan2(double y, double x) { return fast_atan2(y, x); }
+inline void shading_sin(const double *x, double *out, size_t count) { fast_sin(x, out, count); }
+#else
+inline double shading_sin(double x) { return std::sin(x); }
+inline double shading_cos(double x) { return std::cos(x); }
+inline void shading_sincos(double x, double &s, double &c)
+{
+    s = std::sin(x);
+    c = std::cos(x);
+}
+inline double shading_log(double x) { return std::log(x); }
+inline double shading_acos(double x) { return std::acos(x); }
+inline double shading_atan2(double y, double x) { return std::atan2(y, x); }
+inline void shading_sin(const double *x, double *out, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        out[i] = std::sin(x[i]);
+}
+#endif
+
+#endif
@@ -0,0 +1,703 @@
+#ifndef FLAT_BVH_H
+#define FLAT_BVH_H
+
+#include "aligned_box.h"
+#include "content_hash.h"
+#include "hittable.h"
+#include "mapped_file.h"
+#include "quad.h"
+#include "sphere.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+
+template <typename Shape>
+struct typed_primitive // A primitive stored by value in one of the typed leaf arrays
+{
+    Shape shape;
+    uint32_t material;    // Index into the material table
+    uint32_t padding = 0; // Explicit, so that cache files are reproducible byte for byte
+};
+
+struct flat_bvh_node // 32 bytes, laid out depth-first
+{
+    float lo[3], hi[3]; // Single-precision bounds, rounded outwards
+    uint32_t index;     // Interior: second child (the first one follows directly). Leaf: first primitive reference
+    uint16_t count;     // Primitive references in a leaf, 0 for interior nodes
+    uint16_t axis;      // Split axis of an interior node
+};
+
+class flat_bvh : public hittable // BVH in a flat array, with leaves resolved per primitive type at compile time
+{
+public:
+    // Primitive references store the type in their top bits and the array index below.
+    enum primitive_type : uint32_t
+    {
+        sphere_type,
+        quad_type,
+        triangle_type,
+        box_type,
+        rotated_sphere_type, // Spheres baked from a rotation, which keep their UV frame
+        oriented_box_type,   // Boxes baked from a rotation, slab-tested in their own frame
+        other_type,          // Anything else goes through the virtual hittable interface
+        type_count
+    };
+
+    static const int max_leaf_size = 2;
+
+    flat_bvh(const std::vector<shared_ptr<hittable>> &objects, const std::string &cache_filename = "")
+    {
+        // Given a cache file name, a tree cached there for exactly these primitives is mapped
+        // and traversed where it lies, without building or copying anything but the material
+        // table. Otherwise the tree is built here and written there for the next run.
+        if (objects.empty())
+            return;
+
+        if (cache_filename.empty())
+        {
+            RT_TRACE_ZONE("build flat_bvh");
+            build_tree(objects);
+            return;
+        }
+
+        uint64_t hash;
+        {
+            RT_TRACE_ZONE("map BVH cache", cache_filename);
+            size_t counts[type_count] = {};
+            hash = scan(objects, counts);
+            if (map_cache_file(cache_filename, hash, objects.size(), counts))
+                return;
+        }
+
+        materials.clear();
+        others.clear();
+        {
+            RT_TRACE_ZONE("build flat_bvh");
+            build_tree(objects);
+        }
+        RT_TRACE_ZONE("write BVH cache", cache_filename);
+        write_cache_file(cache_filename, hash);
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        if (nodes.size == 0)
+            return false;
+
+        const point3 &orig = r.origin();
+        const vec3 &dir = r.direction();
+        const vec3 inv_dir(1 / dir.x(), 1 / dir.y(), 1 / dir.z());
+
+        // Material of the closest typed hit so far; it is only looked up once at the end.
+        int64_t closest_material = -1;
+        bool hit_anything = false;
+
+        uint32_t stack[64];
+        int stack_size = 0;
+        uint32_t node_index = 0;
+
+        while (true)
+        {
+            const flat_bvh_node &node = nodes[node_index];
+            RT_STAT(thread_stats().bvh_nodes++);
+
+            if (!node_hit(node, orig, inv_dir, ray_t))
+            {
+                if (stack_size == 0)
+                    break;
+                node_index = stack[--stack_size];
+                continue;
+            }
+
+            if (node.count == 0)
+            {
+                // Visit the child on the side the ray comes from first.
+                if (dir[node.axis] < 0)
+                {
+                    stack[stack_size++] = node_index + 1;
+                    node_index = node.index;
+                }
+                else
+                {
+                    stack[stack_size++] = node.index;
+                    node_index = node_index + 1;
+                }
+                continue;
+            }
+
+            for (uint32_t i = node.index; i < node.index + node.count; i++)
+            {
+                int64_t material;
+                if (hit_primitive(refs[i], r, ray_t, rec, material))
+                {
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                    closest_material = material;
+                }
+            }
+
+            if (stack_size == 0)
+                break;
+            node_index = stack[--stack_size];
+        }
+
+        if (closest_material >= 0)
+            rec.mat = materials[closest_material].get();
+
+        return hit_anything;
+    }
+
+    bool occluded(const ray &r, interval ray_t) const override
+    {
+        // Same traversal as hit(), but it stops at the first primitive hit and never writes a
+        // hit record. The nearer child still goes first: blockers tend to sit close to the
+        // shading point, and the test costs a single comparison.
+        if (nodes.size == 0)
+            return false;
+
+        const point3 &orig = r.origin();
+        const vec3 &dir = r.direction();
+        const vec3 inv_dir(1 / dir.x(), 1 / dir.y(), 1 / dir.z());
+
+        uint32_t stack[64];
+        int stack_size = 0;
+        uint32_t node_index = 0;
+
+        while (true)
+        {
+            const flat_bvh_node &node = nodes[node_index];
+
+            if (node_hit(node, orig, inv_dir, ray_t))
+            {
+                if (node.count == 0)
+                {
+                    if (dir[node.axis] < 0)
+                    {
+                        stack[stack_size++] = node_index + 1;
+                        node_index = node.index;
+                    }
+                    else
+                    {
+                        stack[stack_size++] = node.index;
+                        node_index = node_index + 1;
+                    }
+                    continue;
+                }
+
+                for (uint32_t i = node.index; i < node.index + node.count; i++)
+                {
+                    if (occluded_primitive(refs[i], r, ray_t))
+                        return true;
+                }
+            }
+
+            if (stack_size == 0)
+                return false;
+            node_index = stack[--stack_size];
+        }
+    }
+
+    aabb bounding_box() const override { return bbox; }
+    vec3 center() const override { return 0.5 * (bbox.min + bbox.max); }
+
+    size_t node_count() const { return nodes.size; }
+
+    size_t primitive_count(primitive_type type) const
+    {
+        switch (type)
+        {
+        case sphere_type:
+            return spheres.size;
+        case quad_type:
+            return quads.size;
+        case triangle_type:
+            return triangles.size;
+        case box_type:
+            return boxes.size;
+        case rotated_sphere_type:
+            return rotated_spheres.size;
+        case oriented_box_type:
+            return oriented_boxes.size;
+        default:
+            return others.size();
+        }
+    }
+
+    bool loaded_from_cache() const { return cache_file != nullptr; }
+
+private:
+    struct build_item
+    {
+        aabb box;
+        point3 centroid;
+        uint32_t ref;
+    };
+
+    template <typename T>
+    struct array_view // Elements owned by one of the storage vectors, or inside a mapped cache file
+    {
+        const T *data = nullptr;
+        size_t size = 0;
+
+        const T &operator[](size_t i) const { return data[i]; }
+    };
+
+    // Cache file layout: the header, then each array at its offset, aligned to a cache line.
+    // Everything refers to everything else by index, so the arrays are used in place.
+    struct cache_file_header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t content_hash;            // See scan()
+        uint64_t offset[2 + other_type]; // Nodes, references, then the typed primitives in primitive_type order
+        uint64_t count[2 + other_type];
+    };
+
+    static const int section_count = 2 + other_type;
+    static constexpr char cache_file_magic[8] = {'R', 'T', 'W', 'B', 'V', 'H', '\0', '\0'};
+    static const uint32_t cache_file_version = 3;
+    static const size_t cache_file_alignment = 64;
+
+    static const int type_shift = 28;
+    static const uint32_t index_mask = (1u << type_shift) - 1;
+
+    // Traversal reads the tree through these views.
+    array_view<flat_bvh_node> nodes;
+    array_view<uint32_t> refs;
+    array_view<typed_primitive<sphere_shape>> spheres;
+    array_view<typed_primitive<quad_shape>> quads;
+    array_view<typed_primitive<triangle_shape>> triangles;
+    array_view<typed_primitive<box_shape>> boxes;
+    array_view<typed_primitive<rotated_sphere_shape>> rotated_spheres;
+    array_view<typed_primitive<oriented_box_shape>> oriented_boxes;
+
+    // A tree built here lives in these, a cached one in the mapped file.
+    std::vector<flat_bvh_node> node_storage;
+    std::vector<uint32_t> ref_storage;
+    std::vector<typed_primitive<sphere_shape>> sphere_storage;
+    std::vector<typed_primitive<quad_shape>> quad_storage;
+    std::vector<typed_primitive<triangle_shape>> triangle_storage;
+    std::vector<typed_primitive<box_shape>> box_storage;
+    std::vector<typed_primitive<rotated_sphere_shape>> rotated_sphere_storage;
+    std::vector<typed_primitive<oriented_box_shape>> oriented_box_storage;
+    shared_ptr<mapped_file> cache_file;
+
+    std::vector<shared_ptr<hittable>> others;
+    std::vector<shared_ptr<material>> materials;
+    aabb bbox;
+
+    void build_tree(const std::vector<shared_ptr<hittable>> &objects)
+    {
+        std::vector<build_item> items;
+        items.reserve(objects.size());
+        for (const auto &object : objects)
+            items.push_back({object->bounding_box(), object->center(), store(object)});
+
+        node_storage.reserve(2 * items.size() / max_leaf_size + 1);
+        ref_storage.reserve(items.size());
+        build(items, 0, items.size());
+
+        view(nodes, node_storage);
+        view(refs, ref_storage);
+        view(spheres, sphere_storage);
+        view(quads, quad_storage);
+        view(triangles, triangle_storage);
+        view(boxes, box_storage);
+        view(rotated_spheres, rotated_sphere_storage);
+        view(oriented_boxes, oriented_box_storage);
+        set_root_bounds();
+    }
+
+    template <typename T>
+    static void view(array_view<T> &view, const std::vector<T> &storage)
+    {
+        view.data = storage.data();
+        view.size = storage.size();
+    }
+
+    void set_root_bounds()
+    {
+        bbox = aabb(point3(nodes[0].lo[0], nodes[0].lo[1], nodes[0].lo[2]),
+                    point3(nodes[0].hi[0], nodes[0].hi[1], nodes[0].hi[2]));
+    }
+
+    uint32_t store(const shared_ptr<hittable> &object)
+    {
+        // Copies the object into the typed array for its exact type and returns its reference.
+        // Subclasses may override hit(), so they always stay behind the virtual interface.
+
+        const auto &type = typeid(*object);
+        if (type == typeid(sphere))
+            return store(sphere_storage, sphere_type, static_cast<const sphere &>(*object));
+        if (type == typeid(quad))
+            return store(quad_storage, quad_type, static_cast<const quad &>(*object));
+        if (type == typeid(triangle))
+            return store(triangle_storage, triangle_type, static_cast<const triangle &>(*object));
+        if (type == typeid(aligned_box))
+            return store(box_storage, box_type, static_cast<const aligned_box &>(*object));
+        if (type == typeid(rotated_sphere))
+            return store(rotated_sphere_storage, rotated_sphere_type, static_cast<const rotated_sphere &>(*object));
+        if (type == typeid(oriented_box))
+            return store(oriented_box_storage, oriented_box_type, static_cast<const oriented_box &>(*object));
+
+        others.push_back(object);
+        return make_ref(other_type, others.size() - 1);
+    }
+
+    template <typename Shape, typename Primitive>
+    uint32_t store(std::vector<typed_primitive<Shape>> &array, primitive_type type, const Primitive &primitive)
+    {
+        array.push_back({primitive.geometry(), material_index(primitive.material_ptr())});
+        return make_ref(type, array.size() - 1);
+    }
+
+    uint32_t material_index(const shared_ptr<material> &mat)
+    {
+        // Scenes share a handful of materials between many primitives, so a linear search from
+        // the most recently added material is good enough here.
+        for (size_t i = materials.size(); i-- > 0;)
+        {
+            if (materials[i] == mat)
+                return uint32_t(i);
+        }
+        materials.push_back(mat);
+        return uint32_t(materials.size() - 1);
+    }
+
+    static uint32_t make_ref(primitive_type type, size_t index)
+    {
+        return (uint32_t(type) << type_shift) | uint32_t(index);
+    }
+
+    uint64_t scan(const std::vector<shared_ptr<hittable>> &objects, size_t counts[type_count])
+    {
+        // Collects the material table and the virtual primitives just as building would, and
+        // hashes everything the built tree depends on: the geometry and material of the typed
+        // primitives, the bounds of the virtual ones, and the layout of the cached arrays.
+        content_hasher hash;
+        hash.add(uint64_t(cache_file_version));
+        hash.add(uint64_t(max_leaf_size));
+        hash.add(uint64_t(objects.size()));
+        for (auto size : {sizeof(flat_bvh_node), sizeof(typed_primitive<sphere_shape>), sizeof(typed_primitive<quad_shape>),
+                          sizeof(typed_primitive<triangle_shape>), sizeof(typed_primitive<box_shape>),
+                          sizeof(typed_primitive<rotated_sphere_shape>), sizeof(typed_primitive<oriented_box_shape>)})
+            hash.add(uint64_t(size));
+
+        for (const auto &object : objects)
+        {
+            const auto &type = typeid(*object);
+            if (type == typeid(sphere))
+                scan(hash, counts, sphere_type, static_cast<const sphere &>(*object));
+            else if (type == typeid(quad))
+                scan(hash, counts, quad_type, static_cast<const quad &>(*object));
+            else if (type == typeid(triangle))
+                scan(hash, counts, triangle_type, static_cast<const triangle &>(*object));
+            else if (type == typeid(aligned_box))
+                scan(hash, counts, box_type, static_cast<const aligned_box &>(*object));
+            else if (type == typeid(rotated_sphere))
+                scan(hash, counts, rotated_sphere_type, static_cast<const rotated_sphere &>(*object));
+            else if (type == typeid(oriented_box))
+                scan(hash, counts, oriented_box_type, static_cast<const oriented_box &>(*object));
+            else
+            {
+                auto box = object->bounding_box();
+                hash.add(uint64_t(other_type));
+                hash.add(box.min);
+                hash.add(box.max);
+                hash.add(object->center());
+                others.push_back(object);
+                counts[other_type]++;
+            }
+        }
+        return hash.value;
+    }
+
+    template <typename Primitive>
+    void scan(content_hasher &hash, size_t counts[type_count], primitive_type type, const Primitive &primitive)
+    {
+        hash.add(uint64_t(type));
+        hash.add_shape(primitive.geometry());
+        hash.add(uint64_t(material_index(primitive.material_ptr())));
+        counts[type]++;
+    }
+
+    bool map_cache_file(const std::string &filename, uint64_t hash, size_t object_count, const size_t counts[type_count])
+    {
+        // Maps the cache file if it holds a tree for the scanned primitives. The checks only look
+        // at the header, so a valid file costs no more than mapping it.
+        auto file = make_shared<mapped_file>();
+        if (!file->open(filename) || file->size() < sizeof(cache_file_header))
+            return false;
+
+        cache_file_header header;
+        std::memcpy(&header, file->data(), sizeof header);
+        if (std::memcmp(header.magic, cache_file_magic, sizeof header.magic) != 0 ||
+            header.version != cache_file_version || header.content_hash != hash)
+            return false;
+
+        // Every primitive is referenced exactly once, and a binary tree over them has fewer
+        // nodes than twice their number.
+        if (header.count[0] == 0 || header.count[0] >= 2 * uint64_t(object_count) || header.count[1] != object_count)
+            return false;
+        for (uint32_t type = 0; type < other_type; type++)
+            if (header.count[2 + type] != counts[type])
+                return false;
+
+        bool ok = map_section(*file, header, 0, nodes) && map_section(*file, header, 1, refs) &&
+                  map_section(*file, header, 2 + sphere_type, spheres) &&
+                  map_section(*file, header, 2 + quad_type, quads) &&
+                  map_section(*file, header, 2 + triangle_type, triangles) &&
+                  map_section(*file, header, 2 + box_type, boxes) &&
+                  map_section(*file, header, 2 + rotated_sphere_type, rotated_spheres) &&
+                  map_section(*file, header, 2 + oriented_box_type, oriented_boxes);
+        if (!ok)
+        {
+            nodes = {};
+            refs = {};
+            spheres = {};
+            quads = {};
+            triangles = {};
+            boxes = {};
+            rotated_spheres = {};
+            oriented_boxes = {};
+            return false;
+        }
+
+        cache_file = file;
+        set_root_bounds();
+        return true;
+    }
+
+    template <typename T>
+    static bool map_section(const mapped_file &file, const cache_file_header &header, int section, array_view<T> &view)
+    {
+        auto offset = header.offset[section];
+        auto count = header.count[section];
+        if (offset % cache_file_alignment != 0 || offset > file.size() || count > (file.size() - offset) / sizeof(T))
+            return false;
+
+        view.data = reinterpret_cast<const T *>(file.data() + offset);
+        view.size = size_t(count);
+        return true;
+    }
+
+    void write_cache_file(const std::string &filename, uint64_t hash) const
+    {
+        // Like bake files, cache files go through a temporary file, and failing to write one
+        // only means building the tree again next time.
+        cache_file_header header = {};
+        std::memcpy(header.magic, cache_file_magic, sizeof header.magic);
+        header.version = cache_file_version;
+        header.content_hash = hash;
+
+        const void *sections[section_count] = {};
+        size_t bytes[section_count] = {}, counts[section_count] = {};
+        auto add_section = [&](int section, const auto &storage)
+        {
+            sections[section] = storage.data();
+            bytes[section] = storage.size() * sizeof(storage[0]);
+            counts[section] = storage.size();
+        };
+        add_section(0, node_storage);
+        add_section(1, ref_storage);
+        add_section(2 + sphere_type, sphere_storage);
+        add_section(2 + quad_type, quad_storage);
+        add_section(2 + triangle_type, triangle_storage);
+        add_section(2 + box_type, box_storage);
+        add_section(2 + rotated_sphere_type, rotated_sphere_storage);
+        add_section(2 + oriented_box_type, oriented_box_storage);
+
+        uint64_t offset = sizeof header;
+        for (int section = 0; section < section_count; section++)
+        {
+            offset = (offset + cache_file_alignment - 1) / cache_file_alignment * cache_file_alignment;
+            header.offset[section] = offset;
+            header.count[section] = counts[section];
+            offset += bytes[section];
+        }
+
+        auto temp_filename = filename + ".tmp";
+        {
+            std::ofstream out(temp_filename, std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char *>(&header), sizeof header);
+
+            uint64_t written = sizeof header;
+            const char zeros[cache_file_alignment] = {};
+            for (int section = 0; section < section_count; section++)
+            {
+                out.write(zeros, std::streamsize(header.offset[section] - written));
+                out.write(static_cast<const char *>(sections[section]), std::streamsize(bytes[section]));
+                written = header.offset[section] + bytes[section];
+            }
+
+            if (!out)
+            {
+                out.close();
+                std::remove(temp_filename.c_str());
+                return;
+            }
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(temp_filename, filename, ec);
+        if (ec)
+            std::remove(temp_filename.c_str());
+    }
+
+    uint32_t build(std::vector<build_item> &items, size_t start, size_t end)
+    {
+        // Median split on the longest axis of the centroid bounds, emitting nodes depth-first.
+
+        auto node_index = uint32_t(node_storage.size());
+        node_storage.emplace_back();
+
+        aabb bounds = aabb::empty;
+        aabb centroids = aabb::empty;
+        for (size_t i = start; i < end; i++)
+        {
+            bounds = aabb(bounds, items[i].box);
+            centroids = aabb(centroids, aabb(items[i].centroid, items[i].centroid));
+        }
+        set_bounds(node_storage[node_index], bounds);
+
+        // Virtual primitives tend to be expensive (media, instances), so they get leaves of
+        // their own where their bounds can still cull rays.
+        size_t span = end - start;
+        bool has_other = false;
+        for (size_t i = start; i < end; i++)
+            has_other = has_other || (items[i].ref >> type_shift) == other_type;
+
+        if (span == 1 || (span <= max_leaf_size && !has_other))
+        {
+            // Group the leaf by type, so consecutive tests dispatch to the same kernel.
+            std::sort(items.begin() + start, items.begin() + end,
+                      [](const build_item &a, const build_item &b) { return a.ref < b.ref; });
+
+            node_storage[node_index].index = uint32_t(ref_storage.size());
+            node_storage[node_index].count = uint16_t(span);
+            for (size_t i = start; i < end; i++)
+                ref_storage.push_back(items[i].ref);
+            return node_index;
+        }
+
+        int axis = centroids.longest_axis();
+        auto mid = start + span / 2;
+        std::nth_element(items.begin() + start, items.begin() + mid, items.begin() + end,
+                         [axis](const build_item &a, const build_item &b)
+                         { return a.centroid[axis] < b.centroid[axis]; });
+
+        build(items, start, mid);
+        auto second = build(items, mid, end);
+
+        node_storage[node_index].index = second;
+        node_storage[node_index].count = 0;
+        node_storage[node_index].axis = uint16_t(axis);
+        return node_index;
+    }
+
+    static void set_bounds(flat_bvh_node &node, const aabb &box)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const interval &ax = box.axis_interval(axis);
+            float lo = float(ax.min);
+            float hi = float(ax.max);
+            if (lo > ax.min)
+                lo = std::nextafter(lo, -std::numeric_limits<float>::infinity());
+            if (hi < ax.max)
+                hi = std::nextafter(hi, std::numeric_limits<float>::infinity());
+            node.lo[axis] = lo;
+            node.hi[axis] = hi;
+        }
+    }
+
+    static bool node_hit(const flat_bvh_node &node, const point3 &orig, const vec3 &inv_dir, interval ray_t)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            auto t0 = (node.lo[axis] - orig[axis]) * inv_dir[axis];
+            auto t1 = (node.hi[axis] - orig[axis]) * inv_dir[axis];
+            if (inv_dir[axis] < 0)
+                std::swap(t0, t1);
+
+            if (t0 > ray_t.min)
+                ray_t.min = t0;
+            if (t1 < ray_t.max)
+                ray_t.max = t1;
+
+            if (ray_t.max <= ray_t.min)
+                return false;
+        }
+        return true;
+    }
+
+    bool hit_primitive(uint32_t ref, const ray &r, interval ray_t, hit_record &rec, int64_t &material) const
+    {
+        // The switch resolves every primitive type statically, so the intersection kernels
+        // inline into the traversal loop.
+
+        auto index = ref & index_mask;
+        switch (ref >> type_shift)
+        {
+        case sphere_type:
+            return hit_typed(spheres[index], r, ray_t, rec, material);
+        case quad_type:
+            return hit_typed(quads[index], r, ray_t, rec, material);
+        case triangle_type:
+            return hit_typed(triangles[index], r, ray_t, rec, material);
+        case box_type:
+            return hit_typed(boxes[index], r, ray_t, rec, material);
+        case rotated_sphere_type:
+            return hit_typed(rotated_spheres[index], r, ray_t, rec, material);
+        case oriented_box_type:
+            return hit_typed(oriented_boxes[index], r, ray_t, rec, material);
+        default:
+            material = -1; // Virtual primitives set rec.mat themselves
+            return others[index]->hit(r, ray_t, rec);
+        }
+    }
+
+    bool occluded_primitive(uint32_t ref, const ray &r, interval ray_t) const
+    {
+        auto index = ref & index_mask;
+        switch (ref >> type_shift)
+        {
+        case sphere_type:
+            return spheres[index].shape.occluded(r, ray_t);
+        case quad_type:
+            return quads[index].shape.occluded(r, ray_t);
+        case triangle_type:
+            return triangles[index].shape.occluded(r, ray_t);
+        case box_type:
+            return boxes[index].shape.occluded(r, ray_t);
+        case rotated_sphere_type:
+            return rotated_spheres[index].shape.occluded(r, ray_t);
+        case oriented_box_type:
+            return oriented_boxes[index].shape.occluded(r, ray_t);
+        default:
+            return others[index]->occluded(r, ray_t);
+        }
+    }
+
+    template <typename Shape>
+    static bool hit_typed(const typed_primitive<Shape> &primitive, const ray &r, interval ray_t,
+                          hit_record &rec, int64_t &material)
+    {
+        if (!primitive.shape.hit(r, ray_t, rec))
+            return false;
+
+        material = primitive.material;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,378 @@
+#ifndef HETEROGENEOUS_MEDIUM_H
+#define HETEROGENEOUS_MEDIUM_H
+
+#include "bvh.h"
+#include "hittable.h"
+#include "material.h"
+#include "texture.h"
+
+#include <vector>
+
+class density_field // Spatially varying density of a participating medium
+{
+public:
+    virtual ~density_field() = default;
+
+    virtual double density(const point3 &p) const = 0;
+
+    // Upper bound of the density inside the box; the medium's majorant grid is built from it.
+    virtual double max_density(const aabb &box) const = 0;
+};
+
+class density_grid : public density_field // Densities on a regular voxel grid, trilinearly interpolated
+{
+public:
+    density_grid(const aabb &bounds, int nx, int ny, int nz, std::vector<float> values)
+        : values(std::move(values))
+    {
+        // `values` holds nx*ny*nz densities at the voxel centers, x fastest. The density is
+        // zero outside the bounds.
+        size[0] = std::max(1, nx);
+        size[1] = std::max(1, ny);
+        size[2] = std::max(1, nz);
+        this->values.resize(size_t(size[0]) * size[1] * size[2], 0.0f);
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const interval &extent = bounds.axis_interval(axis);
+            origin[axis] = extent.min;
+            voxel[axis] = extent.size() / size[axis];
+        }
+    }
+
+    double density(const point3 &p) const override
+    {
+        int i0[3];
+        double t[3];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            auto x = (p[axis] - origin[axis]) / voxel[axis];
+            if (!(x >= 0 && x <= size[axis]))
+                return 0;
+
+            x -= 0.5;
+            auto fx = std::floor(x);
+            t[axis] = x - fx;
+            i0[axis] = int(fx);
+        }
+
+        double result = 0;
+        for (int c = 0; c < 8; c++)
+        {
+            int x = clamp(i0[0] + (c & 1), 0), y = clamp(i0[1] + ((c >> 1) & 1), 1), z = clamp(i0[2] + (c >> 2), 2);
+            auto weight = (c & 1 ? t[0] : 1 - t[0]) * (c & 2 ? t[1] : 1 - t[1]) * (c & 4 ? t[2] : 1 - t[2]);
+            result += weight * at(x, y, z);
+        }
+        return result;
+    }
+
+    double max_density(const aabb &box) const override
+    {
+        // Interpolation never exceeds the voxels it blends, so the maximum over the voxels
+        // whose centers surround the box bounds it exactly.
+        int lo[3], hi[3];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const interval &extent = box.axis_interval(axis);
+            lo[axis] = clamp(int(std::floor((extent.min - origin[axis]) / voxel[axis] - 0.5)), axis);
+            hi[axis] = clamp(int(std::floor((extent.max - origin[axis]) / voxel[axis] - 0.5)) + 1, axis);
+        }
+
+        double result = 0;
+        for (int z = lo[2]; z <= hi[2]; z++)
+            for (int y = lo[1]; y <= hi[1]; y++)
+                for (int x = lo[0]; x <= hi[0]; x++)
+                    result = std::fmax(result, at(x, y, z));
+        return result;
+    }
+
+private:
+    std::vector<float> values;
+    int size[3];
+    point3 origin;
+    vec3 voxel; // Voxel size along each axis
+
+    int clamp(int i, int axis) const { return std::min(std::max(i, 0), size[axis] - 1); }
+    double at(int x, int y, int z) const { return values[(size_t(z) * size[1] + y) * size[0] + x]; }
+};
+
+class texture_density : public density_field // Density from the red channel of a texture, for procedural media
+{
+public:
+    texture_density(shared_ptr<texture> tex, double scale, double max_value = 1)
+        : tex(tex), scale(scale), max_value(max_value)
+    {
+        // `max_value` bounds the texture's red channel (1 for noise and image textures).
+    }
+
+    double density(const point3 &p) const override
+    {
+        return scale * std::fmax(0.0, tex->value(0, 0, p).x());
+    }
+
+    double max_density(const aabb &box) const override
+    {
+        // Procedural textures have no exact bound over a box, so it is estimated from a 5x5x5
+        // lattice of samples with a safety margin, and capped by the global bound. Where the
+        // estimate is too low, delta tracking clamps the density to it.
+        double sampled = 0;
+        for (int k = 0; k <= 4; k++)
+            for (int j = 0; j <= 4; j++)
+                for (int i = 0; i <= 4; i++)
+                {
+                    point3 p(box.x.min + box.x.size() * i / 4, box.y.min + box.y.size() * j / 4,
+                             box.z.min + box.z.size() * k / 4);
+                    sampled = std::fmax(sampled, density(p));
+                }
+        return std::fmin(1.5 * sampled, scale * max_value);
+    }
+
+private:
+    shared_ptr<texture> tex;
+    double scale;
+    double max_value;
+};
+
+class heterogeneous_medium : public hittable // Medium of varying density, sampled by delta tracking
+{
+public:
+    heterogeneous_medium(shared_ptr<hittable> boundary, shared_ptr<density_field> density,
+                         shared_ptr<material> phase_function, int majorant_resolution = 16)
+        : boundary(boundary), density(density), phase_function(phase_function),
+          majorant_resolution(majorant_resolution)
+    {
+        build_majorants();
+    }
+
+    heterogeneous_medium(shared_ptr<hittable> boundary, shared_ptr<density_field> density, const color &albedo,
+                         int majorant_resolution = 16)
+        : heterogeneous_medium(boundary, density, make_shared<isotropic>(albedo), majorant_resolution)
+    {
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        RT_STAT(thread_stats().tests[stat_medium]++);
+        double t_hit;
+        if (!sample_collision(r, ray_t, t_hit))
+            return false;
+
+        RT_STAT(thread_stats().hits[stat_medium]++);
+        rec.t = t_hit;
+        rec.p = r.at(rec.t);
+
+        rec.normal = vec3(1, 0, 0); // arbitary
+        rec.front_face = true;      // also arbitary
+        rec.uv_area = 0;            // No surface to map a texture onto
+        rec.mat = phase_function.get();
+
+        return true;
+    }
+
+    bool occluded(const ray &r, interval ray_t) const override
+    {
+        // A medium blocks a ray at random, just as often as hit() would scatter it.
+        double t_hit;
+        return sample_collision(r, ray_t, t_hit);
+    }
+
+    double transmittance(const ray &r, interval ray_t) const
+    {
+        // Ratio tracking estimate of the fraction of light passing through the medium along
+        // the ray within ray_t. Unlike delta tracking, which can only say 0 or 1, it weighs
+        // every tentative collision, so estimates through thin media are far less noisy.
+        interval span;
+        if (!boundary_span(r, ray_t, span))
+            return 1;
+
+        auto length = r.direction().length();
+        double result = 1;
+        traverse(r, span, [&](double t0, double t1, double majorant)
+                 {
+                     auto t = t0;
+                     while (true)
+                     {
+                         t -= shading_log(1 - random_double()) / (majorant * length);
+                         if (t >= t1)
+                             return true;
+                         result *= 1 - std::fmin(1.0, density->density(r.at(t)) / majorant);
+                         if (result <= 0)
+                             return false;
+                     } });
+        return result;
+    }
+
+    aabb bounding_box() const override { return boundary->bounding_box(); }
+    vec3 center() const override { return boundary->center(); }
+
+    size_t flatten(const shared_ptr<hittable> &self, std::vector<shared_ptr<hittable>> &out) const override
+    {
+        // Like constant_medium: the boundary gets compiled, the medium stays one object.
+        std::vector<shared_ptr<hittable>> parts;
+        auto dissolved = boundary->flatten(boundary, parts);
+        if (dissolved == 0)
+        {
+            out.push_back(self);
+            return 0;
+        }
+
+        if (parts.empty())
+            return dissolved;
+
+        auto compiled = make_shared<heterogeneous_medium>(*this);
+        compiled->boundary = parts.size() == 1 ? parts[0] : make_shared<bvh_node>(parts, 0, parts.size());
+        out.push_back(compiled);
+        return dissolved;
+    }
+
+private:
+    shared_ptr<hittable> boundary;
+    shared_ptr<density_field> density;
+    shared_ptr<material> phase_function;
+    int majorant_resolution;
+
+    // Coarse grid over the boundary's bounding box holding an upper bound of the density in
+    // each cell, x fastest.
+    std::vector<double> majorants;
+    int cells[3];
+    point3 grid_origin;
+    vec3 cell_size;
+
+    void build_majorants()
+    {
+        aabb bounds = boundary->bounding_box();
+        auto longest = bounds.axis_interval(bounds.longest_axis()).size();
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const interval &extent = bounds.axis_interval(axis);
+            cells[axis] = std::max(1, int(std::ceil(majorant_resolution * extent.size() / longest)));
+            grid_origin[axis] = extent.min;
+            cell_size[axis] = extent.size() / cells[axis];
+        }
+
+        majorants.resize(size_t(cells[0]) * cells[1] * cells[2]);
+        for (int z = 0; z < cells[2]; z++)
+            for (int y = 0; y < cells[1]; y++)
+                for (int x = 0; x < cells[0]; x++)
+                {
+                    point3 lo = grid_origin + vec3(x * cell_size.x(), y * cell_size.y(), z * cell_size.z());
+                    majorants[(size_t(z) * cells[1] + y) * cells[0] + x] =
+                        density->max_density(aabb(lo, lo + cell_size));
+                }
+    }
+
+    bool sample_collision(const ray &r, interval ray_t, double &t_hit) const
+    {
+        // Samples where the ray scatters within ray_t, if it does.
+        interval span;
+        if (!boundary_span(r, ray_t, span))
+            return false;
+
+        // Delta tracking: tentative collisions are drawn against the majorant of each grid cell
+        // and accepted with probability density / majorant. Empty cells cost nothing.
+        auto length = r.direction().length();
+        bool scattered = false;
+        traverse(r, span, [&](double t0, double t1, double majorant)
+                 {
+                     auto t = t0;
+                     while (true)
+                     {
+                         t -= shading_log(1 - random_double()) / (majorant * length);
+                         if (t >= t1)
+                             return true; // On to the next cell
+                         if (random_double() * majorant < density->density(r.at(t)))
+                         {
+                             t_hit = t;
+                             scattered = true;
+                             return false;
+                         }
+                     } });
+
+        return scattered;
+    }
+
+    bool boundary_span(const ray &r, interval ray_t, interval &span) const
+    {
+        // The part of the ray within ray_t that lies between its first two boundary crossings,
+        // as in constant_medium.
+        hit_record rec1, rec2;
+
+        if (!boundary->hit(r, interval::universe, rec1))
+            return false;
+
+        if (!boundary->hit(r, interval(rec1.t + 0.0001, infinity), rec2))
+            return false;
+
+        span = interval(std::fmax(std::fmax(rec1.t, ray_t.min), 0.0), std::fmin(rec2.t, ray_t.max));
+        return span.min < span.max;
+    }
+
+    template <typename Visit>
+    void traverse(const ray &r, interval span, Visit visit) const
+    {
+        // Walks the majorant grid cells along the ray through `span` with a 3D DDA, calling
+        // visit(t0, t1, majorant) for every cell with a non-zero majorant until it returns
+        // false. t0 and t1 are ray parameters, the majorant is per unit of distance.
+
+        const point3 &orig = r.origin();
+        const vec3 &dir = r.direction();
+
+        // Clip the span to the grid.
+        for (int axis = 0; axis < 3; axis++)
+        {
+            auto lo = grid_origin[axis], hi = grid_origin[axis] + cells[axis] * cell_size[axis];
+            if (dir[axis] == 0)
+            {
+                if (orig[axis] < lo || orig[axis] > hi)
+                    return;
+                continue;
+            }
+            auto t0 = (lo - orig[axis]) / dir[axis], t1 = (hi - orig[axis]) / dir[axis];
+            if (t0 > t1)
+                std::swap(t0, t1);
+            span.min = std::fmax(span.min, t0);
+            span.max = std::fmin(span.max, t1);
+        }
+        if (!(span.min < span.max))
+            return;
+
+        int cell[3], step[3];
+        double t_next[3], t_delta[3];
+        auto start = r.at(span.min);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            cell[axis] = std::min(std::max(int((start[axis] - grid_origin[axis]) / cell_size[axis]), 0),
+                                  cells[axis] - 1);
+            if (dir[axis] == 0)
+            {
+                step[axis] = 0;
+                t_next[axis] = t_delta[axis] = infinity;
+                continue;
+            }
+
+            step[axis] = dir[axis] > 0 ? 1 : -1;
+            auto boundary = grid_origin[axis] + (cell[axis] + (step[axis] > 0 ? 1 : 0)) * cell_size[axis];
+            t_next[axis] = (boundary - orig[axis]) / dir[axis];
+            t_delta[axis] = cell_size[axis] / std::fabs(dir[axis]);
+        }
+
+        auto t = span.min;
+        while (t < span.max)
+        {
+            int axis = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+            auto t_exit = std::fmin(t_next[axis], span.max);
+
+            auto majorant = majorants[(size_t(cell[2]) * cells[1] + cell[1]) * cells[0] + cell[0]];
+            if (majorant > 0 && t_exit > t && !visit(t, t_exit, majorant))
+                return;
+
+            t = t_exit;
+            cell[axis] += step[axis];
+            if (cell[axis] < 0 || cell[axis] >= cells[axis])
+                return;
+            t_next[axis] += t_delta[axis];
+        }
+    }
+};
+
+#endif
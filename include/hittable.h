@@ -3,6 +3,9 @@
 
 #include "utils.h"
 #include "aabb.h"
+#include "render_stats.h"
+
+#include <vector>
 
 class material;
 
@@ -11,11 +14,14 @@ class hit_record
 public:
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat;
+    const material *mat; // Owned by the scene, which outlives every hit record
     double t;
     double u;
     double v;
     bool front_face;
+    double uv_area = 0;   // Texture space area per unit of surface area at p, 0 if unknown
+    ray_cone cone;        // Cone of the incoming ray, moved to p
+    double footprint = 0; // Width of the ray cone projected onto the surface, in texture space
 
     void set_face_normal(const ray &r, const vec3 &outward_normal)
     {
@@ -25,6 +31,27 @@ public:
         front_face = dot(r.direction(), outward_normal) < 0;
         normal = front_face ? outward_normal : -outward_normal;
     }
+
+    void set_footprint(const ray &r)
+    {
+        // Moves the cone of the ray that hit p to p, and measures its projection onto the
+        // surface in texture space for texture level-of-detail selection. Call this once the
+        // closest hit is known; primitives only provide uv_area.
+
+        auto length = r.direction().length();
+        cone = ray_cone{r.cone().width_at(t * length), r.cone().spread};
+
+        // Grazing angles stretch the footprint; the clamp keeps it finite.
+        auto cos_theta = std::fabs(dot(r.direction(), normal)) / length;
+        footprint = cone.width * std::sqrt(uv_area) / std::fmax(cos_theta, 0.01);
+    }
+
+    ray_cone scattered_cone(double spread) const
+    {
+        // Cone of a ray scattered at p, with the given spread. A flat mirror keeps the spread
+        // of the incoming cone; rough and diffuse scattering widen it.
+        return ray_cone{cone.width, std::fmax(cone.spread, spread)};
+    }
 };
 
 class hittable
@@ -32,10 +59,62 @@ class hittable
 public:
     virtual ~hittable() = default;
     virtual bool hit(const ray &r, interval ray_t, hit_record &rec) const = 0;
+
+    virtual bool occluded(const ray &r, interval ray_t) const
+    {
+        // Any-hit query: whether anything at all is hit within ray_t, for shadow and visibility
+        // rays. Overrides return on the first intersection found and skip the hit record.
+        hit_record rec;
+        return hit(r, ray_t, rec);
+    }
+
     virtual aabb bounding_box() const = 0;
     virtual vec3 center() const = 0;
+
+    virtual size_t flatten(const shared_ptr<hittable> &self, std::vector<shared_ptr<hittable>> &out) const
+    {
+        // Scene compilation hook: appends the primitives this object is made of to `out` and
+        // returns the number of aggregate or wrapper nodes dissolved on the way. `self` is the
+        // pointer that owns this object; leaf primitives simply append it.
+        out.push_back(self);
+        return 0;
+    }
+
+    virtual bool bake(const matrix &trans, std::vector<shared_ptr<hittable>> &out) const
+    {
+        // Scene compilation hook: appends primitives equivalent to this one with the affine
+        // transform `trans` (row-vector convention, as in matrix) applied to their data, and
+        // returns true. Returns false when that cannot be represented exactly, in which case
+        // the caller keeps an instance wrapper around this object.
+        return false;
+    }
 };
 
+template <typename Wrap>
+size_t flatten_transformed(const shared_ptr<hittable> &self, const shared_ptr<hittable> &object,
+                           const matrix &trans, std::vector<shared_ptr<hittable>> &out, Wrap wrap)
+{
+    // Shared flatten() logic of the transform wrappers: bakes `trans` into every primitive of
+    // the wrapped object where possible, and wraps the remaining ones individually with
+    // `wrap`. If nothing could be pulled out of the wrapper, it stays as it is.
+
+    std::vector<shared_ptr<hittable>> inner;
+    auto dissolved = object->flatten(object, inner);
+
+    bool baked = false;
+    for (const auto &primitive : inner)
+    {
+        if (primitive->bake(trans, out))
+            baked = true;
+        else if (dissolved == 0)
+            out.push_back(self);
+        else
+            out.push_back(wrap(primitive));
+    }
+
+    return (dissolved > 0 || baked) ? dissolved + 1 : 0;
+}
+
 class translate : public hittable
 {
 public:
@@ -60,9 +139,22 @@ public:
         return true;
     }
 
+    bool occluded(const ray &r, interval ray_t) const override
+    {
+        return object->occluded(ray(r.origin() - offset, r.direction(), r.time()), ray_t);
+    }
+
     aabb bounding_box() const override { return bbox; }
     vec3 center() const override { return object->center() + offset; }
 
+    size_t flatten(const shared_ptr<hittable> &self, std::vector<shared_ptr<hittable>> &out) const override
+    {
+        // Push the translation down onto every primitive of the wrapped object.
+        return flatten_transformed(self, object, matrix(vec3(0, 0, 0), offset), out,
+                                   [this](const shared_ptr<hittable> &primitive)
+                                   { return make_shared<translate>(primitive, offset); });
+    }
+
 private:
     shared_ptr<hittable> object;
     vec3 offset;
@@ -72,10 +164,13 @@ private:
 class rotate : public hittable
 {
 public:
-    rotate(shared_ptr<hittable> object, const vec3 &euler_xyz) : object(object)
+    rotate(shared_ptr<hittable> object, const vec3 &euler_xyz)
+        : rotate(object, matrix(euler_xyz, vec3(0, 0, 0))) {}
+
+    rotate(shared_ptr<hittable> object, const matrix &rotation) : object(object)
     {
         bbox = object->bounding_box();
-        trans = matrix(euler_xyz, vec3(0, 0, 0));
+        trans = rotation;
         trans_inv = trans.inverse();
         point3 min(infinity, infinity, infinity);
         point3 max(-infinity, -infinity, -infinity);
@@ -120,9 +215,24 @@ public:
         return true;
     }
 
+    bool occluded(const ray &r, interval ray_t) const override
+    {
+        // Only the ray needs transforming; there is no hit to bring back.
+        ray object_r((trans_inv * matrix(r.origin(), true)).to_vec3(), (trans_inv * matrix(r.direction(), false)).to_vec3(), r.time());
+        return object->occluded(object_r, ray_t);
+    }
+
     aabb bounding_box() const override { return bbox; }
     vec3 center() const override { return (trans * matrix(object->center(), true)).to_vec3(); }
 
+    size_t flatten(const shared_ptr<hittable> &self, std::vector<shared_ptr<hittable>> &out) const override
+    {
+        // Push the rotation down onto every primitive of the wrapped object.
+        return flatten_transformed(self, object, trans, out,
+                                   [this](const shared_ptr<hittable> &primitive)
+                                   { return make_shared<rotate>(primitive, trans); });
+    }
+
 private:
     shared_ptr<hittable> object;
     matrix trans, trans_inv;
@@ -132,7 +242,8 @@ private:
 class scale : public hittable
 {
 public:
-    scale(std::shared_ptr<hittable> object, const vec3 &scaling_factors) : object(object)
+    scale(std::shared_ptr<hittable> object, const vec3 &scaling_factors)
+        : object(object), scaling_factors(scaling_factors)
     {
         bbox = object->bounding_box();
         trans = matrix(
@@ -150,6 +261,9 @@ public:
         point3 min = (trans * matrix(bbox.min, true)).to_vec3();
         point3 max = (trans * matrix(bbox.max, true)).to_vec3();
         bbox = aabb(min, max);
+
+        // Surface areas scale differently depending on their orientation; use the average.
+        area_scale = std::pow(std::fabs(scaling_factors.x() * scaling_factors.y() * scaling_factors.z()), 2.0 / 3);
     }
 
     bool hit(const ray &r, interval ray_t, hit_record &rec) const override
@@ -165,6 +279,7 @@ public:
 
         // Transform the intersection from object space back to world space.
         rec.p = (trans * matrix(rec.p, true)).to_vec3();
+        rec.uv_area /= area_scale;
         
         vec3 rec_normal = (trans * matrix(rec.normal, false)).to_vec3();
         
@@ -174,14 +289,31 @@ public:
         return true;
     }
 
+    bool occluded(const ray &r, interval ray_t) const override
+    {
+        ray object_r((trans_inv * matrix(r.origin(), true)).to_vec3(),
+                     (trans_inv * matrix(r.direction(), false)).to_vec3(),
+                     r.time());
+        return object->occluded(object_r, ray_t);
+    }
+
     aabb bounding_box() const override { return bbox; }
     vec3 center() const override { return (trans * matrix(object->center(), true)).to_vec3(); }
 
+    size_t flatten(const shared_ptr<hittable> &self, std::vector<shared_ptr<hittable>> &out) const override
+    {
+        // Push the scaling down onto every primitive of the wrapped object.
+        return flatten_transformed(self, object, trans, out,
+                                   [this](const shared_ptr<hittable> &primitive)
+                                   { return make_shared<scale>(primitive, scaling_factors); });
+    }
+
 private:
     std::shared_ptr<hittable> object;
     matrix trans, trans_inv;
     aabb bbox;
     vec3 scaling_factors; // Store the scaling factors for later use if needed
+    double area_scale;    // Average factor by which the scaling changes surface areas
 };
 
 class transform: public hittable
@@ -206,9 +338,17 @@ public:
         return true;
     }
 
+    bool occluded(const ray &r, interval ray_t) const override { return translation->occluded(r, ray_t); }
+
     aabb bounding_box() const override { return bbox; }
     vec3 center() const override { return translation->center(); }
 
+    size_t flatten(const shared_ptr<hittable> &self, std::vector<shared_ptr<hittable>> &out) const override
+    {
+        // The composed wrappers already know how to distribute themselves.
+        return translation->flatten(translation, out) + 1;
+    }
+
 private:
     shared_ptr<hittable> object; 
     shared_ptr<hittable> rotation, translation, scaling;  
@@ -41,6 +41,16 @@ public:
         return hit_anything;
     }
 
+    bool occluded(const ray &r, interval ray_t) const override
+    {
+        for (const auto &object : objects)
+        {
+            if (object->occluded(r, ray_t))
+                return true;
+        }
+        return false;
+    }
+
     aabb bounding_box() const override { return bbox; }
     vec3 center() const override
     {
@@ -52,6 +62,14 @@ public:
         return center / objects.size();
     }
 
+    size_t flatten(const shared_ptr<hittable> &self, std::vector<shared_ptr<hittable>> &out) const override
+    {
+        size_t dissolved = 1;
+        for (const auto &object : objects)
+            dissolved += object->flatten(object, out);
+        return dissolved;
+    }
+
 private:
     aabb bbox;
 };
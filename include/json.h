@@ -0,0 +1,547 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+class json_value // A parsed JSON value, remembering where in the text it started
+{
+public:
+    enum kind_type
+    {
+        null_kind,
+        bool_kind,
+        number_kind,
+        string_kind,
+        array_kind,
+        object_kind
+    };
+
+    kind_type kind = null_kind;
+    bool boolean = false;
+    double number = 0;
+    std::string string;
+    std::vector<json_value> items;                           // Array elements
+    std::vector<std::pair<std::string, json_value>> members; // Object members, in file order
+    int line = 0, column = 0;                                // 1-based position, for error messages
+
+    bool is_number() const { return kind == number_kind; }
+    bool is_string() const { return kind == string_kind; }
+    bool is_array() const { return kind == array_kind; }
+    bool is_object() const { return kind == object_kind; }
+
+    const json_value *find(const std::string &key) const
+    {
+        // Member lookup; scene objects only have a handful of members, so a linear search
+        // beats hashing here.
+        for (const auto &member : members)
+        {
+            if (member.first == key)
+                return &member.second;
+        }
+        return nullptr;
+    }
+
+    static const char *kind_name(kind_type kind)
+    {
+        static const char *names[] = {"null", "boolean", "number", "string", "array", "object"};
+        return names[kind];
+    }
+};
+
+class json_parser // Recursive descent parser for strict JSON
+{
+public:
+    bool parse(const char *text, size_t length, json_value &root, std::string &error)
+    {
+        // Parses the whole text into root. On failure returns false with error set to
+        // "line:column: message".
+
+        cursor = text;
+        end = text + length;
+        line = 1;
+        line_start = text;
+        message.clear();
+
+        bool ok = parse_value(root, 0);
+        if (ok)
+        {
+            skip_whitespace();
+            if (cursor != end)
+                ok = fail("unexpected text after the end of the document");
+        }
+
+        if (!ok)
+            error = std::to_string(line) + ":" + std::to_string(column()) + ": " + message;
+        return ok;
+    }
+
+private:
+    static const int max_depth = 256; // Nesting deeper than this is rejected rather than overflowing the stack
+
+    const char *cursor = nullptr;
+    const char *end = nullptr;
+    const char *line_start = nullptr;
+    int line = 1;
+    std::string message;
+
+    int column() const { return int(cursor - line_start) + 1; }
+
+    bool fail(const std::string &what)
+    {
+        message = what;
+        return false;
+    }
+
+    std::string describe_next() const
+    {
+        // The offending character, as it would read in an error message.
+        if (cursor == end)
+            return "end of file";
+        if (*cursor >= 0x20 && *cursor < 0x7f)
+            return std::string("'") + *cursor + "'";
+        char code[8];
+        std::snprintf(code, sizeof code, "0x%02x", unsigned(static_cast<unsigned char>(*cursor)));
+        return std::string("byte ") + code;
+    }
+
+    void skip_whitespace()
+    {
+        while (cursor != end)
+        {
+            char c = *cursor;
+            if (c == '\n')
+            {
+                line++;
+                line_start = cursor + 1;
+            }
+            else if (c != ' ' && c != '\t' && c != '\r')
+                return;
+            cursor++;
+        }
+    }
+
+    bool parse_value(json_value &value, int depth)
+    {
+        skip_whitespace();
+        value.line = line;
+        value.column = column();
+
+        if (depth > max_depth)
+            return fail("values are nested too deeply");
+        if (cursor == end)
+            return fail("expected a value but found the end of file");
+
+        switch (*cursor)
+        {
+        case '{':
+            return parse_object(value, depth);
+        case '[':
+            return parse_array(value, depth);
+        case '"':
+            value.kind = json_value::string_kind;
+            return parse_string(value.string);
+        case 't':
+            value.kind = json_value::bool_kind;
+            value.boolean = true;
+            return parse_literal("true");
+        case 'f':
+            value.kind = json_value::bool_kind;
+            value.boolean = false;
+            return parse_literal("false");
+        case 'n':
+            value.kind = json_value::null_kind;
+            return parse_literal("null");
+        default:
+            if (*cursor == '-' || (*cursor >= '0' && *cursor <= '9'))
+                return parse_number(value);
+            return fail("expected a value but found " + describe_next());
+        }
+    }
+
+    bool parse_literal(const char *word)
+    {
+        const char *start = cursor;
+        for (const char *c = word; *c; c++, cursor++)
+        {
+            if (cursor == end || *cursor != *c)
+            {
+                cursor = start;
+                return fail(std::string("expected '") + word + "'");
+            }
+        }
+        return true;
+    }
+
+    bool parse_number(json_value &value)
+    {
+        // Checks the JSON grammar first, since from_chars also accepts forms JSON does not
+        // (leading zeros, "inf", a missing integer part).
+        const char *start = cursor;
+        const char *p = cursor;
+        if (p != end && *p == '-')
+            p++;
+        if (p == end || !(*p >= '0' && *p <= '9'))
+            return fail("malformed number");
+        if (*p == '0')
+            p++;
+        else
+            while (p != end && *p >= '0' && *p <= '9')
+                p++;
+        if (p != end && *p == '.')
+        {
+            p++;
+            if (p == end || !(*p >= '0' && *p <= '9'))
+                return fail("malformed number: expected digits after '.'");
+            while (p != end && *p >= '0' && *p <= '9')
+                p++;
+        }
+        if (p != end && (*p == 'e' || *p == 'E'))
+        {
+            p++;
+            if (p != end && (*p == '+' || *p == '-'))
+                p++;
+            if (p == end || !(*p >= '0' && *p <= '9'))
+                return fail("malformed number: expected digits in the exponent");
+            while (p != end && *p >= '0' && *p <= '9')
+                p++;
+        }
+
+        auto result = std::from_chars(start, p, value.number);
+        if (result.ec != std::errc())
+            return fail("number out of range");
+
+        value.kind = json_value::number_kind;
+        cursor = p;
+        return true;
+    }
+
+    bool parse_string(std::string &out)
+    {
+        cursor++; // Opening quote
+        out.clear();
+
+        while (true)
+        {
+            // Copy runs of plain characters in one go.
+            const char *run = cursor;
+            while (cursor != end && *cursor != '"' && *cursor != '\\' && static_cast<unsigned char>(*cursor) >= 0x20)
+                cursor++;
+            out.append(run, cursor);
+
+            if (cursor == end)
+                return fail("unterminated string");
+            if (*cursor == '"')
+            {
+                cursor++;
+                return true;
+            }
+            if (*cursor != '\\')
+                return fail("control character in string; use an escape sequence");
+
+            cursor++;
+            if (cursor == end)
+                return fail("unterminated string");
+            switch (*cursor++)
+            {
+            case '"':
+                out += '"';
+                break;
+            case '\\':
+                out += '\\';
+                break;
+            case '/':
+                out += '/';
+                break;
+            case 'b':
+                out += '\b';
+                break;
+            case 'f':
+                out += '\f';
+                break;
+            case 'n':
+                out += '\n';
+                break;
+            case 'r':
+                out += '\r';
+                break;
+            case 't':
+                out += '\t';
+                break;
+            case 'u':
+                if (!parse_unicode_escape(out))
+                    return false;
+                break;
+            default:
+                cursor--;
+                return fail("unknown escape sequence '\\" + std::string(1, *cursor) + "'");
+            }
+        }
+    }
+
+    bool parse_hex4(uint32_t &code)
+    {
+        code = 0;
+        for (int i = 0; i < 4; i++, cursor++)
+        {
+            if (cursor == end)
+                return fail("unterminated \\u escape");
+            char c = *cursor;
+            int digit = (c >= '0' && c <= '9') ? c - '0'
+                        : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+                        : (c >= 'A' && c <= 'F') ? c - 'A' + 10
+                                                 : -1;
+            if (digit < 0)
+                return fail("expected a hexadecimal digit in \\u escape");
+            code = code * 16 + uint32_t(digit);
+        }
+        return true;
+    }
+
+    bool parse_unicode_escape(std::string &out)
+    {
+        // \uXXXX, with UTF-16 surrogate pairs combined, appended as UTF-8.
+        uint32_t code;
+        if (!parse_hex4(code))
+            return false;
+
+        if (code >= 0xd800 && code < 0xdc00)
+        {
+            uint32_t low;
+            if (end - cursor < 2 || cursor[0] != '\\' || cursor[1] != 'u')
+                return fail("unpaired surrogate in \\u escape");
+            cursor += 2;
+            if (!parse_hex4(low))
+                return false;
+            if (low < 0xdc00 || low >= 0xe000)
+                return fail("unpaired surrogate in \\u escape");
+            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+        }
+        else if (code >= 0xdc00 && code < 0xe000)
+            return fail("unpaired surrogate in \\u escape");
+
+        if (code < 0x80)
+            out += char(code);
+        else if (code < 0x800)
+        {
+            out += char(0xc0 | (code >> 6));
+            out += char(0x80 | (code & 0x3f));
+        }
+        else if (code < 0x10000)
+        {
+            out += char(0xe0 | (code >> 12));
+            out += char(0x80 | ((code >> 6) & 0x3f));
+            out += char(0x80 | (code & 0x3f));
+        }
+        else
+        {
+            out += char(0xf0 | (code >> 18));
+            out += char(0x80 | ((code >> 12) & 0x3f));
+            out += char(0x80 | ((code >> 6) & 0x3f));
+            out += char(0x80 | (code & 0x3f));
+        }
+        return true;
+    }
+
+    bool parse_array(json_value &value, int depth)
+    {
+        value.kind = json_value::array_kind;
+        cursor++; // '['
+
+        skip_whitespace();
+        if (cursor != end && *cursor == ']')
+        {
+            cursor++;
+            return true;
+        }
+
+        while (true)
+        {
+            value.items.emplace_back();
+            if (!parse_value(value.items.back(), depth + 1))
+                return false;
+
+            skip_whitespace();
+            if (cursor != end && *cursor == ',')
+            {
+                cursor++;
+                continue;
+            }
+            if (cursor != end && *cursor == ']')
+            {
+                cursor++;
+                return true;
+            }
+            return fail("expected ',' or ']' in array but found " + describe_next());
+        }
+    }
+
+    bool parse_object(json_value &value, int depth)
+    {
+        value.kind = json_value::object_kind;
+        cursor++; // '{'
+
+        skip_whitespace();
+        if (cursor != end && *cursor == '}')
+        {
+            cursor++;
+            return true;
+        }
+
+        while (true)
+        {
+            skip_whitespace();
+            if (cursor == end || *cursor != '"')
+                return fail("expected a member name in quotes but found " + describe_next());
+
+            std::string key;
+            if (!parse_string(key))
+                return false;
+            for (const auto &member : value.members)
+            {
+                if (member.first == key)
+                    return fail("duplicate member \"" + key + "\"");
+            }
+
+            skip_whitespace();
+            if (cursor == end || *cursor != ':')
+                return fail("expected ':' after member name but found " + describe_next());
+            cursor++;
+
+            value.members.emplace_back(std::move(key), json_value());
+            if (!parse_value(value.members.back().second, depth + 1))
+                return false;
+
+            skip_whitespace();
+            if (cursor != end && *cursor == ',')
+            {
+                cursor++;
+                continue;
+            }
+            if (cursor != end && *cursor == '}')
+            {
+                cursor++;
+                return true;
+            }
+            return fail("expected ',' or '}' in object but found " + describe_next());
+        }
+    }
+};
+
+class json_writer // Streams indented JSON, for reports meant to be read back by scripts
+{
+public:
+    explicit json_writer(std::ostream &out) : out(out) {}
+
+    // Members of an object take a key; elements of an array pass nullptr.
+    void begin_object(const char *key = nullptr) { open(key, '{'); }
+    void end_object() { close('}'); }
+    void begin_array(const char *key = nullptr) { open(key, '['); }
+    void end_array() { close(']'); }
+
+    void value(const char *key, const std::string &text)
+    {
+        start_value(key);
+        write_string(text);
+    }
+
+    void value(const char *key, const char *text) { value(key, std::string(text)); }
+
+    void value(const char *key, double number)
+    {
+        // Shortest text that reads back as the same double; JSON has no infinities or NaNs.
+        start_value(key);
+        if (!std::isfinite(number))
+        {
+            out << "null";
+            return;
+        }
+        char text[32];
+        auto result = std::to_chars(text, text + sizeof text, number);
+        out.write(text, result.ptr - text);
+    }
+
+    void value(const char *key, int number) { value(key, int64_t(number)); }
+    void value(const char *key, uint64_t number)
+    {
+        start_value(key);
+        out << number;
+    }
+    void value(const char *key, int64_t number)
+    {
+        start_value(key);
+        out << number;
+    }
+
+    void value(const char *key, bool flag)
+    {
+        start_value(key);
+        out << (flag ? "true" : "false");
+    }
+
+private:
+    std::ostream &out;
+    std::vector<bool> first; // Per open object or array, whether nothing was written into it yet
+
+    void start_value(const char *key)
+    {
+        if (!first.empty())
+        {
+            out << (first.back() ? "\n" : ",\n");
+            first.back() = false;
+            out << std::string(4 * first.size(), ' ');
+        }
+        if (key)
+        {
+            write_string(key);
+            out << ": ";
+        }
+    }
+
+    void open(const char *key, char bracket)
+    {
+        start_value(key);
+        out << bracket;
+        first.push_back(true);
+    }
+
+    void close(char bracket)
+    {
+        bool empty = first.back();
+        first.pop_back();
+        if (!empty)
+            out << '\n' << std::string(4 * first.size(), ' ');
+        out << bracket;
+        if (first.empty())
+            out << '\n';
+    }
+
+    void write_string(const std::string &text)
+    {
+        out << '"';
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                out << '\\' << c;
+            else if (c == '\n')
+                out << "\\n";
+            else if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char escape[8];
+                std::snprintf(escape, sizeof escape, "\\u%04x", unsigned(c));
+                out << escape;
+            }
+            else
+                out << c;
+        }
+        out << '"';
+    }
+};
+
+#endif
@@ -4,12 +4,16 @@
 #include "hittable.h"
 #include "texture.h"
 
+// Spread of the ray cone after a diffuse bounce. Whatever such a ray hits is only seen blurred
+// by the wide scattering lobe, so a coarse texture level is good enough for it.
+const double diffuse_cone_spread = 0.5;
+
 class material
 {
 public:
     virtual ~material() = default;
 
-    virtual color emitted(double u, double v, const point3 &p) const
+    virtual color emitted(const hit_record &rec) const
     {
         return color(0, 0, 0);
     }
@@ -36,8 +40,8 @@ public:
         if (scatter_direction.near_zero())
             scatter_direction = rec.normal;
 
-        scattered = ray(rec.p, scatter_direction, r_in.time());
-        attenuation = tex->value(rec.u, rec.v, rec.p);
+        scattered = ray(rec.p, scatter_direction, r_in.time(), rec.scattered_cone(diffuse_cone_spread));
+        attenuation = tex->value(rec.u, rec.v, rec.p, rec.footprint);
         return true;
     }
 
@@ -56,8 +60,8 @@ public:
     {
         vec3 reflected = reflect(r_in.direction(), rec.normal);
         reflected = unit_vector(reflected) + (fuzz * random_unit_vector());
-        scattered = ray(rec.p, reflected, r_in.time());
-        attenuation = tex->value(rec.u, rec.v, rec.p);
+        scattered = ray(rec.p, reflected, r_in.time(), rec.scattered_cone(fuzz));
+        attenuation = tex->value(rec.u, rec.v, rec.p, rec.footprint);
         return (dot(scattered.direction(), rec.normal) > 0);
     }
 
@@ -89,7 +93,7 @@ public:
         else
             direction = refract(unit_direction, rec.normal, ri);
 
-        scattered = ray(rec.p, direction, r_in.time());
+        scattered = ray(rec.p, direction, r_in.time(), rec.scattered_cone(0));
         return true;
     }
 
@@ -103,7 +107,7 @@ private:
         // Use Schlick's approximation for reflectance.
         auto r0 = (1 - refraction_index) / (1 + refraction_index);
         r0 = r0 * r0;
-        return r0 + (1 - r0) * std::pow((1 - cosine), 5);
+        return r0 + (1 - r0) * pow5(1 - cosine);
     }
 };
 
@@ -113,9 +117,9 @@ public:
     diffuse_light(shared_ptr<texture> tex) : tex(tex) {}
     diffuse_light(const color &emit) : tex(make_shared<solid_color>(emit)) {}
 
-    color emitted(double u, double v, const point3 &p) const override
+    color emitted(const hit_record &rec) const override
     {
-        return tex->value(u, v, p);
+        return tex->value(rec.u, rec.v, rec.p, rec.footprint);
     }
 
 private:
@@ -131,8 +135,8 @@ public:
     bool scatter(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered)
         const override
     {
-        scattered = ray(rec.p, random_unit_vector(), r_in.time());
-        attenuation = tex->value(rec.u, rec.v, rec.p);
+        scattered = ray(rec.p, random_unit_vector(), r_in.time(), rec.scattered_cone(diffuse_cone_spread));
+        attenuation = tex->value(rec.u, rec.v, rec.p, rec.footprint);
         return true;
     }
 
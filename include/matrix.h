@@ -181,4 +181,39 @@ inline matrix operator*(const matrix &a, const matrix &b)
     return result;
 }
 
-#endif
\ No newline at end of file
+inline vec3 transform_point(const matrix &m, const point3 &p)
+{
+    return (m * matrix(p, true)).to_vec3();
+}
+
+inline vec3 transform_vector(const matrix &m, const vec3 &v)
+{
+    return (m * matrix(v, false)).to_vec3();
+}
+
+inline bool uniform_scale_of(const matrix &m, double &s)
+{
+    // Returns true if the linear part of m is a rotation times a positive uniform scale, and
+    // stores that scale in s. Such transforms keep spheres spheres and preserve angles.
+
+    vec3 rows[3] = {vec3(m.m[0][0], m.m[0][1], m.m[0][2]),
+                    vec3(m.m[1][0], m.m[1][1], m.m[1][2]),
+                    vec3(m.m[2][0], m.m[2][1], m.m[2][2])};
+
+    auto s2 = rows[0].length_squared();
+    auto tolerance = 1e-9 * s2;
+    for (int i = 0; i < 3; i++)
+    {
+        if (std::fabs(rows[i].length_squared() - s2) > tolerance)
+            return false;
+        if (std::fabs(dot(rows[i], rows[(i + 1) % 3])) > tolerance)
+            return false;
+    }
+    if (s2 <= 0 || dot(cross(rows[0], rows[1]), rows[2]) <= 0) // no mirroring
+        return false;
+
+    s = std::sqrt(s2);
+    return true;
+}
+
+#endif
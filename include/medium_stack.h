@@ -0,0 +1,55 @@
+#ifndef MEDIUM_STACK_H
+#define MEDIUM_STACK_H
+
+class medium_stack // Media a path is currently inside of, by index into the scene's media, most recent last
+{
+public:
+    static const int capacity = 8; // Deeper nesting than this is ignored
+
+    void set(int medium, bool inside)
+    {
+        // Records entering (inside) or leaving the given medium.
+        if (inside)
+            enter(medium);
+        else
+            exit(medium);
+    }
+
+    void enter(int medium)
+    {
+        if (!contains(medium) && count < capacity)
+            items[count++] = medium;
+    }
+
+    void exit(int medium)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (items[i] == medium)
+            {
+                for (int j = i + 1; j < count; j++)
+                    items[j - 1] = items[j];
+                count--;
+                return;
+            }
+        }
+    }
+
+    bool contains(int medium) const
+    {
+        for (int i = 0; i < count; i++)
+            if (items[i] == medium)
+                return true;
+        return false;
+    }
+
+    bool empty() const { return count == 0; }
+    int size() const { return count; }
+    int operator[](int i) const { return items[i]; }
+
+private:
+    int items[capacity];
+    int count = 0;
+};
+
+#endif
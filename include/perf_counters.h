@@ -0,0 +1,179 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+// Hardware performance counters through Linux perf_event_open(): cycles, instructions, cache,
+// branch and TLB misses of the calling thread and of the threads it starts while counting.
+// Elsewhere, or where the kernel does not allow it (see /proc/sys/kernel/perf_event_paranoid),
+// open() fails and nothing is counted. Counters the CPU lacks are left out on their own.
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+class perf_counters
+{
+public:
+    enum event
+    {
+        cycles,
+        instructions,
+        l1d_misses,    // Level 1 data cache read misses
+        llc_misses,    // Last level cache read misses
+        branch_misses, // Mispredicted branches
+        dtlb_misses,   // Data TLB read misses
+        event_count
+    };
+
+    perf_counters() = default;
+    perf_counters(const perf_counters &) = delete;
+    perf_counters &operator=(const perf_counters &) = delete;
+    ~perf_counters() { close(); }
+
+    static const char *name(event e)
+    {
+        static const char *names[event_count] = {"cycles", "instructions", "l1d_misses",
+                                                 "llc_misses", "branch_misses", "dtlb_misses"};
+        return names[e];
+    }
+
+    static std::string describe(const double per_unit[event_count], const char *unit)
+    {
+        // One line of counts per unit of work, -1 where not counted, e.g.
+        // "per ray: 52.1 cycles, 120 instructions, ..., IPC 2.31".
+        static const char *labels[event_count] = {"cycles", "instructions", "L1D misses",
+                                                  "LLC misses", "branch misses", "dTLB misses"};
+        std::string text = std::string("per ") + unit + ":";
+        char part[64];
+        for (int e = 0; e < event_count; e++)
+        {
+            if (per_unit[e] < 0)
+                continue;
+            std::snprintf(part, sizeof part, " %.3g %s,", per_unit[e], labels[e]);
+            text += part;
+        }
+        if (per_unit[cycles] > 0 && per_unit[instructions] >= 0)
+        {
+            std::snprintf(part, sizeof part, " IPC %.2f,", per_unit[instructions] / per_unit[cycles]);
+            text += part;
+        }
+        text.pop_back();
+        return text;
+    }
+
+    bool open()
+    {
+        // Opens every counter the machine has, returning false with error() set if there are
+        // none. User space only, so the counts do not depend on kernel permissions beyond that.
+        close();
+#ifdef __linux__
+        const uint64_t cache_read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        const struct
+        {
+            uint32_t type;
+            uint64_t config;
+        } events[event_count] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | cache_read_miss},
+            {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | cache_read_miss},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+            {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | cache_read_miss},
+        };
+
+        bool any = false;
+        for (int e = 0; e < event_count; e++)
+        {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof attr);
+            attr.size = sizeof attr;
+            attr.type = events[e].type;
+            attr.config = events[e].config;
+            attr.disabled = 1;
+            attr.inherit = 1; // Also count threads started after this, such as render threads
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            fds[e] = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+            if (fds[e] >= 0)
+                any = true;
+            else if (message.empty())
+                message = std::string("perf_event_open: ") + std::strerror(errno);
+        }
+        if (any)
+            message.clear();
+        return any;
+#else
+        message = "hardware counters are only supported on Linux";
+        return false;
+#endif
+    }
+
+    void close()
+    {
+#ifdef __linux__
+        for (auto &fd : fds)
+        {
+            if (fd >= 0)
+                ::close(fd);
+            fd = -1;
+        }
+#endif
+    }
+
+    void start()
+    {
+        // Zeroes the counters and starts counting. Threads started from here on are counted
+        // as long as they finish before stop().
+#ifdef __linux__
+        for (auto fd : fds)
+        {
+            if (fd >= 0)
+            {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    void stop()
+    {
+        // Stops counting and reads the counts, scaled up for the time a counter was not
+        // scheduled when the CPU has fewer counters than were asked for.
+#ifdef __linux__
+        for (int e = 0; e < event_count; e++)
+        {
+            counts[e] = -1;
+            if (fds[e] < 0)
+                continue;
+            ioctl(fds[e], PERF_EVENT_IOC_DISABLE, 0);
+
+            uint64_t values[3]; // Count, time enabled, time running
+            if (read(fds[e], values, sizeof values) != ssize_t(sizeof values) || values[2] == 0)
+                continue;
+            counts[e] = double(values[0]) * double(values[1]) / double(values[2]);
+        }
+#endif
+    }
+
+    bool has(event e) const { return counts[e] >= 0; }
+    double count(event e) const { return counts[e]; } // Of the last start() to stop(), -1 if not counted
+    const std::string &error() const { return message; }
+
+private:
+    int fds[event_count] = {-1, -1, -1, -1, -1, -1};
+    double counts[event_count] = {-1, -1, -1, -1, -1, -1};
+    std::string message;
+};
+
+#endif
@@ -2,16 +2,31 @@
 #define PERLIN_H
 
 #include "utils.h"
+#include "content_hash.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PERLIN_SSE2 1
+#include <emmintrin.h>
+#endif
 
 class perlin
 {
 public:
     perlin()
     {
+        // Draws the same random numbers, in the same order, as the original double precision
+        // tables did, so scenes built after a perlin object stay the same.
         for (int i = 0; i < point_count; i++)
         {
-            randvec[i] = unit_vector(vec3::random(-1, 1)); 
+            auto g = unit_vector(vec3::random(-1, 1));
             // Generate a tile of 3d random vectors
+            gradient[i][0] = float(g.x());
+            gradient[i][1] = float(g.y());
+            gradient[i][2] = float(g.z());
+            gradient[i][3] = 0;
         }
 
         perlin_generate_perm(perm_x);
@@ -21,85 +36,234 @@ public:
 
     double noise(const point3 &p) const
     {
-        auto u = p.x() - std::floor(p.x());
-        auto v = p.y() - std::floor(p.y());
-        auto w = p.z() - std::floor(p.z());
-
-        auto i = int(std::floor(p.x()));
-        auto j = int(std::floor(p.y()));
-        auto k = int(std::floor(p.z()));
-        vec3 c[2][2][2];
-
-        for (int di = 0; di < 2; di++)
-            for (int dj = 0; dj < 2; dj++)
-                for (int dk = 0; dk < 2; dk++)
-                    c[di][dj][dk] = randvec[perm_x[(i + di) & 255] ^
-                                            perm_y[(j + dj) & 255] ^
-                                            perm_z[(k + dk) & 255]];
-        //&255 to get the remainder of 255, thus specify a vector in randvec for every lattice point
-
-        return perlin_interp(c, u, v, w);
+        const point3 points[lanes] = {p, p, p, p};
+        double results[lanes];
+        noise4(points, results);
+        return results[0];
     }
 
     double turb(const point3 &p, int depth) const
     {
+        // Evaluates four octaves per call of the vectorized kernel.
+        point3 points[lanes];
+        double results[lanes];
         auto accum = 0.0;
         auto temp_p = p;
         auto weight = 1.0;
 
-        for (int i = 0; i < depth; i++)
+        for (int octave = 0; octave < depth; octave += lanes)
         {
-            accum += weight * noise(temp_p);
-            weight *= 0.5;
-            temp_p *= 2;
+            int count = std::min(lanes, depth - octave);
+            for (int l = 0; l < lanes; l++)
+            {
+                points[l] = temp_p;
+                if (l < count)
+                    temp_p *= 2;
+            }
+
+            noise4(points, results);
+
+            for (int l = 0; l < count; l++)
+            {
+                accum += weight * results[l];
+                weight *= 0.5;
+            }
         }
 
         return std::fabs(accum);
     }
 
+    void turb(const point3 *points, double *results, size_t count, int depth) const
+    {
+        // Batch version of turb(): evaluates the points four at a time, one per vector lane.
+        point3 batch[lanes];
+        double noise_values[lanes];
+
+        for (size_t start = 0; start < count; start += lanes)
+        {
+            auto batch_size = std::min(size_t(lanes), count - start);
+            for (int l = 0; l < lanes; l++)
+                batch[l] = points[start + std::min(size_t(l), batch_size - 1)];
+
+            double accum[lanes] = {0, 0, 0, 0};
+            auto weight = 1.0;
+            for (int octave = 0; octave < depth; octave++)
+            {
+                noise4(batch, noise_values);
+                for (int l = 0; l < lanes; l++)
+                {
+                    accum[l] += weight * noise_values[l];
+                    batch[l] *= 2;
+                }
+                weight *= 0.5;
+            }
+
+            for (size_t l = 0; l < batch_size; l++)
+                results[start + l] = std::fabs(accum[l]);
+        }
+    }
+
+    void describe(content_hasher &hash) const
+    {
+        // The random tables, which differ between perlin objects made at different points of
+        // the random sequence.
+        hash.add_bytes(gradient, sizeof gradient);
+        hash.add_bytes(perm_x, sizeof perm_x);
+        hash.add_bytes(perm_y, sizeof perm_y);
+        hash.add_bytes(perm_z, sizeof perm_z);
+    }
+
 private:
     static const int point_count = 256;
-    vec3 randvec[point_count];
-    int perm_x[point_count];
-    int perm_y[point_count];
-    int perm_z[point_count];
+    static constexpr int lanes = 4; // Points evaluated together by noise4()
+
+    alignas(16) float gradient[point_count][4]; // Unit gradients, padded to a vector each
+    uint8_t perm_x[point_count];
+    uint8_t perm_y[point_count];
+    uint8_t perm_z[point_count];
+
+    static void lattice_point(double x, float &frac, int32_t &cell)
+    {
+        // The lattice cell of x and the offset within it, for any finite x. Only the cell modulo
+        // 256 is used, so cells too large for 32 bits are reduced to that first.
+        auto floor = std::floor(x);
+        frac = float(x - floor);
+        cell = std::fabs(floor) < 2147483648.0 ? int32_t(floor) : int32_t(std::fmod(floor, 256.0));
+    }
+
+    void noise4(const point3 points[lanes], double results[lanes]) const
+    {
+        // Noise at four points at once. The lattice cell and offsets are found in double
+        // precision, so large coordinates keep their accuracy; the interpolation runs in float,
+        // one point per vector lane.
+
+        alignas(16) float frac[3][lanes]; // Offsets within the lattice cell, per axis
+        alignas(16) int32_t cell[3][lanes]; // Lattice cell, per axis
+        const float *corner[8][lanes];      // Gradients at the cell corners, per lane
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+#ifdef PERLIN_SSE2
+            // floor() is a library call without SSE4.1, so round towards zero and correct the
+            // negative values instead, two lanes at a time. The conversion only holds 32 bits, so
+            // pairs with a coordinate of 2^31 or more in size go through lattice_point() instead.
+            const __m128d int32_limit = _mm_set1_pd(2147483648.0), sign = _mm_set1_pd(-0.0);
+            for (int l = 0; l < lanes; l += 2)
+            {
+                __m128d x = _mm_set_pd(points[l + 1][axis], points[l][axis]);
+                if (_mm_movemask_pd(_mm_cmpnlt_pd(_mm_andnot_pd(sign, x), int32_limit)))
+                {
+                    lattice_point(points[l][axis], frac[axis][l], cell[axis][l]);
+                    lattice_point(points[l + 1][axis], frac[axis][l + 1], cell[axis][l + 1]);
+                    continue;
+                }
 
-    static void perlin_generate_perm(int *p)
+                __m128i truncated = _mm_cvttpd_epi32(x);
+                __m128d floor = _mm_cvtepi32_pd(truncated);
+                __m128d above = _mm_cmpgt_pd(floor, x);
+                floor = _mm_sub_pd(floor, _mm_and_pd(above, _mm_set1_pd(1)));
+                truncated = _mm_add_epi32(truncated, _mm_shuffle_epi32(_mm_castpd_si128(above), _MM_SHUFFLE(3, 3, 2, 0)));
+
+                _mm_storel_pi(reinterpret_cast<__m64 *>(&frac[axis][l]), _mm_cvtpd_ps(_mm_sub_pd(x, floor)));
+                _mm_storel_epi64(reinterpret_cast<__m128i *>(&cell[axis][l]), truncated);
+            }
+#else
+            for (int l = 0; l < lanes; l++)
+                lattice_point(points[l][axis], frac[axis][l], cell[axis][l]);
+#endif
+        }
+
+        //&255 to get the remainder of 255, thus specify a vector in gradient for every lattice point
+        for (int l = 0; l < lanes; l++)
+        {
+            int x0 = perm_x[cell[0][l] & 255], x1 = perm_x[(cell[0][l] + 1) & 255];
+            int y0 = perm_y[cell[1][l] & 255], y1 = perm_y[(cell[1][l] + 1) & 255];
+            int z0 = perm_z[cell[2][l] & 255], z1 = perm_z[(cell[2][l] + 1) & 255];
+
+            corner[0][l] = gradient[x0 ^ y0 ^ z0];
+            corner[1][l] = gradient[x0 ^ y0 ^ z1];
+            corner[2][l] = gradient[x0 ^ y1 ^ z0];
+            corner[3][l] = gradient[x0 ^ y1 ^ z1];
+            corner[4][l] = gradient[x1 ^ y0 ^ z0];
+            corner[5][l] = gradient[x1 ^ y0 ^ z1];
+            corner[6][l] = gradient[x1 ^ y1 ^ z0];
+            corner[7][l] = gradient[x1 ^ y1 ^ z1];
+        }
+
+#ifdef PERLIN_SSE2
+        const __m128 one = _mm_set1_ps(1), two = _mm_set1_ps(2), three = _mm_set1_ps(3);
+        __m128 u = _mm_load_ps(frac[0]), v = _mm_load_ps(frac[1]), w = _mm_load_ps(frac[2]);
+
+        // Hermite smoothing of the offsets: the weights of the upper corners along each axis.
+        __m128 uu = _mm_mul_ps(_mm_mul_ps(u, u), _mm_sub_ps(three, _mm_mul_ps(two, u)));
+        __m128 vv = _mm_mul_ps(_mm_mul_ps(v, v), _mm_sub_ps(three, _mm_mul_ps(two, v)));
+        __m128 ww = _mm_mul_ps(_mm_mul_ps(w, w), _mm_sub_ps(three, _mm_mul_ps(two, w)));
+
+        __m128 accum = _mm_setzero_ps();
+        for (int c = 0; c < 8; c++)
+        {
+            int i = c >> 2, j = (c >> 1) & 1, k = c & 1;
+
+            // Turn the four lanes' gradients into one vector per component.
+            __m128 gx = _mm_load_ps(corner[c][0]);
+            __m128 gy = _mm_load_ps(corner[c][1]);
+            __m128 gz = _mm_load_ps(corner[c][2]);
+            __m128 gw = _mm_load_ps(corner[c][3]);
+            _MM_TRANSPOSE4_PS(gx, gy, gz, gw);
+
+            __m128 dx = i ? _mm_sub_ps(u, one) : u;
+            __m128 dy = j ? _mm_sub_ps(v, one) : v;
+            __m128 dz = k ? _mm_sub_ps(w, one) : w;
+            __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(gx, dx), _mm_mul_ps(gy, dy)), _mm_mul_ps(gz, dz));
+
+            __m128 weight = _mm_mul_ps(_mm_mul_ps(i ? uu : _mm_sub_ps(one, uu), j ? vv : _mm_sub_ps(one, vv)),
+                                       k ? ww : _mm_sub_ps(one, ww));
+            accum = _mm_add_ps(accum, _mm_mul_ps(weight, dot));
+        }
+
+        alignas(16) float out[lanes];
+        _mm_store_ps(out, accum);
+        for (int l = 0; l < lanes; l++)
+            results[l] = out[l];
+#else
+        for (int l = 0; l < lanes; l++)
+        {
+            float u = frac[0][l], v = frac[1][l], w = frac[2][l];
+            float uu = u * u * (3 - 2 * u);
+            float vv = v * v * (3 - 2 * v);
+            float ww = w * w * (3 - 2 * w);
+
+            float accum = 0;
+            for (int c = 0; c < 8; c++)
+            {
+                int i = c >> 2, j = (c >> 1) & 1, k = c & 1;
+                const float *g = corner[c][l];
+                float dot = g[0] * (u - i) + g[1] * (v - j) + g[2] * (w - k);
+                accum += (i ? uu : 1 - uu) * (j ? vv : 1 - vv) * (k ? ww : 1 - ww) * dot;
+            }
+            results[l] = accum;
+        }
+#endif
+    }
+
+    static void perlin_generate_perm(uint8_t *p)
     {
         for (int i = 0; i < point_count; i++)
-            p[i] = i;
+            p[i] = uint8_t(i);
 
         permute(p, point_count);
     }
 
-    static void permute(int *p, int n)
+    static void permute(uint8_t *p, int n)
     {
         for (int i = n - 1; i > 0; i--)
         {
             int target = random_int(0, i);
-            int tmp = p[i];
+            uint8_t tmp = p[i];
             p[i] = p[target];
             p[target] = tmp;
         }
     }
-
-    static double perlin_interp(const vec3 c[2][2][2], double u, double v, double w)
-    {
-        auto uu = u * u * (3 - 2 * u);
-        auto vv = v * v * (3 - 2 * v);
-        auto ww = w * w * (3 - 2 * w);
-        auto accum = 0.0;
-
-        for (int i = 0; i < 2; i++)
-            for (int j = 0; j < 2; j++)
-                for (int k = 0; k < 2; k++)
-                {
-                    vec3 weight_v(u - i, v - j, w - k);
-                    accum += (i * uu + (1 - i) * (1 - uu)) * (j * vv + (1 - j) * (1 - vv)) * (k * ww + (1 - k) * (1 - ww)) * dot(c[i][j][k], weight_v);
-                }
-
-        return accum;
-    }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -4,30 +4,41 @@
 #include "hittable.h"
 #include "hittable_list.h"
 
-class quad : public hittable
+#include <array>
+#include <typeinfo>
+
+struct planar_shape // Plane of a quad or triangle: corner Q, spanned by the edges u and v
 {
-public:
-    quad(const point3 &Q, const vec3 &u, const vec3 &v, shared_ptr<material> mat)
-        : Q(Q), u(u), v(v), mat(mat)
+    point3 Q;
+    vec3 u, v;
+    vec3 w;
+    vec3 normal;
+    double D;       // Ax + By + Cz = D
+    double uv_area; // Texture space area per unit of surface area
+
+    planar_shape() {}
+
+    planar_shape(const point3 &Q, const vec3 &u, const vec3 &v) : Q(Q), u(u), v(v)
     {
         auto n = cross(u, v);
         normal = unit_vector(n);
         D = dot(normal, Q);
         w = n / dot(n, n);
-
-        set_bounding_box();
+        uv_area = 1 / n.length();
     }
 
-    virtual void set_bounding_box()
+    point3 surface_point(double a, double b) const
     {
-        // Compute the bounding box of all four vertices.
-        auto bbox_diagonal1 = aabb(Q, Q + u + v);
-        auto bbox_diagonal2 = aabb(Q + u, Q + v);
-        bbox = aabb(bbox_diagonal1, bbox_diagonal2);
+        // The point at plane coordinates (and UV coordinates) a,b.
+        return Q + a * u + b * v;
     }
 
-    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    template <typename Interior>
+    bool hit_plane(const ray &r, interval ray_t, hit_record &rec, Interior is_interior) const
     {
+        // Fills in everything about the hit except the material. `is_interior` decides from
+        // the plane coordinates whether the shape was hit, and sets the UV coordinates.
+
         auto denom = dot(normal, r.direction());
 
         // No hit if the ray is parallel to the plane.
@@ -50,18 +61,58 @@ public:
 
         rec.t = t;
         rec.p = intersection;
-        rec.mat = mat;
         rec.set_face_normal(r, normal);
+        rec.uv_area = uv_area;
         return true;
     }
 
-    virtual bool is_interior(double a, double b, hit_record &rec) const
+    template <typename Inside>
+    bool occluded_plane(const ray &r, interval ray_t, Inside inside) const
+    {
+        // hit_plane() without a hit record: `inside` only decides from the plane coordinates
+        // whether the shape was hit.
+
+        auto denom = dot(normal, r.direction());
+        if (std::fabs(denom) < 1e-8)
+            return false;
+
+        auto t = (D - dot(normal, r.origin())) / denom;
+        if (!ray_t.contains(t))
+            return false;
+
+        vec3 planar_hitpt_vector = r.at(t) - Q;
+        return inside(dot(w, cross(planar_hitpt_vector, v)), dot(w, cross(u, planar_hitpt_vector)));
+    }
+};
+
+struct quad_shape : planar_shape // Plain geometry of a parallelogram, without its material
+{
+    using planar_shape::planar_shape;
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const
+    {
+        RT_STAT(thread_stats().tests[stat_quad]++);
+        if (!hit_plane(r, ray_t, rec, interior))
+            return false;
+
+        RT_STAT(thread_stats().hits[stat_quad]++);
+        return true;
+    }
+
+    bool occluded(const ray &r, interval ray_t) const { return occluded_plane(r, ray_t, inside); }
+
+    static bool inside(double a, double b)
     {
         interval unit_interval = interval(0, 1);
+        return unit_interval.contains(a) && unit_interval.contains(b);
+    }
+
+    static bool interior(double a, double b, hit_record &rec)
+    {
         // Given the hit point in plane coordinates, return false if it is outside the
         // primitive, otherwise set the hit record UV coordinates and return true.
 
-        if (!unit_interval.contains(a) || !unit_interval.contains(b))
+        if (!inside(a, b))
             return false;
 
         rec.u = a;
@@ -69,94 +120,176 @@ public:
         return true;
     }
 
+    aabb bounding_box() const
+    {
+        // Compute the bounding box of all four vertices.
+        auto bbox_diagonal1 = aabb(Q, Q + u + v);
+        auto bbox_diagonal2 = aabb(Q + u, Q + v);
+        return aabb(bbox_diagonal1, bbox_diagonal2);
+    }
+};
+
+struct triangle_shape : planar_shape // Plain geometry of a triangle, without its material
+{
+    using planar_shape::planar_shape;
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const
+    {
+        RT_STAT(thread_stats().tests[stat_triangle]++);
+        if (!hit_plane(r, ray_t, rec, interior))
+            return false;
+
+        RT_STAT(thread_stats().hits[stat_triangle]++);
+        return true;
+    }
+
+    bool occluded(const ray &r, interval ray_t) const { return occluded_plane(r, ray_t, inside); }
+
+    static bool inside(double a, double b) { return a >= 0 && b >= 0 && a + b <= 1; }
+
+    static bool interior(double a, double b, hit_record &rec)
+    {
+        // Given the hit point in plane coordinates, return false if it is outside the
+        // primitive, otherwise set the hit record UV coordinates and return true.
+
+        if (!inside(a, b))
+            return false;
+
+        rec.u = a;
+        rec.v = b;
+        return true;
+    }
+
+    aabb bounding_box() const
+    {
+        // Compute the bounding box of all three vertices.
+        auto bbox_1 = aabb(Q, Q + u);
+        auto bbox_2 = aabb(Q, Q + v);
+        return aabb(bbox_1, bbox_2);
+    }
+};
+
+class quad : public hittable
+{
+public:
+    quad(const point3 &Q, const vec3 &u, const vec3 &v, shared_ptr<material> mat)
+        : shape(Q, u, v), mat(mat)
+    {
+        set_bounding_box();
+    }
+
+    virtual void set_bounding_box()
+    {
+        bbox = shape.bounding_box();
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        RT_STAT(thread_stats().tests[stat_quad]++);
+        auto interior = [this](double a, double b, hit_record &rec) { return is_interior(a, b, rec); };
+        if (!shape.hit_plane(r, ray_t, rec, interior))
+            return false;
+
+        RT_STAT(thread_stats().hits[stat_quad]++);
+        rec.mat = mat.get();
+        return true;
+    }
+
+    bool occluded(const ray &r, interval ray_t) const override
+    {
+        // is_interior() may be overridden, and it wants somewhere to put the UVs.
+        hit_record scratch;
+        return shape.occluded_plane(r, ray_t, [&](double a, double b) { return is_interior(a, b, scratch); });
+    }
+
+    virtual bool is_interior(double a, double b, hit_record &rec) const
+    {
+        return quad_shape::interior(a, b, rec);
+    }
+
     aabb bounding_box() const override { return bbox; }
-    vec3 center() const { return Q + u / 2 + v / 2; }
+    vec3 center() const { return shape.Q + shape.u / 2 + shape.v / 2; }
+
+    bool bake(const matrix &trans, std::vector<shared_ptr<hittable>> &out) const override
+    {
+        // Affine maps keep parallelograms parallelograms and preserve plane coordinates. A
+        // subclass may have a different interior, so only plain quads are baked here.
+        if (typeid(*this) != typeid(quad))
+            return false;
+
+        out.push_back(make_shared<quad>(transform_point(trans, shape.Q), transform_vector(trans, shape.u),
+                                        transform_vector(trans, shape.v), mat));
+        return true;
+    }
+
+    const quad_shape &geometry() const { return shape; }
+    const shared_ptr<material> &material_ptr() const { return mat; }
 
 private:
-    point3 Q;
-    vec3 u, v;
-    vec3 w;
+    quad_shape shape;
     shared_ptr<material> mat;
     aabb bbox;
-    vec3 normal;
-    double D; // Ax + By + Cz = D
 };
 
 class triangle : public hittable
 {
 public:
     triangle(const point3 &Q, const vec3 &u, const vec3 &v, shared_ptr<material> mat)
-        : Q(Q), u(u), v(v), mat(mat)
+        : shape(Q, u, v), mat(mat)
     {
-        auto n = cross(u, v);
-        normal = unit_vector(n);
-        D = dot(normal, Q);
-        w = n / dot(n, n);
-
         set_bounding_box();
     }
 
     virtual void set_bounding_box()
     {
-        // Compute the bounding box of all three vertices.
-        auto bbox_1 = aabb(Q, Q + u);
-        auto bbox_2 = aabb(Q, Q + v);
-        bbox = aabb(bbox_1, bbox_2);
+        bbox = shape.bounding_box();
     }
 
     bool hit(const ray &r, interval ray_t, hit_record &rec) const override
     {
-        auto denom = dot(normal, r.direction());
-
-        // No hit if the ray is parallel to the plane.
-        if (std::fabs(denom) < 1e-8)
+        RT_STAT(thread_stats().tests[stat_triangle]++);
+        auto interior = [this](double a, double b, hit_record &rec) { return is_interior(a, b, rec); };
+        if (!shape.hit_plane(r, ray_t, rec, interior))
             return false;
 
-        // Return false if the hit point parameter t is outside the ray interval.
-        auto t = (D - dot(normal, r.origin())) / denom;
-        if (!ray_t.contains(t))
-            return false;
-
-        // Determine if the hit point lies within the planar shape using its plane coordinates.
-        auto intersection = r.at(t);
-        vec3 planar_hitpt_vector = intersection - Q;
-        auto alpha = dot(w, cross(planar_hitpt_vector, v));
-        auto beta = dot(w, cross(u, planar_hitpt_vector));
-
-        if (!is_interior(alpha, beta, rec))
-            return false;
-
-        rec.t = t;
-        rec.p = intersection;
-        rec.mat = mat;
-        rec.set_face_normal(r, normal);
+        RT_STAT(thread_stats().hits[stat_triangle]++);
+        rec.mat = mat.get();
         return true;
     }
 
+    bool occluded(const ray &r, interval ray_t) const override
+    {
+        // is_interior() may be overridden, and it wants somewhere to put the UVs.
+        hit_record scratch;
+        return shape.occluded_plane(r, ray_t, [&](double a, double b) { return is_interior(a, b, scratch); });
+    }
+
     virtual bool is_interior(double a, double b, hit_record &rec) const
     {
-        // Given the hit point in plane coordinates, return false if it is outside the
-        // primitive, otherwise set the hit record UV coordinates and return true.
+        return triangle_shape::interior(a, b, rec);
+    }
 
-        if (a < 0 || b < 0 || a + b > 1)
+    aabb bounding_box() const override { return bbox; }
+    vec3 center() const { return shape.Q / 3 + (shape.Q + shape.u) / 3 + (shape.Q + shape.v) / 3; }
+
+    bool bake(const matrix &trans, std::vector<shared_ptr<hittable>> &out) const override
+    {
+        // Affine maps keep triangles triangles and preserve barycentric coordinates.
+        if (typeid(*this) != typeid(triangle))
             return false;
 
-        rec.u = a;
-        rec.v = b;
+        out.push_back(make_shared<triangle>(transform_point(trans, shape.Q), transform_vector(trans, shape.u),
+                                            transform_vector(trans, shape.v), mat));
         return true;
     }
 
-    aabb bounding_box() const override { return bbox; }
-    vec3 center() const { return Q / 3 + (Q + u) / 3 + (Q + v) / 3; }
+    const triangle_shape &geometry() const { return shape; }
+    const shared_ptr<material> &material_ptr() const { return mat; }
 
 private:
-    point3 Q;
-    vec3 u, v;
-    vec3 w;
+    triangle_shape shape;
     shared_ptr<material> mat;
     aabb bbox;
-    vec3 normal;
-    double D; // Ax + By + Cz = D
 };
 
 inline shared_ptr<hittable_list> tetrahedron(const point3 &a, const point3 &b, const point3 &c, const point3 &d, shared_ptr<material> mat)
@@ -187,9 +320,11 @@ inline shared_ptr<hittable_list> tetrahedron(const point3 &a, const point3 &b, c
     return tetrahedron;
 }
 
-inline shared_ptr<hittable_list> box(const point3 &a, const point3 &b, shared_ptr<material> mat)
+inline shared_ptr<hittable_list> box_sides(const point3 &a, const point3 &b, const std::array<shared_ptr<material>, 6> &mats)
 {
-    // Returns the 3D box (six sides) that contains the two opposite vertices a & b.
+    // Returns the 3D box (six sides) that contains the two opposite vertices a & b, with one
+    // material per side in the order front, right, back, left, top, bottom. Only use this when
+    // the sides need different materials; box() in aligned_box.h is much cheaper to intersect.
 
     auto sides = make_shared<hittable_list>();
 
@@ -201,14 +336,20 @@ inline shared_ptr<hittable_list> box(const point3 &a, const point3 &b, shared_pt
     auto dy = vec3(0, max.y() - min.y(), 0);
     auto dz = vec3(0, 0, max.z() - min.z());
 
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), max.z()), dx, dy, mat));  // front
-    sides->add(make_shared<quad>(point3(max.x(), min.y(), max.z()), -dz, dy, mat)); // right
-    sides->add(make_shared<quad>(point3(max.x(), min.y(), min.z()), -dx, dy, mat)); // back
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()), dz, dy, mat));  // left
-    sides->add(make_shared<quad>(point3(min.x(), max.y(), max.z()), dx, -dz, mat)); // top
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()), dx, dz, mat));  // bottom
+    sides->add(make_shared<quad>(point3(min.x(), min.y(), max.z()), dx, dy, mats[0]));  // front
+    sides->add(make_shared<quad>(point3(max.x(), min.y(), max.z()), -dz, dy, mats[1])); // right
+    sides->add(make_shared<quad>(point3(max.x(), min.y(), min.z()), -dx, dy, mats[2])); // back
+    sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()), dz, dy, mats[3]));  // left
+    sides->add(make_shared<quad>(point3(min.x(), max.y(), max.z()), dx, -dz, mats[4])); // top
+    sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()), dx, dz, mats[5]));  // bottom
 
     return sides;
 }
 
+inline shared_ptr<hittable_list> box_sides(const point3 &a, const point3 &b, shared_ptr<material> mat)
+{
+    // Returns the 3D box as six quads sharing a single material.
+    return box_sides(a, b, {mat, mat, mat, mat, mat, mat});
+}
+
 #endif
\ No newline at end of file
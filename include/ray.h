@@ -3,6 +3,14 @@
 
 #include "vec3.h"
 
+struct ray_cone // Footprint of a ray: a cone around it that grows linearly with distance
+{
+    double width = 0;  // Cone width at the ray origin
+    double spread = 0; // Growth of the width per unit distance travelled (angle in radians)
+
+    double width_at(double distance) const { return width + spread * distance; }
+};
+
 class ray
 {
 public:
@@ -10,6 +18,9 @@ public:
     ray(const point3 &origin, const vec3 &direction, double time)
         : orig(origin), dir(direction), tm(time) {}
 
+    ray(const point3 &origin, const vec3 &direction, double time, const ray_cone &cone)
+        : orig(origin), dir(direction), tm(time), cn(cone) {}
+
     ray(const point3 &origin, const vec3 &direction)
         : ray(origin, direction, 0) {}
 
@@ -18,6 +29,9 @@ public:
 
     double time() const { return tm; }
 
+    // Rays without a footprint (all secondary rays of wrappers, for instance) have a zero cone.
+    const ray_cone &cone() const { return cn; }
+
     point3 at(double t) const
     {
         return orig + t * dir;
@@ -27,6 +41,7 @@ private:
     point3 orig;
     vec3 dir;
     double tm;
+    ray_cone cn;
 };
 
 #endif
\ No newline at end of file
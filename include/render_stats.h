@@ -0,0 +1,201 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+// Render statistics: rays, BVH traversal steps, intersection tests and path lengths, counted
+// per thread while rendering and added up by the camera afterwards. The counters are only
+// compiled in with RT_STATS defined (cmake -DRT_STATS=ON); without it RT_STAT() expands to
+// nothing and the hot paths are exactly what they would be without statistics.
+
+#include "json.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+
+#ifdef RT_STATS
+#define RT_STAT(statement) (statement)
+#else
+#define RT_STAT(statement) ((void)0)
+#endif
+
+struct render_times // Where the last render() spent its time, in milliseconds
+{
+    double compile = 0;      // Flattening the scene and building or loading its BVH
+    double texture_wait = 0; // Waiting for textures still loading once the compile is done
+    double render = 0;       // Tracing the tiles
+    double write = 0;        // Writing the image
+};
+
+enum stat_primitive // Primitive types intersection tests are counted for
+{
+    stat_sphere,
+    stat_quad,
+    stat_triangle,
+    stat_box,
+    stat_medium, // Media sampling a scattering point, as primitives or tracked along the path; their
+                 // boundaries count as their own type, and the global fog is not counted
+    stat_primitive_count
+};
+
+struct render_stats
+{
+#ifdef RT_STATS
+    static constexpr bool enabled = true;
+#else
+    static constexpr bool enabled = false;
+#endif
+
+    enum path_end
+    {
+        escaped,     // Left the scene into the background
+        absorbed,    // Ended on a surface that does not scatter, such as a light
+        depth_limit, // Cut off at max_depth
+        path_end_count
+    };
+
+    static const int path_length_bins = 32; // Longer paths go in the last bin
+
+    uint64_t primary_rays = 0;   // Camera rays
+    uint64_t secondary_rays = 0; // Rays scattered off surfaces and in media
+    uint64_t bvh_nodes = 0;      // BVH nodes whose bounding box was tested, either kind of BVH
+    uint64_t tests[stat_primitive_count] = {};
+    uint64_t hits[stat_primitive_count] = {};
+    uint64_t path_ends[path_end_count] = {};
+    uint64_t path_lengths[path_length_bins] = {}; // Paths by number of rays traced, from 0
+
+    uint64_t rays() const { return primary_rays + secondary_rays; }
+
+    uint64_t primitive_tests() const
+    {
+        uint64_t total = 0;
+        for (auto count : tests)
+            total += count;
+        return total;
+    }
+
+    void end_path(path_end how, int length)
+    {
+        path_ends[how]++;
+        path_lengths[length < path_length_bins ? length : path_length_bins - 1]++;
+    }
+
+    void add(const render_stats &other)
+    {
+        primary_rays += other.primary_rays;
+        secondary_rays += other.secondary_rays;
+        bvh_nodes += other.bvh_nodes;
+        for (int i = 0; i < stat_primitive_count; i++)
+        {
+            tests[i] += other.tests[i];
+            hits[i] += other.hits[i];
+        }
+        for (int i = 0; i < path_end_count; i++)
+            path_ends[i] += other.path_ends[i];
+        for (int i = 0; i < path_length_bins; i++)
+            path_lengths[i] += other.path_lengths[i];
+    }
+
+    void write_table(std::ostream &out, const render_times &times) const
+    {
+        char line[160];
+        auto print = [&](const char *format, auto... values)
+        {
+            std::snprintf(line, sizeof line, format, values...);
+            out << line;
+        };
+        auto per = [](double count, double total) { return total > 0 ? count / total : 0.0; };
+        auto total_rays = double(rays());
+
+        print("Rays: %llu primary, %llu secondary, %.3f M/s\n", (unsigned long long)primary_rays,
+              (unsigned long long)secondary_rays, per(1e-3 * total_rays, times.render));
+        print("Per ray: %.2f BVH nodes, %.2f primitive tests\n", per(double(bvh_nodes), total_rays),
+              per(double(primitive_tests()), total_rays));
+
+        print("%-10s %14s %14s %9s\n", "primitive", "tests", "hits", "hit rate");
+        for (int i = 0; i < stat_primitive_count; i++)
+        {
+            print("%-10s %14llu %14llu %8.1f%%\n", primitive_name(stat_primitive(i)), (unsigned long long)tests[i],
+                  (unsigned long long)hits[i], 100 * per(double(hits[i]), double(tests[i])));
+        }
+
+        uint64_t paths = 0, rays_in_paths = 0;
+        for (int i = 0; i < path_length_bins; i++)
+        {
+            paths += path_lengths[i];
+            rays_in_paths += i * path_lengths[i];
+        }
+        print("Paths: %llu, mean length %.2f; %.1f%% escaped, %.1f%% absorbed, %.1f%% hit the depth limit\n",
+              (unsigned long long)paths, per(double(rays_in_paths), double(paths)),
+              100 * per(double(path_ends[escaped]), double(paths)), 100 * per(double(path_ends[absorbed]), double(paths)),
+              100 * per(double(path_ends[depth_limit]), double(paths)));
+        out << "Path lengths:";
+        for (int i = 0; i < path_length_bins; i++)
+        {
+            if (path_lengths[i])
+                print(" %d%s: %.1f%%", i, i == path_length_bins - 1 ? "+" : "", 100 * per(double(path_lengths[i]), double(paths)));
+        }
+        out << "\n";
+
+        print("Time: compile %.1f ms, texture wait %.1f ms, render %.1f ms, write %.1f ms\n", times.compile,
+              times.texture_wait, times.render, times.write);
+    }
+
+    void write_json(std::ostream &out, const render_times &times) const
+    {
+        json_writer json(out);
+        json.begin_object();
+        json.value("primary_rays", primary_rays);
+        json.value("secondary_rays", secondary_rays);
+        json.value("rays_per_second", times.render > 0 ? 1e3 * double(rays()) / times.render : 0.0);
+        json.value("bvh_nodes", bvh_nodes);
+        json.value("bvh_nodes_per_ray", rays() ? double(bvh_nodes) / double(rays()) : 0.0);
+        json.value("primitive_tests", primitive_tests());
+        json.value("primitive_tests_per_ray", rays() ? double(primitive_tests()) / double(rays()) : 0.0);
+
+        json.begin_object("primitives");
+        for (int i = 0; i < stat_primitive_count; i++)
+        {
+            json.begin_object(primitive_name(stat_primitive(i)));
+            json.value("tests", tests[i]);
+            json.value("hits", hits[i]);
+            json.end_object();
+        }
+        json.end_object();
+
+        json.begin_object("path_ends");
+        json.value("escaped", path_ends[escaped]);
+        json.value("absorbed", path_ends[absorbed]);
+        json.value("depth_limit", path_ends[depth_limit]);
+        json.end_object();
+        json.begin_array("path_lengths"); // Index is the number of rays; the last bin has the longer paths too
+        for (auto count : path_lengths)
+            json.value(nullptr, count);
+        json.end_array();
+
+        json.begin_object("times_ms");
+        json.value("compile", times.compile);
+        json.value("texture_wait", times.texture_wait);
+        json.value("render", times.render);
+        json.value("write", times.write);
+        json.end_object();
+        json.end_object();
+        out << "\n";
+    }
+
+    static const char *primitive_name(stat_primitive kind)
+    {
+        static const char *names[] = {"sphere", "quad", "triangle", "box", "medium"};
+        return names[kind];
+    }
+};
+
+#ifdef RT_STATS
+inline render_stats &thread_stats()
+{
+    // Counters of the calling thread; the camera adds those of its render threads together.
+    thread_local render_stats stats;
+    return stats;
+}
+#endif
+
+#endif
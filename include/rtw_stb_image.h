@@ -8,99 +8,472 @@
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_FAILURE_USERMSG
-#include "external\stb_image.h"
+#include "external/stb_image.h"
 
+#include "mapped_file.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+enum class texel_storage
+{
+    linear_float, // 32-bit float per channel
+    half          // 16-bit float per channel, half the memory of linear_float
+};
+
+enum class texture_filter
+{
+    nearest,   // Closest texel of the full resolution image
+    bilinear,  // Four texels of one mip level
+    trilinear  // Bilinear lookups in the two mip levels around the requested level of detail
+};
 
 class rtw_image
 {
 public:
     rtw_image() {}
 
-    rtw_image(const char *image_filename)
+    rtw_image(const char *image_filename, texel_storage storage = texel_storage::linear_float)
+        : storage(storage)
     {
         // Loads image data from the specified file. If the RTW_IMAGES environment variable is
         // defined, looks only in that directory for the image file. If the image was not found,
         // searches for the specified image file first from the current directory, then in the
         // images/ subdirectory, then the _parent's_ images/ subdirectory, and then _that_
         // parent, on so on, for six levels up. If the image was not loaded successfully,
-        // width() and height() will return 0.
+        // width() and height() will return 0. The mip pyramid is kept in the given storage.
 
-        auto filename = std::string(image_filename);
-        auto imagedir = getenv("RTW_IMAGES");
+        auto filename = find(image_filename);
+        if (filename.empty() || !load(filename))
+            std::cerr << "ERROR: Could not load image file '" << image_filename << "'.\n";
+    }
 
-        // Hunt for the image file in some likely locations.
-        if (imagedir && load(std::string(imagedir) + "/" + image_filename))
-            return;
-        if (load(filename))
-            return;
-        if (load("images/" + filename))
-            return;
-        if (load("../images/" + filename))
-            return;
-        if (load("../../images/" + filename))
-            return;
-        if (load("../../../images/" + filename))
-            return;
-        if (load("../../../../images/" + filename))
-            return;
-        if (load("../../../../../images/" + filename))
-            return;
-        if (load("../../../../../../images/" + filename))
-            return;
+    rtw_image(const float *pixels, int width, int height, texel_storage storage = texel_storage::linear_float)
+        : storage(storage)
+    {
+        // Builds the mip pyramid of an image already in memory: three linear floats per pixel,
+        // left to right and top to bottom.
+        build_mipmaps(pixels, width, height);
+    }
+
+    rtw_image(const rtw_image &) = delete;
+    rtw_image &operator=(const rtw_image &) = delete;
 
-        std::cerr << "ERROR: Could not load image file '" << image_filename << "'.\n";
+    static shared_ptr<const rtw_image> shared(const char *image_filename,
+                                              texel_storage storage = texel_storage::linear_float)
+    {
+        // Process-wide image cache: returns the image loaded earlier from the same file, as long
+        // as the file has not been modified since, and loads it otherwise. Different images
+        // can be loaded from several threads at once; threads asking for the same image wait
+        // for the one loading it.
+
+        struct entry
+        {
+            std::once_flag loaded;
+            shared_ptr<rtw_image> image = make_shared<rtw_image>();
+        };
+
+        static std::mutex cache_mutex;
+        static std::map<std::tuple<std::string, int64_t, texel_storage>, shared_ptr<entry>> cache;
+
+        auto filename = find(image_filename);
+        auto key = std::make_tuple(filename.empty() ? std::string(image_filename) : filename,
+                                   file_stamp(filename).time, storage);
+
+        shared_ptr<entry> cached;
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            auto &slot = cache[key];
+            if (!slot)
+                slot = make_shared<entry>();
+            cached = slot;
+        }
+
+        std::call_once(cached->loaded, [&]
+        {
+            cached->image->storage = storage;
+            if (filename.empty() || !cached->image->load(filename))
+                std::cerr << "ERROR: Could not load image file '" << image_filename << "'.\n";
+        });
+
+        return cached->image;
     }
 
-    ~rtw_image()
+    static std::string find(const char *image_filename)
     {
-        delete[] bdata;
-        STBI_FREE(fdata);
+        // Returns the path of the image file, hunting for it as described for the constructor,
+        // or an empty string if there is no such file.
+
+        auto filename = std::string(image_filename);
+        auto imagedir = getenv("RTW_IMAGES");
+
+        std::vector<std::string> candidates;
+        if (imagedir)
+            candidates.push_back(std::string(imagedir) + "/" + image_filename);
+        candidates.push_back(filename);
+
+        std::string prefix = "images/";
+        for (int level = 0; level <= 6; level++, prefix = "../" + prefix)
+            candidates.push_back(prefix + filename);
+
+        std::error_code ec;
+        for (const auto &candidate : candidates)
+        {
+            if (std::filesystem::is_regular_file(candidate, ec))
+                return candidate;
+        }
+        return "";
     }
 
     bool load(const std::string &filename)
     {
-        // Loads the linear (gamma=1) image data from the given file name. Returns true if the
-        // load succeeded. The resulting data buffer contains the three [0.0, 1.0]
-        // floating-point values for the first pixel (red, then green, then blue). Pixels are
-        // contiguous, going left to right for the width of the image, followed by the next row
-        // below, for the full height of the image.
+        // Loads the image from the given file and returns true if that succeeded. Decoded
+        // images are saved as a mip file (see save_mip_file()) next to the source, or in the
+        // RTW_TEXTURE_CACHE directory if that environment variable is set, and later loads
+        // simply map that file into memory, as long as the source has not changed since.
+
+        auto stamp = file_stamp(filename);
+        auto mip_filename = cache_filename(filename);
+        if (load_mip_file(mip_filename, stamp))
+            return true;
 
+        // Decode the linear (gamma=1) image data: three [0.0, 1.0] floating-point values per
+        // pixel, left to right and top to bottom.
+        int image_width, image_height;
         auto n = bytes_per_pixel; // Dummy out parameter: original components per pixel
-        fdata = stbi_loadf(filename.c_str(), &image_width, &image_height, &n, bytes_per_pixel);
-        if (fdata == nullptr)
+        float *pixels = stbi_loadf(filename.c_str(), &image_width, &image_height, &n, bytes_per_pixel);
+        if (pixels == nullptr)
             return false;
 
-        bytes_per_scanline = image_width * bytes_per_pixel;
-        convert_to_bytes();
+        build_mipmaps(pixels, image_width, image_height);
+        STBI_FREE(pixels);
+
+        save_mip_file(mip_filename, stamp);
         return true;
     }
 
-    int width() const { return (fdata == nullptr) ? 0 : image_width; }
-    int height() const { return (fdata == nullptr) ? 0 : image_height; }
+    int width() const { return mip.empty() ? 0 : mip[0].width; }
+    int height() const { return mip.empty() ? 0 : mip[0].height; }
+    int mip_levels() const { return int(mip.size()); }
+
+    bool memory_mapped() const { return mapping.data() != nullptr; }
 
-    const unsigned char *pixel_data(int x, int y) const
+    color sample(double u, double v, double lod, texture_filter filter) const
     {
-        // Return the address of the three RGB bytes of the pixel at x,y. If there is no image
-        // data, returns magenta.
-        static unsigned char magenta[] = {255, 0, 255};
-        if (bdata == nullptr)
-            return magenta;
+        // Looks up the image at image coordinates u,v in [0,1] (v pointing down), at the given
+        // level of detail: 0 is the full resolution image, every step up halves it. Coordinates
+        // outside the image are clamped to its edge. With no image data, returns magenta.
 
-        x = clamp(x, 0, image_width);
-        y = clamp(y, 0, image_height);
+        if (mip.empty())
+            return color(1, 0, 1);
 
-        return bdata + y * bytes_per_scanline + x * bytes_per_pixel;
+        switch (filter)
+        {
+        case texture_filter::nearest:
+        {
+            const mip_level &level = mip[0];
+            return texel(level, clamp(int(u * level.width), 0, level.width),
+                         clamp(int(v * level.height), 0, level.height));
+        }
+        case texture_filter::bilinear:
+            return bilinear(mip[0], u, v);
+        default:
+        {
+            lod = std::fmin(std::fmax(lod, 0.0), double(mip.size() - 1));
+            auto l0 = int(lod);
+            auto t = lod - l0;
+            if (t == 0)
+                return bilinear(mip[l0], u, v);
+            return (1 - t) * bilinear(mip[l0], u, v) + t * bilinear(mip[l0 + 1], u, v);
+        }
+        }
     }
 
 private:
-    const int bytes_per_pixel = 3;
-    float *fdata = nullptr;         // Linear floating point pixel data
-    unsigned char *bdata = nullptr; // Linear 8-bit pixel data
-    int image_width = 0;            // Loaded image width
-    int image_height = 0;           // Loaded image height
-    int bytes_per_scanline = 0;
+    struct mip_level
+    {
+        int width = 0, height = 0;
+        int tiles_x = 0; // Tiles per tile row
+        size_t offset;   // First texel of the level in the texel buffer
+    };
+
+    struct source_stamp // Identifies the version of a source image file
+    {
+        int64_t time = 0;
+        uint64_t size = 0;
+    };
+
+    // Mip file layout: the header, one mip_file_level per level, then the texels of all levels
+    // (as built by build_mipmaps()) starting at data_offset. Numbers are in native byte order;
+    // the byte order mark rejects files written on a machine with a different one.
+    struct mip_file_header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order; // mip_file_byte_order as written
+        uint32_t storage;
+        uint32_t levels;
+        int64_t source_time;
+        uint64_t source_size;
+        uint64_t data_offset;
+        uint64_t data_size;
+    };
+
+    struct mip_file_level
+    {
+        uint32_t width, height, tiles_x, reserved;
+        uint64_t offset;
+    };
+
+    static constexpr char mip_file_magic[8] = {'R', 'T', 'W', 'M', 'I', 'P', '\0', '\0'};
+    static const uint32_t mip_file_version = 1;
+    static const uint32_t mip_file_byte_order = 0x01020304;
+    static const size_t mip_file_alignment = 64;
+
+    static const int tile_size = 4;
+    static const int bytes_per_pixel = 3;
+
+    texel_storage storage = texel_storage::linear_float;
+    std::vector<mip_level> mip;
+
+    // RGB texels of all levels, either in owned_texels or in the mapped mip file.
+    std::vector<unsigned char> owned_texels;
+    mapped_file mapping;
+    const float *float_texels = nullptr;  // When storing linear floats
+    const uint16_t *half_texels = nullptr; // When storing halves
+
+    size_t texel_bytes() const { return storage == texel_storage::half ? sizeof(uint16_t) : sizeof(float); }
+
+    void set_texels(const unsigned char *data)
+    {
+        float_texels = storage == texel_storage::half ? nullptr : reinterpret_cast<const float *>(data);
+        half_texels = storage == texel_storage::half ? reinterpret_cast<const uint16_t *>(data) : nullptr;
+    }
+
+    void build_mipmaps(const float *pixels, int image_width, int image_height)
+    {
+        // Builds the mip pyramid from the decoded image, down to a single texel, with each level
+        // a 2x2 box filter of the one above. All levels share one buffer, and every level is
+        // stored in 4x4 texel tiles so that a filtered lookup touches at most a few cache lines
+        // instead of two scanlines far apart.
+
+        mip.clear();
+
+        int w = image_width, h = image_height;
+        size_t total = 0;
+        while (true)
+        {
+            mip_level level;
+            level.width = w;
+            level.height = h;
+            level.tiles_x = (w + tile_size - 1) / tile_size;
+            level.offset = total;
+            total += size_t(level.tiles_x) * ((h + tile_size - 1) / tile_size) * tile_size * tile_size;
+            mip.push_back(level);
+
+            if (w == 1 && h == 1)
+                break;
+            w = std::max(1, w / 2);
+            h = std::max(1, h / 2);
+        }
+
+        // Filter in float, then convert the whole pyramid at once if half storage is wanted.
+        std::vector<float> texels(total * 3, 0.0f);
+
+        for (int y = 0; y < image_height; y++)
+            for (int x = 0; x < image_width; x++)
+                std::memcpy(&texels[3 * texel_index(mip[0], x, y)],
+                            pixels + (size_t(y) * image_width + x) * bytes_per_pixel, 3 * sizeof(float));
+
+        for (size_t l = 1; l < mip.size(); l++)
+        {
+            const mip_level &above = mip[l - 1];
+            const mip_level &level = mip[l];
+
+            for (int y = 0; y < level.height; y++)
+            {
+                for (int x = 0; x < level.width; x++)
+                {
+                    // Odd sizes fold their last row or column into the previous texel.
+                    int x0 = std::min(2 * x, above.width - 1), x1 = std::min(2 * x + 1, above.width - 1);
+                    int y0 = std::min(2 * y, above.height - 1), y1 = std::min(2 * y + 1, above.height - 1);
+
+                    float *dst = &texels[3 * texel_index(level, x, y)];
+                    for (int c = 0; c < 3; c++)
+                    {
+                        dst[c] = 0.25f * (texels[3 * texel_index(above, x0, y0) + c] +
+                                          texels[3 * texel_index(above, x1, y0) + c] +
+                                          texels[3 * texel_index(above, x0, y1) + c] +
+                                          texels[3 * texel_index(above, x1, y1) + c]);
+                    }
+                }
+            }
+        }
+
+        owned_texels.resize(texels.size() * texel_bytes());
+        if (storage == texel_storage::half)
+        {
+            auto *half = reinterpret_cast<uint16_t *>(owned_texels.data());
+            for (size_t i = 0; i < texels.size(); i++)
+                half[i] = float_to_half(texels[i]);
+        }
+        else
+            std::memcpy(owned_texels.data(), texels.data(), owned_texels.size());
+
+        set_texels(owned_texels.data());
+    }
+
+    static source_stamp file_stamp(const std::string &filename)
+    {
+        source_stamp stamp;
+        std::error_code ec;
+        auto time = std::filesystem::last_write_time(filename, ec);
+        if (!ec)
+            stamp.time = int64_t(time.time_since_epoch().count());
+        auto size = std::filesystem::file_size(filename, ec);
+        if (!ec)
+            stamp.size = uint64_t(size);
+        return stamp;
+    }
+
+    std::string cache_filename(const std::string &filename) const
+    {
+        // Mip files sit next to their source unless RTW_TEXTURE_CACHE names a directory for
+        // them, in which case the source path is hashed into the name to keep them apart.
+
+        std::string suffix = storage == texel_storage::half ? ".half.mip" : ".mip";
+
+        auto cachedir = getenv("RTW_TEXTURE_CACHE");
+        if (!cachedir)
+            return filename + suffix;
+
+        std::error_code ec;
+        auto absolute = std::filesystem::absolute(filename, ec).string();
+        char hash[17];
+        std::snprintf(hash, sizeof hash, "%016llx",
+                      static_cast<unsigned long long>(std::hash<std::string>()(absolute)));
+
+        auto name = std::filesystem::path(filename).filename().string();
+        return std::string(cachedir) + "/" + name + "." + hash + suffix;
+    }
+
+    bool load_mip_file(const std::string &mip_filename, const source_stamp &stamp)
+    {
+        // Maps a mip file written by save_mip_file(). Returns false, leaving the image empty, if
+        // there is none or it does not match the source image and storage.
+
+        if (!mapping.open(mip_filename))
+            return false;
+
+        const auto *bytes = mapping.data();
+        auto size = mapping.size();
+
+        mip_file_header header;
+        bool valid = size >= sizeof header;
+        if (valid)
+        {
+            std::memcpy(&header, bytes, sizeof header);
+            valid = std::memcmp(header.magic, mip_file_magic, sizeof header.magic) == 0 &&
+                    header.version == mip_file_version && header.byte_order == mip_file_byte_order &&
+                    header.storage == uint32_t(storage) && header.source_time == stamp.time &&
+                    header.source_size == stamp.size && header.levels > 0 &&
+                    sizeof header + header.levels * sizeof(mip_file_level) <= header.data_offset &&
+                    header.data_offset % mip_file_alignment == 0 &&
+                    header.data_offset + header.data_size <= size;
+        }
+
+        for (uint32_t l = 0; valid && l < header.levels; l++)
+        {
+            mip_file_level file_level;
+            std::memcpy(&file_level, bytes + sizeof header + l * sizeof file_level, sizeof file_level);
+
+            mip_level level;
+            level.width = int(file_level.width);
+            level.height = int(file_level.height);
+            level.tiles_x = int(file_level.tiles_x);
+            level.offset = size_t(file_level.offset);
+
+            // The last texel of the level must lie inside the data.
+            auto tiles_y = (level.height + tile_size - 1) / tile_size;
+            auto end = level.offset + size_t(level.tiles_x) * tiles_y * tile_size * tile_size;
+            valid = level.width > 0 && level.height > 0 &&
+                    level.tiles_x == (level.width + tile_size - 1) / tile_size &&
+                    3 * end * texel_bytes() <= header.data_size;
+            mip.push_back(level);
+        }
+
+        if (!valid)
+        {
+            mip.clear();
+            mapping.close();
+            return false;
+        }
+
+        set_texels(bytes + header.data_offset);
+        return true;
+    }
+
+    void save_mip_file(const std::string &mip_filename, const source_stamp &stamp) const
+    {
+        // Writes the pyramid to a mip file for load_mip_file(). Goes through a temporary file,
+        // so that concurrent runs never map a half written one. Failing to write is not an
+        // error: the next run simply decodes the image again.
+
+        mip_file_header header = {};
+        std::memcpy(header.magic, mip_file_magic, sizeof header.magic);
+        header.version = mip_file_version;
+        header.byte_order = mip_file_byte_order;
+        header.storage = uint32_t(storage);
+        header.levels = uint32_t(mip.size());
+        header.source_time = stamp.time;
+        header.source_size = stamp.size;
+        header.data_size = owned_texels.size();
+
+        auto table_end = sizeof header + mip.size() * sizeof(mip_file_level);
+        header.data_offset = (table_end + mip_file_alignment - 1) / mip_file_alignment * mip_file_alignment;
+
+        auto temp_filename = mip_filename + ".tmp";
+        {
+            std::ofstream out(temp_filename, std::ios::binary | std::ios::trunc);
+            if (!out)
+                return;
+
+            out.write(reinterpret_cast<const char *>(&header), sizeof header);
+            for (const auto &level : mip)
+            {
+                mip_file_level file_level = {uint32_t(level.width), uint32_t(level.height),
+                                             uint32_t(level.tiles_x), 0, uint64_t(level.offset)};
+                out.write(reinterpret_cast<const char *>(&file_level), sizeof file_level);
+            }
+
+            std::vector<char> padding(header.data_offset - table_end, 0);
+            out.write(padding.data(), padding.size());
+            out.write(reinterpret_cast<const char *>(owned_texels.data()), owned_texels.size());
+
+            if (!out)
+            {
+                out.close();
+                std::remove(temp_filename.c_str());
+                return;
+            }
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(temp_filename, mip_filename, ec);
+        if (ec)
+            std::remove(temp_filename.c_str());
+    }
 
     static int clamp(int x, int low, int high)
     {
@@ -112,30 +485,93 @@ private:
         return high - 1;
     }
 
-    static unsigned char float_to_byte(float value)
+    static size_t texel_index(const mip_level &level, int x, int y)
+    {
+        // Tiles are stored row by row, and the 16 texels of a tile row by row within it.
+        size_t tile = size_t(y / tile_size) * level.tiles_x + x / tile_size;
+        return level.offset + tile * (tile_size * tile_size) + (y % tile_size) * tile_size + x % tile_size;
+    }
+
+    color texel(const mip_level &level, int x, int y) const
     {
-        if (value <= 0.0)
-            return 0;
-        if (1.0 <= value)
-            return 255;
-        return static_cast<unsigned char>(256.0 * value);
+        auto i = 3 * texel_index(level, x, y);
+        if (half_texels != nullptr)
+            return color(half_to_float(half_texels[i]), half_to_float(half_texels[i + 1]),
+                         half_to_float(half_texels[i + 2]));
+        return color(float_texels[i], float_texels[i + 1], float_texels[i + 2]);
+    }
+
+    color bilinear(const mip_level &level, double u, double v) const
+    {
+        // Blends the four texels whose centers surround u,v.
+        auto x = u * level.width - 0.5;
+        auto y = v * level.height - 0.5;
+        auto fx = std::floor(x), fy = std::floor(y);
+        auto tx = x - fx, ty = y - fy;
+
+        int x0 = clamp(int(fx), 0, level.width), x1 = clamp(int(fx) + 1, 0, level.width);
+        int y0 = clamp(int(fy), 0, level.height), y1 = clamp(int(fy) + 1, 0, level.height);
+
+        return (1 - ty) * ((1 - tx) * texel(level, x0, y0) + tx * texel(level, x1, y0)) +
+               ty * ((1 - tx) * texel(level, x0, y1) + tx * texel(level, x1, y1));
     }
 
-    void convert_to_bytes()
+    static uint16_t float_to_half(float value)
     {
-        // Convert the linear floating point pixel data to bytes, storing the resulting byte
-        // data in the `bdata` member.
+        // Rounds to nearest. Texel values are never NaN, so those are not handled specially.
+        uint32_t f;
+        std::memcpy(&f, &value, sizeof f);
 
-        int total_bytes = image_width * image_height * bytes_per_pixel;
-        bdata = new unsigned char[total_bytes];
+        uint32_t sign = (f >> 16) & 0x8000;
+        int exponent = int((f >> 23) & 0xff) - 127 + 15;
+        uint32_t mantissa = f & 0x7fffff;
 
-        // Iterate through all pixel components, converting from [0.0, 1.0] float values to
-        // unsigned [0, 255] byte values.
+        if (exponent >= 31)
+            return uint16_t(sign | 0x7c00); // Overflow to infinity
+        if (exponent <= 0)
+        {
+            if (exponent < -10)
+                return uint16_t(sign); // Underflow to zero
+            mantissa |= 0x800000;
+            auto shift = uint32_t(14 - exponent);
+            return uint16_t(sign | ((mantissa + (1u << (shift - 1))) >> shift));
+        }
 
-        auto *bptr = bdata;
-        auto *fptr = fdata;
-        for (auto i = 0; i < total_bytes; i++, fptr++, bptr++)
-            *bptr = float_to_byte(*fptr);
+        // A carry out of the mantissa correctly bumps the exponent.
+        return uint16_t((sign | (uint32_t(exponent) << 10) | (mantissa >> 13)) + ((mantissa >> 12) & 1));
+    }
+
+    static float half_to_float(uint16_t value)
+    {
+        uint32_t sign = uint32_t(value & 0x8000) << 16;
+        uint32_t exponent = (value >> 10) & 0x1f;
+        uint32_t mantissa = value & 0x3ff;
+
+        uint32_t f;
+        if (exponent == 0)
+        {
+            if (mantissa == 0)
+                f = sign;
+            else
+            {
+                // Subnormal half: normalize it for the float format.
+                exponent = 127 - 15 + 1;
+                while ((mantissa & 0x400) == 0)
+                {
+                    mantissa <<= 1;
+                    exponent--;
+                }
+                f = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+            }
+        }
+        else if (exponent == 31)
+            f = sign | 0x7f800000 | (mantissa << 13);
+        else
+            f = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+
+        float result;
+        std::memcpy(&result, &f, sizeof result);
+        return result;
     }
 };
 
@@ -144,4 +580,4 @@ private:
 #pragma warning(pop)
 #endif
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,188 @@
+#ifndef SCENE_ARENA_H
+#define SCENE_ARENA_H
+
+#include "hittable.h"
+#include "material.h"
+#include "texture.h"
+
+#include <memory_resource>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+class scene_arena // Owns the primitives, materials and textures of a scene in contiguous pools
+{
+public:
+    // Everything handed out lives in pools that are released all at once when the arena is
+    // destroyed, so the arena must outlive the scene (and any render of it). Constant textures
+    // and materials with identical parameters are created only once.
+
+    scene_arena() {}
+    scene_arena(const scene_arena &) = delete;
+    scene_arena &operator=(const scene_arena &) = delete;
+
+    template <typename T, typename... Args>
+    shared_ptr<T> make(Args &&...args)
+    {
+        // Allocates a primitive (or any other hittable) in the primitive pool.
+        static_assert(std::is_base_of<hittable, T>::value, "make<T>() is for hittables");
+        return allocate<T>(primitives, std::forward<Args>(args)...);
+    }
+
+    shared_ptr<texture> solid(const color &albedo)
+    {
+        // Returns the interned constant texture of the given color.
+        std::string key;
+        append_key(key, albedo);
+
+        auto found = solid_colors.find(key);
+        if (found != solid_colors.end())
+        {
+            textures.interned++;
+            return found->second;
+        }
+
+        shared_ptr<texture> tex = allocate<solid_color>(textures, albedo);
+        solid_colors.emplace(key, tex);
+        texture_table.push_back(tex);
+        return tex;
+    }
+
+    template <typename T, typename... Args>
+    shared_ptr<texture> tex(const Args &...args)
+    {
+        // Allocates a texture in the texture pool. Color arguments become interned constant
+        // textures where T accepts a texture in their place.
+        static_assert(std::is_base_of<texture, T>::value, "tex<T>() is for textures");
+
+        shared_ptr<texture> result;
+        if constexpr (has_color<Args...> && std::is_constructible<T, texture_arg_t<Args>...>::value)
+            result = allocate<T>(textures, as_texture_arg(args)...);
+        else
+            result = allocate<T>(textures, args...);
+
+        texture_table.push_back(result);
+        return result;
+    }
+
+    template <typename M, typename... Args>
+    shared_ptr<material> mat(const Args &...args)
+    {
+        // Returns the material of type M built from args, creating it only if no identical
+        // one exists yet. Color arguments become interned constant textures where M accepts a
+        // texture in their place, so equal colors share one texture across material types.
+        static_assert(std::is_base_of<material, M>::value, "mat<M>() is for materials");
+
+        if constexpr (has_color<Args...> && std::is_constructible<M, texture_arg_t<Args>...>::value)
+        {
+            return mat<M>(as_texture_arg(args)...);
+        }
+        else
+        {
+            std::string key = typeid(M).name();
+            (append_key(key, args), ...);
+
+            auto found = interned_materials.find(key);
+            if (found != interned_materials.end())
+            {
+                materials.interned++;
+                return found->second;
+            }
+
+            shared_ptr<material> result = allocate<M>(materials, args...);
+            interned_materials.emplace(key, result);
+            return result;
+        }
+    }
+
+    void print_summary(std::ostream &out = std::clog) const
+    {
+        // Memory held by each pool, counting the shared pointer control blocks stored inline.
+        out << "Scene memory:\n";
+        print_pool(out, "primitives", primitives);
+        print_pool(out, "materials", materials);
+        print_pool(out, "textures", textures);
+    }
+
+private:
+    class counting_pool : public std::pmr::memory_resource
+    {
+    public:
+        size_t objects = 0;  // Allocations made from the pool
+        size_t bytes = 0;    // Bytes requested from the pool
+        size_t interned = 0; // Requests answered with an existing object
+
+    private:
+        std::pmr::monotonic_buffer_resource upstream;
+
+        void *do_allocate(size_t size, size_t alignment) override
+        {
+            objects++;
+            bytes += size;
+            return upstream.allocate(size, alignment);
+        }
+
+        void do_deallocate(void *p, size_t size, size_t alignment) override
+        {
+            // Monotonic: memory goes back only when the arena is destroyed.
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+        {
+            return this == &other;
+        }
+    };
+
+    template <typename... Args>
+    static constexpr bool has_color = (std::is_same<typename std::decay<Args>::type, color>::value || ...);
+
+    template <typename A>
+    using texture_arg_t = typename std::conditional<std::is_same<typename std::decay<A>::type, color>::value,
+                                                    shared_ptr<texture>, const A &>::type;
+
+    // Pools are declared first so that they are destroyed last.
+    counting_pool primitives, materials, textures;
+
+    std::unordered_map<std::string, shared_ptr<texture>> solid_colors;
+    std::unordered_map<std::string, shared_ptr<material>> interned_materials;
+    std::vector<shared_ptr<texture>> texture_table; // Every texture, so none is freed before the arena
+
+    template <typename T, typename... Args>
+    static shared_ptr<T> allocate(counting_pool &pool, Args &&...args)
+    {
+        return std::allocate_shared<T>(std::pmr::polymorphic_allocator<T>(&pool), std::forward<Args>(args)...);
+    }
+
+    shared_ptr<texture> as_texture_arg(const color &c) { return solid(c); }
+
+    template <typename A>
+    const A &as_texture_arg(const A &a) { return a; }
+
+    static void append_key(std::string &key, double x) { key.append(reinterpret_cast<const char *>(&x), sizeof x); }
+    static void append_key(std::string &key, int x) { append_key(key, double(x)); }
+    static void append_key(std::string &key, const char *s) { key.append(s).push_back('\0'); }
+    static void append_key(std::string &key, const vec3 &v)
+    {
+        for (int i = 0; i < 3; i++)
+            append_key(key, v[i]);
+    }
+
+    template <typename T>
+    static void append_key(std::string &key, const shared_ptr<T> &p)
+    {
+        auto address = reinterpret_cast<uintptr_t>(p.get());
+        key.append(reinterpret_cast<const char *>(&address), sizeof address);
+    }
+
+    static void print_pool(std::ostream &out, const char *name, const counting_pool &pool)
+    {
+        out << "  " << name << ": " << pool.objects << " objects, " << pool.bytes << " bytes";
+        if (pool.interned > 0)
+            out << " (" << pool.interned << " duplicates interned)";
+        out << '\n';
+    }
+};
+
+#endif
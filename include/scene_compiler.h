@@ -0,0 +1,115 @@
+#ifndef SCENE_COMPILER_H
+#define SCENE_COMPILER_H
+
+#include "bvh.h"
+#include "constant_medium.h"
+#include "flat_bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "trace.h"
+
+#include <string>
+
+class scene_compiler
+{
+public:
+    bool verbose = true;        // Print a statistics line for every compiled scene
+    bool typed_leaves = true;   // Build a flat_bvh with typed leaves rather than a bvh_node tree
+    std::string cache_filename; // With typed leaves, file the BVH is kept in between runs, empty for none
+
+    shared_ptr<hittable> compile(const hittable &world,
+                                 std::vector<shared_ptr<const constant_medium>> *media = nullptr) const
+    {
+        // Flattens nested lists, BVH nodes and transform wrappers of the given scene into one
+        // list of primitives, then builds a single BVH over all of them. Static transforms are
+        // baked into the primitives where that is exact; the rest stay instanced. The returned
+        // root shares ownership of the primitives but not of `world` itself, so the scene must
+        // outlive the compiled result.
+        //
+        // Given `media`, homogeneous media are taken out of the BVH and appended there instead,
+        // for integrators that track which media a path is in.
+
+        RT_TRACE_ZONE("compile scene");
+
+        // A non-owning pointer for the root, so it can go through the same flatten() hook.
+        shared_ptr<hittable> root(shared_ptr<hittable>(), const_cast<hittable *>(&world));
+
+        auto world_list = dynamic_cast<const hittable_list *>(&world);
+        size_t top_level = world_list ? world_list->objects.size() : 1;
+
+        std::vector<shared_ptr<hittable>> primitives;
+        auto dissolved = world.flatten(root, primitives);
+        if (world_list)
+            dissolved--; // The root list is not a nested node
+
+        if (media)
+        {
+            size_t kept = 0;
+            for (auto &primitive : primitives)
+            {
+                if (typeid(*primitive) == typeid(constant_medium))
+                    media->push_back(std::static_pointer_cast<const constant_medium>(primitive));
+                else
+                    primitives[kept++] = primitive;
+            }
+            primitives.resize(kept);
+        }
+
+        size_t instances = 0;
+        for (const auto &primitive : primitives)
+        {
+            if (dynamic_cast<const translate *>(primitive.get()) ||
+                dynamic_cast<const rotate *>(primitive.get()) ||
+                dynamic_cast<const scale *>(primitive.get()))
+                instances++;
+        }
+
+        shared_ptr<hittable> compiled;
+        size_t bvh_nodes = 0;
+        shared_ptr<flat_bvh> flat;
+
+        if (primitives.empty())
+            compiled = make_shared<hittable_list>();
+        else if (typed_leaves)
+        {
+            flat = make_shared<flat_bvh>(primitives, cache_filename);
+            bvh_nodes = flat->node_count();
+            compiled = flat;
+        }
+        else if (primitives.size() == 1)
+            compiled = primitives[0];
+        else
+        {
+            RT_TRACE_ZONE("build bvh_node");
+            auto bvh = make_shared<bvh_node>(primitives, 0, primitives.size());
+            bvh_nodes = bvh->node_count();
+            compiled = bvh;
+        }
+
+        if (verbose)
+        {
+            std::clog << "Scene: " << top_level << " top-level objects, " << dissolved
+                      << " nested nodes -> " << primitives.size() << " primitives ("
+                      << instances << " instanced), " << bvh_nodes << " BVH nodes";
+            if (flat && !cache_filename.empty())
+                std::clog << (flat->loaded_from_cache() ? " (cached)" : " (built)");
+            if (media)
+                std::clog << ", " << media->size() << " tracked media";
+            std::clog << "\n";
+            if (flat)
+            {
+                std::clog << "Leaves: " << flat->primitive_count(flat_bvh::sphere_type) << " spheres, "
+                          << flat->primitive_count(flat_bvh::rotated_sphere_type) << " rotated spheres, "
+                          << flat->primitive_count(flat_bvh::quad_type) << " quads, "
+                          << flat->primitive_count(flat_bvh::triangle_type) << " triangles, "
+                          << flat->primitive_count(flat_bvh::box_type) << " boxes, "
+                          << flat->primitive_count(flat_bvh::oriented_box_type) << " oriented boxes, "
+                          << flat->primitive_count(flat_bvh::other_type) << " virtual\n";
+            }
+        }
+
+        return compiled;
+    }
+};
+
+#endif
@@ -0,0 +1,816 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "aligned_box.h"
+#include "baked_texture.h"
+#include "bvh.h"
+#include "camera.h"
+#include "constant_medium.h"
+#include "heterogeneous_medium.h"
+#include "hittable_list.h"
+#include "json.h"
+#include "mapped_file.h"
+#include "quad.h"
+#include "scene_arena.h"
+#include "sphere.h"
+#include "trace.h"
+
+#include <cstdlib>
+#include <filesystem>
+#include <initializer_list>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Scene files are JSON documents with these top-level members, all optional:
+//
+//   "include":   file name, or array of them, relative to this file. Included files are loaded
+//                first, so their textures and materials can be used here.
+//   "camera":    camera settings, named as the camera members ("image_width", "lookfrom",
+//                "bvh_cache", ...), plus "fog": {"density", "albedo", "center", "radius"}.
+//   "textures":  named textures, {"name": texture, ...}.
+//   "materials": named materials, {"name": material, ...}.
+//   "objects":   array of objects added to the world.
+//
+// Wherever a texture goes, a name, an [r, g, b] color or an inline {"type": ...} description
+// will do; materials likewise take a name or an inline description. Every object accepts
+// "scale" (a number or a vector), "rotate" (Euler angles in degrees) and "translate", applied
+// in that order. A "comment" member is ignored anywhere; any other unknown member is an error.
+
+class scene_file // A scene and the camera to render it with, loaded from a JSON description
+{
+    // Declared first so that it is destroyed last, after everything holding its objects.
+    scene_arena arena;
+
+public:
+    camera cam;
+    hittable_list world;
+
+    scene_file() {}
+    scene_file(const scene_file &) = delete;
+    scene_file &operator=(const scene_file &) = delete;
+
+    bool load(const std::string &filename)
+    {
+        // Adds the scene in the given file to whatever is loaded already. Problems are reported
+        // on std::cerr as "file:line:column: message"; after a failure the scene is incomplete
+        // and should not be rendered.
+        return load_file(filename);
+    }
+
+    void print_summary() const { arena.print_summary(); }
+
+    static std::string find(const std::string &name)
+    {
+        // Returns the path of a scene given by file name or by the name of one in scenes/, or
+        // an empty string if there is no such scene. Like images, scenes are looked for in the
+        // RTW_SCENES directory if that is set, then as given, then in the scenes/
+        // subdirectory of the current directory and of its parents, for six levels up.
+        std::vector<std::string> names = {name};
+        if (std::filesystem::path(name).extension() != ".json")
+            names.push_back(name + ".json");
+
+        std::vector<std::string> candidates;
+        auto scenedir = getenv("RTW_SCENES");
+        for (const auto &file : names)
+        {
+            if (scenedir)
+                candidates.push_back(std::string(scenedir) + "/" + file);
+            candidates.push_back(file);
+
+            std::string prefix = "scenes/";
+            for (int level = 0; level <= 6; level++, prefix = "../" + prefix)
+                candidates.push_back(prefix + file);
+        }
+
+        std::error_code ec;
+        for (const auto &candidate : candidates)
+        {
+            if (std::filesystem::is_regular_file(candidate, ec))
+                return candidate;
+        }
+        return "";
+    }
+
+    static std::string directory()
+    {
+        // The scenes directory find() looks in by name: RTW_SCENES if set, otherwise the first
+        // scenes/ found in the current directory and its parents. Empty if there is none.
+        if (auto scenedir = getenv("RTW_SCENES"))
+            return scenedir;
+
+        std::error_code ec;
+        std::string prefix = "scenes";
+        for (int level = 0; level <= 6; level++, prefix = "../" + prefix)
+        {
+            if (std::filesystem::is_directory(prefix, ec))
+                return prefix;
+        }
+        return "";
+    }
+
+private:
+    std::unordered_map<std::string, shared_ptr<texture>> textures;
+    std::unordered_map<std::string, shared_ptr<material>> materials;
+    std::vector<std::string> open_files; // The chain of includes being loaded, to catch cycles
+    std::string current_file;            // File the values being loaded came from
+
+    bool load_file(const std::string &filename)
+    {
+        RT_TRACE_ZONE("load scene file", filename);
+        std::error_code ec;
+        auto canonical = std::filesystem::weakly_canonical(filename, ec).string();
+        for (const auto &open : open_files)
+        {
+            if (open == canonical)
+            {
+                std::cerr << "ERROR: Scene file '" << filename << "' includes itself, directly or through other files.\n";
+                return false;
+            }
+        }
+
+        json_value root;
+        {
+            mapped_file file;
+            if (!file.open(filename))
+            {
+                std::cerr << "ERROR: Could not read scene file '" << filename << "'.\n";
+                return false;
+            }
+
+            RT_TRACE_ZONE("parse JSON", filename);
+            std::string error;
+            if (!json_parser().parse(reinterpret_cast<const char *>(file.data()), file.size(), root, error))
+            {
+                std::cerr << "ERROR: " << filename << ":" << error << "\n";
+                return false;
+            }
+        }
+
+        auto outer_file = current_file;
+        current_file = filename;
+        open_files.push_back(canonical);
+
+        bool ok = load_root(root, std::filesystem::path(filename).parent_path());
+
+        open_files.pop_back();
+        current_file = outer_file;
+        return ok;
+    }
+
+    bool load_root(const json_value &root, const std::filesystem::path &directory)
+    {
+        if (!root.is_object())
+            return fail(root, "a scene file must contain an object");
+        if (!check_members(root, "the scene", {"include", "camera", "textures", "materials", "objects"}))
+            return false;
+
+        if (auto includes = root.find("include"))
+        {
+            std::vector<const json_value *> names;
+            if (includes->is_array())
+                for (const auto &item : includes->items)
+                    names.push_back(&item);
+            else
+                names.push_back(includes);
+
+            for (auto name : names)
+            {
+                if (!name->is_string())
+                    return fail(*name, "expected the name of a scene file to include");
+                if (!load_file((directory / name->string).string()))
+                    return fail(*name, "included from here");
+            }
+        }
+
+        if (auto settings = root.find("camera"))
+        {
+            if (!load_camera(*settings))
+                return false;
+        }
+
+        if (auto definitions = root.find("textures"))
+        {
+            if (!definitions->is_object())
+                return fail(*definitions, "expected an object of named textures");
+            for (const auto &definition : definitions->members)
+            {
+                if (definition.first == "comment")
+                    continue;
+                if (textures.count(definition.first))
+                    return fail(definition.second, "texture \"" + definition.first + "\" is already defined");
+                shared_ptr<texture> tex;
+                if (!load_texture(definition.second, tex))
+                    return false;
+                textures.emplace(definition.first, tex);
+            }
+        }
+
+        if (auto definitions = root.find("materials"))
+        {
+            if (!definitions->is_object())
+                return fail(*definitions, "expected an object of named materials");
+            for (const auto &definition : definitions->members)
+            {
+                if (definition.first == "comment")
+                    continue;
+                if (materials.count(definition.first))
+                    return fail(definition.second, "material \"" + definition.first + "\" is already defined");
+                shared_ptr<material> mat;
+                if (!load_material(definition.second, mat))
+                    return false;
+                materials.emplace(definition.first, mat);
+            }
+        }
+
+        if (auto objects = root.find("objects"))
+        {
+            if (!objects->is_array())
+                return fail(*objects, "expected an array of objects");
+            for (const auto &spec : objects->items)
+            {
+                shared_ptr<hittable> object;
+                if (!load_object(spec, object))
+                    return false;
+                world.add(object);
+            }
+        }
+
+        return true;
+    }
+
+    bool load_camera(const json_value &spec)
+    {
+        if (!spec.is_object())
+            return fail(spec, "expected an object of camera settings");
+        if (!check_members(spec, "the camera",
+                           {"aspect_ratio", "image_width", "samples_per_pixel", "max_depth", "background", "vfov",
+                            "lookfrom", "lookat", "vup", "defocus_angle", "focus_dist", "fog", "accelerate", "typed_leaves",
+                            "track_media", "bvh_cache", "seed"}))
+            return false;
+
+        // Limits as for the command line options.
+        bool ok = read_number(spec, "aspect_ratio", cam.aspect_ratio, false) &&
+                  read_int(spec, "image_width", cam.image_width, false, 1) &&
+                  read_int(spec, "samples_per_pixel", cam.samples_per_pixel, false, 1) &&
+                  read_int(spec, "max_depth", cam.max_depth, false, 1) &&
+                  read_vec3(spec, "background", cam.background, false) &&
+                  read_number(spec, "vfov", cam.vfov, false) &&
+                  read_vec3(spec, "lookfrom", cam.lookfrom, false) &&
+                  read_vec3(spec, "lookat", cam.lookat, false) &&
+                  read_vec3(spec, "vup", cam.vup, false) &&
+                  read_number(spec, "defocus_angle", cam.defocus_angle, false) &&
+                  read_number(spec, "focus_dist", cam.focus_dist, false) &&
+                  read_bool(spec, "accelerate", cam.accelerate, false) &&
+                  read_bool(spec, "typed_leaves", cam.typed_leaves, false) &&
+                  read_bool(spec, "track_media", cam.track_media, false) &&
+                  read_seed(spec, "seed", cam.seed);
+        if (!ok)
+            return false;
+
+        // The BVH cache file is named relative to the scene file, like includes.
+        std::string bvh_cache;
+        if (!read_string(spec, "bvh_cache", bvh_cache, false))
+            return false;
+        if (!bvh_cache.empty())
+            cam.bvh_cache = (std::filesystem::path(current_file).parent_path() / bvh_cache).string();
+
+        if (auto fog = spec.find("fog"))
+        {
+            if (!fog->is_object())
+                return fail(*fog, "expected an object of fog settings");
+            return check_members(*fog, "the fog", {"density", "albedo", "center", "radius"}) &&
+                   read_number(*fog, "density", cam.fog_density) &&
+                   read_vec3(*fog, "albedo", cam.fog_albedo, false) &&
+                   read_vec3(*fog, "center", cam.fog_center, false) &&
+                   read_number(*fog, "radius", cam.fog_radius, false);
+        }
+        return true;
+    }
+
+    bool load_texture(const json_value &spec, shared_ptr<texture> &out)
+    {
+        if (spec.is_string())
+        {
+            auto found = textures.find(spec.string);
+            if (found == textures.end())
+                return fail(spec, "unknown texture \"" + spec.string + "\"");
+            out = found->second;
+            return true;
+        }
+
+        if (spec.is_array())
+        {
+            vec3 albedo;
+            if (!to_vec3(spec, albedo))
+                return false;
+            out = arena.solid(albedo);
+            return true;
+        }
+
+        std::string type;
+        if (!read_type(spec, "texture", type))
+            return false;
+
+        if (type == "solid")
+        {
+            color albedo;
+            if (!check_members(spec, "a solid texture", {"color"}) || !read_vec3(spec, "color", albedo))
+                return false;
+            out = arena.solid(albedo);
+        }
+        else if (type == "checker")
+        {
+            double scale;
+            shared_ptr<texture> even, odd;
+            if (!check_members(spec, "a checker texture", {"scale", "even", "odd"}) ||
+                !read_number(spec, "scale", scale) || !read_texture(spec, "even", even) ||
+                !read_texture(spec, "odd", odd))
+                return false;
+            out = arena.tex<checker_texture>(scale, even, odd);
+        }
+        else if (type == "image")
+        {
+            std::string file;
+            if (!check_members(spec, "an image texture", {"file"}) || !read_string(spec, "file", file))
+                return false;
+            out = arena.tex<image_texture>(file.c_str());
+        }
+        else if (type == "noise")
+        {
+            double scale;
+            if (!check_members(spec, "a noise texture", {"scale"}) || !read_number(spec, "scale", scale))
+                return false;
+            out = arena.tex<noise_texture>(scale);
+        }
+        else if (type == "baked")
+        {
+            // A volume bake of another texture, see baked_texture.
+            shared_ptr<texture> source;
+            point3 min, max;
+            int resolution;
+            std::string cache;
+            if (!check_members(spec, "a baked texture", {"source", "min", "max", "resolution", "cache"}) ||
+                !read_texture(spec, "source", source) || !read_vec3(spec, "min", min) ||
+                !read_vec3(spec, "max", max) || !read_int(spec, "resolution", resolution) ||
+                !read_string(spec, "cache", cache, false))
+                return false;
+            out = arena.tex<baked_texture>(source, aabb(min, max), resolution, cache);
+        }
+        else
+            return fail(*spec.find("type"), "unknown texture type \"" + type + "\"");
+
+        return true;
+    }
+
+    bool load_material(const json_value &spec, shared_ptr<material> &out)
+    {
+        if (spec.is_string())
+        {
+            auto found = materials.find(spec.string);
+            if (found == materials.end())
+                return fail(spec, "unknown material \"" + spec.string + "\"");
+            out = found->second;
+            return true;
+        }
+
+        std::string type;
+        if (!read_type(spec, "material", type))
+            return false;
+
+        shared_ptr<texture> tex;
+        if (type == "lambertian")
+        {
+            if (!check_members(spec, "a lambertian material", {"albedo"}) || !read_texture(spec, "albedo", tex))
+                return false;
+            out = arena.mat<lambertian>(tex);
+        }
+        else if (type == "metal")
+        {
+            double fuzz = 0;
+            if (!check_members(spec, "a metal material", {"albedo", "fuzz"}) || !read_texture(spec, "albedo", tex) ||
+                !read_number(spec, "fuzz", fuzz, false))
+                return false;
+            out = arena.mat<metal>(tex, fuzz);
+        }
+        else if (type == "dielectric")
+        {
+            double refraction_index;
+            if (!check_members(spec, "a dielectric material", {"refraction_index"}) ||
+                !read_number(spec, "refraction_index", refraction_index))
+                return false;
+            out = arena.mat<dielectric>(refraction_index);
+        }
+        else if (type == "diffuse_light")
+        {
+            if (!check_members(spec, "a diffuse_light material", {"emit"}) || !read_texture(spec, "emit", tex))
+                return false;
+            out = arena.mat<diffuse_light>(tex);
+        }
+        else if (type == "isotropic")
+        {
+            if (!check_members(spec, "an isotropic material", {"albedo"}) || !read_texture(spec, "albedo", tex))
+                return false;
+            out = arena.mat<isotropic>(tex);
+        }
+        else
+            return fail(*spec.find("type"), "unknown material type \"" + type + "\"");
+
+        return true;
+    }
+
+    bool load_object(const json_value &spec, shared_ptr<hittable> &out)
+    {
+        std::string type;
+        if (!read_type(spec, "object", type))
+            return false;
+
+        shared_ptr<material> mat;
+        if (type == "sphere")
+        {
+            point3 center, center2;
+            double radius;
+            if (!check_object_members(spec, "a sphere", {"center", "center2", "radius", "material"}) ||
+                !read_vec3(spec, "center", center) || !read_number(spec, "radius", radius) ||
+                !read_material(spec, "material", mat))
+                return false;
+
+            // "center2" makes a sphere moving from center at time 0 to center2 at time 1.
+            center2 = center;
+            if (!read_vec3(spec, "center2", center2, false))
+                return false;
+            out = arena.make<sphere>(center, center2, radius, mat);
+        }
+        else if (type == "quad" || type == "triangle")
+        {
+            point3 Q;
+            vec3 u, v;
+            if (!check_object_members(spec, type == "quad" ? "a quad" : "a triangle", {"Q", "u", "v", "material"}) ||
+                !read_vec3(spec, "Q", Q) || !read_vec3(spec, "u", u) || !read_vec3(spec, "v", v) ||
+                !read_material(spec, "material", mat))
+                return false;
+            if (type == "quad")
+                out = arena.make<quad>(Q, u, v, mat);
+            else
+                out = arena.make<triangle>(Q, u, v, mat);
+        }
+        else if (type == "box")
+        {
+            point3 a, b;
+            if (!check_object_members(spec, "a box", {"min", "max", "material"}) || !read_vec3(spec, "min", a) ||
+                !read_vec3(spec, "max", b) || !read_material(spec, "material", mat))
+                return false;
+            out = arena.make<aligned_box>(a, b, mat);
+        }
+        else if (type == "tetrahedron")
+        {
+            point3 a, b, c, d;
+            if (!check_object_members(spec, "a tetrahedron", {"a", "b", "c", "d", "material"}) ||
+                !read_vec3(spec, "a", a) || !read_vec3(spec, "b", b) || !read_vec3(spec, "c", c) ||
+                !read_vec3(spec, "d", d) || !read_material(spec, "material", mat))
+                return false;
+            out = tetrahedron(a, b, c, d, mat);
+        }
+        else if (type == "group")
+        {
+            // A list of objects that transforms apply to as a whole, optionally with a BVH
+            // of its own.
+            bool bvh = false;
+            if (!check_object_members(spec, "a group", {"objects", "bvh"}) || !read_bool(spec, "bvh", bvh, false))
+                return false;
+
+            auto objects = spec.find("objects");
+            if (!objects || !objects->is_array())
+                return fail(objects ? *objects : spec, "expected an array of objects in \"objects\"");
+
+            hittable_list group;
+            for (const auto &item : objects->items)
+            {
+                shared_ptr<hittable> object;
+                if (!load_object(item, object))
+                    return false;
+                group.add(object);
+            }
+
+            if (group.objects.empty())
+                out = arena.make<hittable_list>();
+            else if (bvh)
+            {
+                RT_TRACE_ZONE("build bvh_node", current_file);
+                out = arena.make<bvh_node>(group);
+            }
+            else
+                out = arena.make<hittable_list>(group);
+        }
+        else if (type == "constant_medium")
+        {
+            shared_ptr<hittable> boundary;
+            double density;
+            if (!check_object_members(spec, "a constant medium", {"boundary", "density", "albedo", "material"}) ||
+                !read_object(spec, "boundary", boundary) || !read_number(spec, "density", density) ||
+                !read_phase_function(spec, mat))
+                return false;
+            out = arena.make<constant_medium>(boundary, density, mat);
+        }
+        else if (type == "heterogeneous_medium")
+        {
+            shared_ptr<hittable> boundary;
+            shared_ptr<density_field> density;
+            int majorant_resolution = 16;
+            if (!check_object_members(spec, "a heterogeneous medium",
+                                      {"boundary", "density", "albedo", "material", "majorant_resolution"}) ||
+                !read_object(spec, "boundary", boundary) || !read_density(spec, "density", density) ||
+                !read_phase_function(spec, mat) || !read_int(spec, "majorant_resolution", majorant_resolution, false))
+                return false;
+            out = arena.make<heterogeneous_medium>(boundary, density, mat, majorant_resolution);
+        }
+        else
+            return fail(*spec.find("type"), "unknown object type \"" + type + "\"");
+
+        return apply_transforms(spec, out);
+    }
+
+    bool apply_transforms(const json_value &spec, shared_ptr<hittable> &object)
+    {
+        // Scaling, then rotation, then translation, as in the transform class.
+        if (auto factors = spec.find("scale"))
+        {
+            vec3 s;
+            if (factors->is_number())
+                s = vec3(factors->number, factors->number, factors->number);
+            else if (!to_vec3(*factors, s))
+                return false;
+            object = arena.make<scale>(object, s);
+        }
+
+        vec3 v;
+        if (spec.find("rotate"))
+        {
+            if (!read_vec3(spec, "rotate", v))
+                return false;
+            object = arena.make<rotate>(object, v);
+        }
+        if (spec.find("translate"))
+        {
+            if (!read_vec3(spec, "translate", v))
+                return false;
+            object = arena.make<translate>(object, v);
+        }
+        return true;
+    }
+
+    bool load_density(const json_value &spec, shared_ptr<density_field> &out)
+    {
+        std::string type;
+        if (!read_type(spec, "density", type))
+            return false;
+
+        if (type == "grid")
+        {
+            // Voxel values, x fastest, over the box from min to max.
+            point3 min, max;
+            vec3 resolution;
+            if (!check_members(spec, "a density grid", {"min", "max", "resolution", "values"}) ||
+                !read_vec3(spec, "min", min) || !read_vec3(spec, "max", max) ||
+                !read_vec3(spec, "resolution", resolution))
+                return false;
+
+            int nx = int(resolution.x()), ny = int(resolution.y()), nz = int(resolution.z());
+            auto values = spec.find("values");
+            if (!values || !values->is_array())
+                return fail(values ? *values : spec, "expected an array of densities in \"values\"");
+            if (nx < 1 || ny < 1 || nz < 1 || values->items.size() != size_t(nx) * ny * nz)
+                return fail(*values, "expected " + std::to_string(std::max(nx, 0) * std::max(ny, 0) * std::max(nz, 0)) +
+                                         " densities, one per voxel");
+
+            std::vector<float> densities;
+            densities.reserve(values->items.size());
+            for (const auto &item : values->items)
+            {
+                if (!item.is_number())
+                    return fail(item, "expected a number");
+                densities.push_back(float(item.number));
+            }
+            out = make_shared<density_grid>(aabb(min, max), nx, ny, nz, std::move(densities));
+        }
+        else if (type == "texture")
+        {
+            shared_ptr<texture> tex;
+            double density_scale, max_value = 1;
+            if (!check_members(spec, "a texture density", {"texture", "scale", "max_value"}) ||
+                !read_texture(spec, "texture", tex) || !read_number(spec, "scale", density_scale) ||
+                !read_number(spec, "max_value", max_value, false))
+                return false;
+            out = make_shared<texture_density>(tex, density_scale, max_value);
+        }
+        else if (type == "cloud")
+        {
+            // Turbulence in a ball, fading out towards its edge, voxelized over the ball's
+            // bounding box.
+            point3 center;
+            double radius, noise_scale, density_scale;
+            int resolution, octaves = 5;
+            if (!check_members(spec, "a cloud density", {"center", "radius", "resolution", "noise_scale", "octaves", "scale"}) ||
+                !read_vec3(spec, "center", center) || !read_number(spec, "radius", radius) ||
+                !read_int(spec, "resolution", resolution) || !read_number(spec, "noise_scale", noise_scale) ||
+                !read_int(spec, "octaves", octaves, false) || !read_number(spec, "scale", density_scale))
+                return false;
+            if (resolution < 1)
+                return fail(*spec.find("resolution"), "the resolution must be at least 1");
+            out = cloud(center, radius, resolution, noise_scale, octaves, density_scale);
+        }
+        else
+            return fail(*spec.find("type"), "unknown density type \"" + type + "\"");
+
+        return true;
+    }
+
+    static shared_ptr<density_field> cloud(const point3 &center, double radius, int n, double noise_scale, int octaves,
+                                           double density_scale)
+    {
+        const vec3 extent(radius, radius, radius);
+        const point3 lo = center - extent;
+
+        perlin noise;
+        std::vector<float> densities(size_t(n) * n * n);
+        for (int z = 0; z < n; z++)
+            for (int y = 0; y < n; y++)
+                for (int x = 0; x < n; x++)
+                {
+                    auto p = lo + (2 * radius / n) * vec3(x + 0.5, y + 0.5, z + 0.5);
+                    auto falloff = 1 - (p - center).length() / radius;
+                    auto value = 1.5 * falloff + noise.turb(noise_scale * p, octaves) - 0.5;
+                    densities[(size_t(z) * n + y) * n + x] = float(density_scale * std::fmax(0.0, value));
+                }
+
+        return make_shared<density_grid>(aabb(lo, center + extent), n, n, n, std::move(densities));
+    }
+
+    // Member readers. Each returns false after reporting the problem; a missing optional
+    // member leaves `out` as it was.
+
+    bool fail(const json_value &at, const std::string &message) const
+    {
+        std::cerr << "ERROR: " << current_file << ":" << at.line << ":" << at.column << ": " << message << "\n";
+        return false;
+    }
+
+    bool check_members(const json_value &spec, const char *what, std::initializer_list<const char *> allowed,
+                       std::initializer_list<const char *> also_allowed = {"type"}) const
+    {
+        // Unknown members are nearly always typos, which would otherwise be silently ignored.
+        for (const auto &member : spec.members)
+        {
+            bool known = member.first == "comment";
+            for (auto name : allowed)
+                known = known || member.first == name;
+            for (auto name : also_allowed)
+                known = known || member.first == name;
+            if (!known)
+                return fail(member.second, "unknown member \"" + member.first + "\" in " + what);
+        }
+        return true;
+    }
+
+    bool check_object_members(const json_value &spec, const char *what, std::initializer_list<const char *> allowed) const
+    {
+        return check_members(spec, what, allowed, {"type", "scale", "rotate", "translate"});
+    }
+
+    const json_value *member(const json_value &spec, const char *key, bool required) const
+    {
+        auto found = spec.find(key);
+        if (!found && required)
+            fail(spec, std::string("missing member \"") + key + "\"");
+        return found;
+    }
+
+    bool read_type(const json_value &spec, const char *what, std::string &type) const
+    {
+        if (!spec.is_object())
+            return fail(spec, std::string("expected a ") + what + " description, found " +
+                                  json_value::kind_name(spec.kind));
+        return read_string(spec, "type", type);
+    }
+
+    bool read_number(const json_value &spec, const char *key, double &out, bool required = true) const
+    {
+        auto value = member(spec, key, required);
+        if (!value)
+            return !required;
+        if (!value->is_number())
+            return fail(*value, std::string("expected a number for \"") + key + "\"");
+        out = value->number;
+        return true;
+    }
+
+    bool read_int(const json_value &spec, const char *key, int &out, bool required = true, int min = -2000000000) const
+    {
+        double number = out;
+        if (!read_number(spec, key, number, required))
+            return false;
+        if (number != std::floor(number) || std::fabs(number) > 2e9)
+            return fail(*spec.find(key), std::string("expected an integer for \"") + key + "\"");
+        if (number < min)
+            return fail(*spec.find(key), std::string("expected at least ") + std::to_string(min) + " for \"" + key + "\"");
+        out = int(number);
+        return true;
+    }
+
+    bool read_seed(const json_value &spec, const char *key, uint64_t &out) const
+    {
+        // Optional. Seeds past 2^53 are only as exact as a JSON number.
+        if (!spec.find(key))
+            return true;
+        double number;
+        if (!read_number(spec, key, number))
+            return false;
+        if (number != std::floor(number) || number < 0 || number >= 18446744073709551616.0)
+            return fail(*spec.find(key), std::string("expected a non-negative integer below 2^64 for \"") + key + "\"");
+        out = uint64_t(number);
+        return true;
+    }
+
+    bool read_bool(const json_value &spec, const char *key, bool &out, bool required = true) const
+    {
+        auto value = member(spec, key, required);
+        if (!value)
+            return !required;
+        if (value->kind != json_value::bool_kind)
+            return fail(*value, std::string("expected true or false for \"") + key + "\"");
+        out = value->boolean;
+        return true;
+    }
+
+    bool read_string(const json_value &spec, const char *key, std::string &out, bool required = true) const
+    {
+        auto value = member(spec, key, required);
+        if (!value)
+            return !required;
+        if (!value->is_string())
+            return fail(*value, std::string("expected a string for \"") + key + "\"");
+        out = value->string;
+        return true;
+    }
+
+    bool to_vec3(const json_value &value, vec3 &out) const
+    {
+        if (!value.is_array() || value.items.size() != 3)
+            return fail(value, "expected an array of three numbers");
+        for (int i = 0; i < 3; i++)
+        {
+            if (!value.items[i].is_number())
+                return fail(value.items[i], "expected a number");
+            out[i] = value.items[i].number;
+        }
+        return true;
+    }
+
+    bool read_vec3(const json_value &spec, const char *key, vec3 &out, bool required = true) const
+    {
+        auto value = member(spec, key, required);
+        if (!value)
+            return !required;
+        return to_vec3(*value, out);
+    }
+
+    bool read_texture(const json_value &spec, const char *key, shared_ptr<texture> &out)
+    {
+        auto value = member(spec, key, true);
+        return value && load_texture(*value, out);
+    }
+
+    bool read_material(const json_value &spec, const char *key, shared_ptr<material> &out)
+    {
+        auto value = member(spec, key, true);
+        return value && load_material(*value, out);
+    }
+
+    bool read_object(const json_value &spec, const char *key, shared_ptr<hittable> &out)
+    {
+        auto value = member(spec, key, true);
+        return value && load_object(*value, out);
+    }
+
+    bool read_density(const json_value &spec, const char *key, shared_ptr<density_field> &out)
+    {
+        auto value = member(spec, key, true);
+        return value && load_density(*value, out);
+    }
+
+    bool read_phase_function(const json_value &spec, shared_ptr<material> &out)
+    {
+        // Media scatter isotropically with the given "albedo", unless a "material" is given.
+        if (spec.find("material"))
+            return read_material(spec, "material", out);
+
+        shared_ptr<texture> albedo;
+        if (!read_texture(spec, "albedo", albedo))
+            return false;
+        out = arena.mat<isotropic>(albedo);
+        return true;
+    }
+};
+
+#endif
@@ -3,31 +3,23 @@
 
 #include "hittable.h"
 
-class sphere : public hittable
+#include <typeinfo>
+
+struct sphere_shape // Plain geometry of a (possibly moving) sphere, without its material
 {
-public:
-    // Stationary Sphere
-    sphere(const point3 &static_center, double radius, shared_ptr<material> mat)
-        : center_path(static_center, vec3(0, 0, 0)), radius(std::fmax(0, radius)), mat(mat)
-    {
-        auto rvec = vec3(radius, radius, radius);
-        bbox = aabb(static_center - rvec, static_center + rvec);
-    }
+    point3 center0; // Center at time 0
+    vec3 motion;    // Center displacement from time 0 to time 1
+    double radius;
 
-    // Moving Sphere
-    sphere(const point3 &center1, const point3 &center2, double radius,
-           shared_ptr<material> mat)
-        : center_path(center1, center2 - center1), radius(std::fmax(0, radius)), mat(mat)
-    {
-        auto rvec = vec3(radius, radius, radius);
-        aabb box1(center_path.at(0) - rvec, center_path.at(0) + rvec);
-        aabb box2(center_path.at(1) - rvec, center_path.at(1) + rvec);
-        bbox = aabb(box1, box2);
-    }
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const { return hit(r, ray_t, rec, nullptr); }
 
-    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    bool hit(const ray &r, interval ray_t, hit_record &rec, const vec3 *orientation) const
     {
-        point3 current_center = center_path.at(r.time());
+        // Fills in everything about the hit except the material. The UVs are mapped in the
+        // frame of the given object axes, or in world space without them.
+        RT_STAT(thread_stats().tests[stat_sphere]++);
+
+        point3 current_center = center0 + r.time() * motion;
         vec3 oc = current_center - r.origin();
         auto a = dot(r.direction(), r.direction());
         auto h = dot(r.direction(), oc);
@@ -53,20 +45,61 @@ public:
         rec.p = r.at(rec.t);
         vec3 outward_normal = (rec.p - current_center) / radius;
         rec.set_face_normal(r, outward_normal);
-        get_sphere_uv(outward_normal, rec.u, rec.v);
-        rec.mat = mat;
 
+        auto local_normal = orientation ? to_object(orientation, outward_normal) : outward_normal;
+        get_sphere_uv(local_normal, rec.u, rec.v);
+
+        // A unit step in u covers the circle of latitude, one in v half a great circle.
+        auto sin_theta = std::sqrt(std::fmax(0.0, 1 - local_normal.y() * local_normal.y()));
+        rec.uv_area = 1 / (2 * pi * pi * radius * radius * std::fmax(sin_theta, 1e-3));
+
+        RT_STAT(thread_stats().hits[stat_sphere]++);
         return true;
     }
 
-    aabb bounding_box() const override { return bbox; }
-    vec3 center() const override { return center_path.at(0.5); }
+    bool occluded(const ray &r, interval ray_t) const
+    {
+        // Whether either root of the intersection lies within ray_t.
 
-private:
-    ray center_path;
-    double radius;
-    shared_ptr<material> mat;
-    aabb bbox;
+        point3 current_center = center0 + r.time() * motion;
+        vec3 oc = current_center - r.origin();
+        auto a = dot(r.direction(), r.direction());
+        auto h = dot(r.direction(), oc);
+        auto c = oc.length_squared() - radius * radius;
+
+        auto discriminant = h * h - a * c;
+        if (discriminant < 0)
+            return false;
+
+        auto sqrtd = std::sqrt(discriminant);
+        return ray_t.surrounds((h - sqrtd) / a) || ray_t.surrounds((h + sqrtd) / a);
+    }
+
+    aabb bounding_box() const
+    {
+        auto rvec = vec3(radius, radius, radius);
+        aabb box1(center0 - rvec, center0 + rvec);
+        aabb box2(center0 + motion - rvec, center0 + motion + rvec);
+        return aabb(box1, box2);
+    }
+
+    point3 surface_point(double u, double v, const vec3 *orientation = nullptr) const
+    {
+        // Inverse of the UV mapping: the point at u,v on the sphere, at time 0.
+        auto theta = v * pi;
+        auto phi = u * 2 * pi;
+        vec3 local(-std::sin(theta) * std::cos(phi), -std::cos(theta), std::sin(theta) * std::sin(phi));
+        if (!orientation)
+            return center0 + radius * local;
+        return center0 + radius * (local.x() * orientation[0] + local.y() * orientation[1] +
+                                   local.z() * orientation[2]);
+    }
+
+    static vec3 to_object(const vec3 orientation[3], const vec3 &v)
+    {
+        // Expresses a world space direction in the sphere's own (unrotated) frame.
+        return vec3(dot(v, orientation[0]), dot(v, orientation[1]), dot(v, orientation[2]));
+    }
 
     static void get_sphere_uv(const point3 &p, double &u, double &v)
     {
@@ -77,12 +110,148 @@ private:
         //     <0 1 0> yields <0.50 1.00>       < 0 -1  0> yields <0.50 0.00>
         //     <0 0 1> yields <0.25 0.50>       < 0  0 -1> yields <0.75 0.50>
 
-        auto theta = std::acos(-p.y());
-        auto phi = std::atan2(-p.z(), p.x()) + pi;
+        auto theta = shading_acos(-p.y());
+        auto phi = shading_atan2(-p.z(), p.x()) + pi;
 
         u = phi / (2 * pi);
         v = theta / pi;
     }
 };
 
-#endif
\ No newline at end of file
+struct rotated_sphere_shape // A sphere whose UV mapping turns with it, from a baked rotation
+{
+    // Kept apart from sphere_shape so that the far more common unrotated spheres stay compact
+    // in the typed leaf arrays.
+    sphere_shape sphere;
+    vec3 orientation[3]; // Object axes in world space
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const { return sphere.hit(r, ray_t, rec, orientation); }
+    bool occluded(const ray &r, interval ray_t) const { return sphere.occluded(r, ray_t); }
+    aabb bounding_box() const { return sphere.bounding_box(); }
+    point3 surface_point(double u, double v) const { return sphere.surface_point(u, v, orientation); }
+};
+
+class sphere : public hittable
+{
+public:
+    // Stationary Sphere
+    sphere(const point3 &static_center, double radius, shared_ptr<material> mat)
+        : sphere(static_center, static_center, radius, mat) {}
+
+    // Moving Sphere
+    sphere(const point3 &center1, const point3 &center2, double radius,
+           shared_ptr<material> mat)
+        : mat(mat)
+    {
+        shape.center0 = center1;
+        shape.motion = center2 - center1;
+        shape.radius = std::fmax(0, radius);
+        bbox = shape.bounding_box();
+    }
+
+    sphere(const sphere_shape &shape, shared_ptr<material> mat)
+        : shape(shape), mat(mat), bbox(shape.bounding_box()) {}
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        if (!shape.hit(r, ray_t, rec))
+            return false;
+
+        rec.mat = mat.get();
+        return true;
+    }
+
+    bool occluded(const ray &r, interval ray_t) const override { return shape.occluded(r, ray_t); }
+
+    aabb bounding_box() const override { return bbox; }
+    vec3 center() const override { return shape.center0 + 0.5 * shape.motion; }
+
+    bool bake(const matrix &trans, std::vector<shared_ptr<hittable>> &out) const override;
+
+    const sphere_shape &geometry() const { return shape; }
+    const shared_ptr<material> &material_ptr() const { return mat; }
+
+private:
+    sphere_shape shape;
+    shared_ptr<material> mat;
+    aabb bbox;
+};
+
+class rotated_sphere : public hittable // A sphere baked from a rotation, its UV mapping turned with it
+{
+public:
+    rotated_sphere(const rotated_sphere_shape &shape, shared_ptr<material> mat)
+        : shape(shape), mat(mat), bbox(shape.bounding_box()) {}
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        if (!shape.hit(r, ray_t, rec))
+            return false;
+
+        rec.mat = mat.get();
+        return true;
+    }
+
+    bool occluded(const ray &r, interval ray_t) const override { return shape.occluded(r, ray_t); }
+
+    aabb bounding_box() const override { return bbox; }
+    vec3 center() const override { return shape.sphere.center0 + 0.5 * shape.sphere.motion; }
+
+    bool bake(const matrix &trans, std::vector<shared_ptr<hittable>> &out) const override
+    {
+        if (typeid(*this) != typeid(rotated_sphere))
+            return false;
+        return bake_sphere(shape.sphere, shape.orientation, mat, trans, out);
+    }
+
+    const rotated_sphere_shape &geometry() const { return shape; }
+    const shared_ptr<material> &material_ptr() const { return mat; }
+
+    static bool bake_sphere(const sphere_shape &shape, const vec3 orientation[3], const shared_ptr<material> &mat,
+                            const matrix &trans, std::vector<shared_ptr<hittable>> &out)
+    {
+        // Rotations, uniform scaling and translations keep a sphere a sphere. The rotation is
+        // remembered for the UV mapping only, so textures stay attached to the surface; spheres
+        // that end up unrotated go back to the plain sphere.
+        double s;
+        if (!uniform_scale_of(trans, s))
+            return false;
+
+        rotated_sphere_shape baked;
+        baked.sphere.center0 = transform_point(trans, shape.center0);
+        baked.sphere.motion = transform_vector(trans, shape.motion);
+        baked.sphere.radius = shape.radius * s;
+
+        bool rotated = false;
+        for (int i = 0; i < 3; i++)
+        {
+            baked.orientation[i] = transform_vector(trans, orientation[i]) / s;
+            for (int j = 0; j < 3; j++)
+                rotated = rotated || std::fabs(baked.orientation[i][j] - (i == j)) > 1e-12;
+        }
+
+        if (rotated)
+        {
+            out.push_back(make_shared<rotated_sphere>(baked, mat));
+            return true;
+        }
+
+        out.push_back(make_shared<sphere>(baked.sphere, mat));
+        return true;
+    }
+
+private:
+    rotated_sphere_shape shape;
+    shared_ptr<material> mat;
+    aabb bbox;
+};
+
+inline bool sphere::bake(const matrix &trans, std::vector<shared_ptr<hittable>> &out) const
+{
+    if (typeid(*this) != typeid(sphere))
+        return false;
+    static const vec3 axes[3] = {vec3(1, 0, 0), vec3(0, 1, 0), vec3(0, 0, 1)};
+    return rotated_sphere::bake_sphere(shape, axes, mat, trans, out);
+}
+
+#endif
@@ -2,8 +2,14 @@
 #define TEXTURE_H
 
 #include "utils.h"
+#include "content_hash.h"
 #include "rtw_stb_image.h"
 #include "perlin.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <filesystem>
+#include <string>
 
 class texture
 {
@@ -11,6 +17,28 @@ public:
     virtual ~texture() = default;
 
     virtual color value(double u, double v, const point3 &p) const = 0;
+
+    virtual color value(double u, double v, const point3 &p, double footprint) const
+    {
+        // Lookup for a footprint of the given width in texture space around u,v. Only filtered
+        // textures care; the rest return their point value.
+        return value(u, v, p);
+    }
+
+    virtual void values(const double *u, const double *v, const point3 *p, color *out, size_t count) const
+    {
+        // Point values at many shading points at once, for textures that evaluate faster in
+        // batches (used when baking).
+        for (size_t i = 0; i < count; i++)
+            out[i] = value(u[i], v[i], p[i]);
+    }
+
+    virtual bool describe(content_hasher &hash) const
+    {
+        // Adds everything the values depend on to `hash`, for caches of them such as bake
+        // files. Textures that cannot be described return false and are not cached.
+        return false;
+    }
 };
 
 class solid_color : public texture
@@ -25,6 +53,13 @@ public:
         return aldebo;
     }
 
+    bool describe(content_hasher &hash) const override
+    {
+        hash.add(std::string("solid_color"));
+        hash.add(aldebo);
+        return true;
+    }
+
 private:
     color aldebo;
 };
@@ -39,6 +74,11 @@ public:
         : checker_texture(scale, make_shared<solid_color>(c1), make_shared<solid_color>(c2)) {}
 
     color value(double u, double v, const point3 &p) const override
+    {
+        return value(u, v, p, 0);
+    }
+
+    color value(double u, double v, const point3 &p, double footprint) const override
     {
         auto xInterger = int(std::floor(scale * p.x()));
         auto yInterger = int(std::floor(scale * p.y()));
@@ -46,7 +86,14 @@ public:
 
         bool isEven = (xInterger + yInterger + zInterger) % 2 == 0;
 
-        return isEven ? even->value(u, v, p) : odd->value(u, v, p);
+        return isEven ? even->value(u, v, p, footprint) : odd->value(u, v, p, footprint);
+    }
+
+    bool describe(content_hasher &hash) const override
+    {
+        hash.add(std::string("checker"));
+        hash.add(scale);
+        return even->describe(hash) && odd->describe(hash);
     }
 
 private:
@@ -58,11 +105,28 @@ private:
 class image_texture : public texture
 {
 public:
-    image_texture(const char *filename) : image(filename) {}
+    image_texture(const char *filename, texture_filter filter = texture_filter::trilinear,
+                  texel_storage storage = texel_storage::linear_float)
+        : name(filename), filter(filter), storage(storage)
+    {
+        // The image is loaded in the background; the first lookup waits for it if necessary.
+        pending = asset_pool().submit([name = name, storage]
+                                      {
+                                          RT_TRACE_ZONE("decode image", name);
+                                          return rtw_image::shared(name.c_str(), storage);
+                                      }).share();
+    }
 
     color value(double u, double v, const point3 &p) const override
+    {
+        // Without a footprint the full resolution level is the only sensible choice.
+        return value(u, v, p, 0);
+    }
+
+    color value(double u, double v, const point3 &p, double footprint) const override
     {
         // If we have no texture data, then return solid cyan as a debugging aid.
+        const rtw_image &image = loaded_image();
         if (image.height() <= 0)
             return color(0, 1, 1);
 
@@ -70,16 +134,52 @@ public:
         u = interval(0, 1).clamp(u);
         v = 1.0 - interval(0, 1).clamp(v); // Flip V to image coordinates
 
-        auto i = int(u * image.width());
-        auto j = int(v * image.height());
-        auto pixel = image.pixel_data(i, j);
+        // Pick the level where one texel is about as wide as the footprint.
+        auto texels = footprint * std::sqrt(double(image.width()) * image.height());
+        auto lod = texels > 1 ? std::log2(texels) : 0.0;
+        return image.sample(u, v, lod, filter);
+    }
 
-        auto color_scale = 1.0 / 255.0;
-        return color(color_scale * pixel[0], color_scale * pixel[1], color_scale * pixel[2]);
+    bool describe(content_hasher &hash) const override
+    {
+        // The file by path, size and modification time, rather than reading it again. The path
+        // is the one the image was loaded from, found as rtw_image does.
+        auto filename = rtw_image::find(name.c_str());
+        std::error_code ec;
+        auto size = std::filesystem::file_size(filename, ec);
+        if (ec)
+            return false;
+        auto modified = std::filesystem::last_write_time(filename, ec);
+        if (ec)
+            return false;
+
+        hash.add(std::string("image"));
+        hash.add(filename);
+        hash.add(uint64_t(size));
+        hash.add(uint64_t(modified.time_since_epoch().count()));
+        hash.add(uint64_t(filter));
+        hash.add(uint64_t(storage));
+        return true;
     }
 
 private:
-    rtw_image image;
+    std::string name;
+    std::shared_future<shared_ptr<const rtw_image>> pending;
+    mutable std::atomic<const rtw_image *> ready{nullptr}; // Set once the image has loaded
+    texture_filter filter;
+    texel_storage storage;
+
+    const rtw_image &loaded_image() const
+    {
+        auto loaded = ready.load(std::memory_order_acquire);
+        if (loaded == nullptr)
+        {
+            // The future keeps the image alive, so the raw pointer stays valid.
+            loaded = pending.get().get();
+            ready.store(loaded, std::memory_order_release);
+        }
+        return *loaded;
+    }
 };
 
 class noise_texture : public texture
@@ -89,7 +189,30 @@ public:
 
     color value(double u, double v, const point3 &p) const override
     {
-        return color(.5, .5, .5) * (1 + std::sin(scale * p.z() + 10 * noise.turb(p, 7)));
+        return color(.5, .5, .5) * (1 + shading_sin(scale * p.z() + 10 * noise.turb(p, 7)));
+    }
+
+    void values(const double *u, const double *v, const point3 *p, color *out, size_t count) const override
+    {
+        std::vector<double> phase(count);
+        noise.turb(p, phase.data(), count, 7);
+        for (size_t i = 0; i < count; i++)
+            phase[i] = scale * p[i].z() + 10 * phase[i];
+
+        shading_sin(phase.data(), phase.data(), count);
+        for (size_t i = 0; i < count; i++)
+            out[i] = color(.5, .5, .5) * (1 + phase[i]);
+    }
+
+    bool describe(content_hasher &hash) const override
+    {
+        hash.add(std::string("noise"));
+        hash.add(scale);
+#ifdef RT_FAST_MATH
+        hash.add(uint64_t(1)); // shading_sin() is approximate
+#endif
+        noise.describe(hash);
+        return true;
     }
 
 private:
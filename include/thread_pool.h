@@ -0,0 +1,102 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "trace.h"
+
+class thread_pool // Fixed set of worker threads running submitted tasks in order
+{
+public:
+    explicit thread_pool(unsigned thread_count)
+    {
+        for (unsigned i = 0; i < std::max(1u, thread_count); i++)
+            workers.emplace_back([this] { work(); });
+    }
+
+    thread_pool(const thread_pool &) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    ~thread_pool()
+    {
+        // Tasks already submitted still run to completion.
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        work_ready.notify_all();
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    template <typename F>
+    auto submit(F task) -> std::future<decltype(task())>
+    {
+        // Queues the task and returns a future for its result.
+        auto packaged = std::make_shared<std::packaged_task<decltype(task())()>>(std::move(task));
+        auto result = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.emplace_back([packaged] { (*packaged)(); });
+        }
+        work_ready.notify_one();
+        return result;
+    }
+
+    void wait_idle()
+    {
+        // Blocks until every task submitted so far has finished.
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return queue.empty() && running == 0; });
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> queue;
+    std::mutex mutex;
+    std::condition_variable work_ready, idle;
+    size_t running = 0; // Tasks taken off the queue but not finished yet
+    bool stopping = false;
+
+    void work()
+    {
+        RT_TRACE_THREAD("pool worker");
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            work_ready.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty())
+                return;
+
+            auto task = std::move(queue.front());
+            queue.pop_front();
+            running++;
+
+            lock.unlock();
+            task();
+            lock.lock();
+
+            running--;
+            if (queue.empty() && running == 0)
+                idle.notify_all();
+        }
+    }
+};
+
+inline thread_pool &asset_pool()
+{
+    // Background pool for loading scene assets (texture decoding, mip generation) while the
+    // scene is being built and compiled.
+    static thread_pool pool(std::thread::hardware_concurrency());
+    return pool;
+}
+
+#endif
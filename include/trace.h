@@ -0,0 +1,156 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Timeline tracing: scoped zones record when each phase of a run started and ended, and on
+// which thread, for viewing in ui.perfetto.dev or chrome://tracing. Zones are only compiled in
+// with RT_TRACE defined (cmake -DRT_TRACE=ON); without it the RT_TRACE_* macros expand to
+// nothing, and their arguments are not evaluated.
+//
+//   RT_TRACE_ZONE("name")            the rest of the enclosing scope
+//   RT_TRACE_ZONE("name", detail)    with a std::string shown as the zone's argument
+//   RT_TRACE_THREAD("name")          names the calling thread in the timeline
+
+#ifdef RT_TRACE
+
+#include "json.h"
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class trace_log // Zones of every thread, written out as Chrome trace_event JSON
+{
+public:
+    struct event
+    {
+        const char *name;
+        std::string detail;
+        int64_t start, duration; // Nanoseconds, start since the log was created
+    };
+
+    struct thread_events
+    {
+        int id;
+        std::string name;
+        std::vector<event> events;
+    };
+
+    static trace_log &instance()
+    {
+        static trace_log log;
+        return log;
+    }
+
+    thread_events &current_thread()
+    {
+        // Every thread appends to its own buffer, so recording a zone takes no lock. The
+        // buffers belong to the log and outlive their threads.
+        thread_local thread_events *events = nullptr;
+        if (!events)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            threads.push_back(std::make_unique<thread_events>());
+            events = threads.back().get();
+            events->id = int(threads.size());
+        }
+        return *events;
+    }
+
+    int64_t now() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    bool write(const std::string &filename)
+    {
+        // Writes the zones recorded so far. Threads still recording zones must be idle.
+        std::lock_guard<std::mutex> lock(mutex);
+        std::ofstream out(filename);
+        json_writer json(out);
+        json.begin_object();
+        json.value("displayTimeUnit", "ms");
+        json.begin_array("traceEvents");
+        for (const auto &thread : threads)
+        {
+            if (!thread->name.empty())
+            {
+                json.begin_object();
+                json.value("name", "thread_name");
+                json.value("ph", "M");
+                json.value("pid", 1);
+                json.value("tid", thread->id);
+                json.begin_object("args");
+                json.value("name", thread->name);
+                json.end_object();
+                json.end_object();
+            }
+            for (const auto &e : thread->events)
+            {
+                json.begin_object();
+                json.value("name", e.name);
+                json.value("ph", "X"); // A complete event: start and duration
+                json.value("ts", e.start / 1e3);
+                json.value("dur", e.duration / 1e3);
+                json.value("pid", 1);
+                json.value("tid", thread->id);
+                if (!e.detail.empty())
+                {
+                    json.begin_object("args");
+                    json.value("detail", e.detail);
+                    json.end_object();
+                }
+                json.end_object();
+            }
+        }
+        json.end_array();
+        json.end_object();
+        out << "\n";
+        return bool(out);
+    }
+
+private:
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::mutex mutex; // Guards the list of threads, not their events
+    std::vector<std::unique_ptr<thread_events>> threads;
+};
+
+class trace_zone // Records the time from its construction to its destruction
+{
+public:
+    explicit trace_zone(const char *name, std::string detail = std::string())
+        : name(name), detail(std::move(detail)), start(trace_log::instance().now())
+    {
+    }
+
+    trace_zone(const trace_zone &) = delete;
+    trace_zone &operator=(const trace_zone &) = delete;
+
+    ~trace_zone()
+    {
+        auto &log = trace_log::instance();
+        log.current_thread().events.push_back({name, std::move(detail), start, log.now() - start});
+    }
+
+private:
+    const char *name;
+    std::string detail;
+    int64_t start;
+};
+
+#define RT_TRACE_CONCAT_(a, b) a##b
+#define RT_TRACE_CONCAT(a, b) RT_TRACE_CONCAT_(a, b)
+#define RT_TRACE_ZONE(...) trace_zone RT_TRACE_CONCAT(trace_zone_, __LINE__)(__VA_ARGS__)
+#define RT_TRACE_THREAD(thread_name) (trace_log::instance().current_thread().name = (thread_name))
+
+#else
+
+#define RT_TRACE_ZONE(...) ((void)0)
+#define RT_TRACE_THREAD(thread_name) ((void)0)
+
+#endif
+
+#endif
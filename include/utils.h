@@ -2,6 +2,7 @@
 #define UTILS_H
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <random>
 #include <iostream>
@@ -25,12 +26,26 @@ inline double degrees_to_radians(double degrees)
     return degrees * pi / 180.0;
 }
 
+inline std::mt19937 &random_generator()
+{
+    // Every thread draws from its own generator, so threads never contend for it.
+    thread_local std::mt19937 generator;
+    return generator;
+}
+
+inline void seed_random(uint64_t seed, uint64_t stream)
+{
+    // Restarts the calling thread's random sequence. Rendering reseeds it for every tile, so an
+    // image only depends on the seed and not on which thread rendered which tile.
+    std::seed_seq sequence{uint32_t(seed), uint32_t(seed >> 32), uint32_t(stream), uint32_t(stream >> 32)};
+    random_generator().seed(sequence);
+}
+
 inline double random_double()
 {
     // Returns a random real in [0,1).
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 generator;
-    return distribution(generator);
+    thread_local std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    return distribution(random_generator());
 }
 
 inline double random_double(double min, double max)
@@ -47,6 +62,7 @@ inline int random_int(int min, int max)
 
 // Common Headers
 
+#include "fast_math.h"
 #include "color.h"
 #include "interval.h"
 #include "ray.h"
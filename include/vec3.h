@@ -123,18 +123,46 @@ inline vec3 unit_vector(const vec3 &v)
     return v / v.length();
 }
 
+inline vec3 sample_unit_disk(double u1, double u2)
+{
+    // Maps two uniform numbers in [0,1) to a uniform point in the unit disk, without rejection.
+    auto r = std::sqrt(u1);
+    double sin_phi, cos_phi;
+    shading_sincos(2 * pi * u2, sin_phi, cos_phi);
+    return vec3(r * cos_phi, r * sin_phi, 0);
+}
+
+inline vec3 sample_unit_vector(double u1, double u2)
+{
+    // Maps two uniform numbers in [0,1) to a uniform direction, without rejection.
+    auto z = 1 - 2 * u1;
+    auto r = std::sqrt(std::fmax(0.0, 1 - z * z));
+    double sin_phi, cos_phi;
+    shading_sincos(2 * pi * u2, sin_phi, cos_phi);
+    return vec3(r * cos_phi, r * sin_phi, z);
+}
+
 inline vec3 random_in_unit_disk()
 {
+#ifdef RT_FAST_MATH
+    auto u1 = random_double();
+    return sample_unit_disk(u1, random_double());
+#else
     while (true)
     {
         auto p = vec3(random_double(-1, 1), random_double(-1, 1), 0);
         if (p.length_squared() < 1)
             return p;
     }
+#endif
 }
 
 inline vec3 random_unit_vector()
 {
+#ifdef RT_FAST_MATH
+    auto u1 = random_double();
+    return sample_unit_vector(u1, random_double());
+#else
     while (true)
     {
         auto p = vec3::random(-1, 1);
@@ -142,6 +170,7 @@ inline vec3 random_unit_vector()
         if (1e-160 < lensq && lensq <= 1)
             return p / sqrt(lensq);
     }
+#endif
 }
 
 inline vec3 random_on_hemisphere(const vec3 &normal)
@@ -1,515 +1,276 @@
 #include "utils.h"
 
-#include "bvh.h"
-#include "camera.h"
-#include "constant_medium.h"
-#include "hittable.h"
-#include "hittable_list.h"
-#include "quad.h"
-#include "material.h"
-#include "sphere.h"
-#include "texture.h"
+#include "scene_file.h"
 
-// each function represents a render scene
-void simple_sphere()
-{
-    // World
-    hittable_list world;
-
-    auto checker = make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(checker)));
-
-    // Camera
-    camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 1200;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = color(0.70, 0.80, 1.00);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(13, 2, 3);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
+#include <charconv>
+#include <filesystem>
+#include <optional>
+#include <string>
 
-    cam.defocus_angle = 0;
+// Renders a scene file, see scene_file.h for the format. The scenes that used to be compiled
+// in here live in scenes/. Options override the settings in the scene file.
 
-    cam.render(world);
+namespace
+{
+const char *usage =
+    "Usage: main [options] [scene] > image.ppm\n"
+    "\n"
+    "  scene                scene file, or the name of one in scenes/ (default: cornell_box)\n"
+    "  -w, --width N        image width in pixels\n"
+    "  -s, --spp N          samples per pixel\n"
+    "  -d, --depth N        maximum number of ray bounces\n"
+    "      --seed N         seed of the random sequences\n"
+    "  -t, --threads N      render threads, 0 for one per hardware thread\n"
+    "      --tile N         width and height of the square render tiles\n"
+    "  -o, --output FILE    image file to write instead of standard output\n"
+    "  -f, --format F       ppm, ppm-binary or pfm (default: pfm for .pfm files, ppm otherwise)\n"
+    "  -a, --accel A        flat (typed-leaf BVH, default), bvh (bvh_node tree) or none\n"
+    "      --bvh-cache FILE keep the flat BVH in FILE between runs\n"
+    "      --stats FILE     write render statistics to FILE as JSON (builds with RT_STATS only)\n"
+    "      --heatmaps BASE  write per-pixel cost maps to BASE_<metric>.ppm and .pfm\n"
+    "      --trace FILE     write a timeline of the run to FILE, for ui.perfetto.dev (builds with RT_TRACE only)\n"
+    "  -h, --help           show this message\n";
+
+struct render_options // Settings given on the command line; unset ones keep the scene's values
+{
+    std::string scene = "cornell_box";
+    std::optional<int> image_width, samples_per_pixel, max_depth, threads, tile_size;
+    std::optional<uint64_t> seed;
+    std::optional<std::string> output, bvh_cache, stats, trace, heatmaps;
+    std::optional<image_format> format;
+    std::optional<std::string> accelerator;
+};
+
+template <typename T>
+bool parse_number(const std::string &text, T &value)
+{
+    auto end = text.data() + text.size();
+    auto result = std::from_chars(text.data(), end, value);
+    return result.ec == std::errc() && result.ptr == end;
 }
 
-void bouncing_spheres()
+bool parse_command_line(int argc, char **argv, render_options &options, bool &help)
 {
-    // World
-
-    hittable_list world;
-
-    auto checker = make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(checker)));
-
-    for (int a = -11; a < 11; a++)
+    // Options take their value as the next argument or after '=' ("--spp 64", "--spp=64").
+    // Reports the first problem on std::cerr and returns false.
+    bool have_scene = false;
+    for (int i = 1; i < argc; i++)
     {
-        for (int b = -11; b < 11; b++)
+        std::string arg = argv[i];
+        if (arg.size() < 2 || arg[0] != '-')
         {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
-
-            if ((center - point3(4, 0.2, 0)).length() > 0.9)
+            if (have_scene)
             {
-                shared_ptr<material> sphere_material;
-
-                if (choose_mat < 0.8)
-                {
-                    // diffuse
-                    auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    auto center2 = center + vec3(0, random_double(0, 0.5), 0);
-                    world.add(make_shared<sphere>(center, center2, 0.2, sphere_material));
-                }
-                else if (choose_mat < 0.95)
-                {
-                    // metal
-                    auto albedo = color::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-                else
-                {
-                    // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
+                std::cerr << "ERROR: More than one scene given: '" << options.scene << "' and '" << arg << "'.\n";
+                return false;
             }
+            options.scene = arg;
+            have_scene = true;
+            continue;
         }
-    }
-
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-
-    world = hittable_list(make_shared<bvh_node>(world));
-
-    // Camera
-    camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 1200;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = color(0.70, 0.80, 1.00);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(13, 2, 3);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0.6;
-    cam.focus_dist = 10.0;
-
-    cam.render(world);
-}
-
-void checkered_spheres()
-{
-    hittable_list world;
-
-    auto checker = make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
-
-    world.add(make_shared<sphere>(point3(0, -10, 0), 10, make_shared<lambertian>(checker)));
-    world.add(make_shared<sphere>(point3(0, 10, 0), 10, make_shared<lambertian>(checker)));
-
-    camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = color(0.70, 0.80, 1.00);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(13, 2, 3);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-void earth()
-{
-    auto earth_texture = make_shared<image_texture>("earthmap.jpg");
-    auto earth_surface = make_shared<lambertian>(earth_texture);
-    auto globe = make_shared<sphere>(point3(0, 0, 0), 2, earth_surface);
-
-    camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = color(0.70, 0.80, 1.00);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(0, 0, 12);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(hittable_list(globe));
-}
-
-void perlin_spheres()
-{
-    hittable_list world;
-
-    auto pertext = make_shared<noise_texture>(4);
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
-    world.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
-
-    camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = color(0.70, 0.80, 1.00);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(13, 2, 3);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-void quads()
-{
-    hittable_list world;
-
-    // Materials
-    auto left_red = make_shared<lambertian>(color(1.0, 0.2, 0.2));
-    auto back_green = make_shared<lambertian>(color(0.2, 1.0, 0.2));
-    auto right_blue = make_shared<lambertian>(color(0.2, 0.2, 1.0));
-    auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.0));
-    auto lower_teal = make_shared<lambertian>(color(0.2, 0.8, 0.8));
-
-    // Quads
-    world.add(make_shared<quad>(point3(-3, -2, 5), vec3(0, 0, -4), vec3(0, 4, 0), left_red));
-    world.add(make_shared<quad>(point3(-2, -2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
-    world.add(make_shared<quad>(point3(3, -2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
-    world.add(make_shared<quad>(point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
-    world.add(make_shared<quad>(point3(-2, -3, 5), vec3(4, 0, 0), vec3(0, 0, -4), lower_teal));
-
-    camera cam;
-
-    cam.aspect_ratio = 1.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = color(0.70, 0.80, 1.00);
-
-    cam.vfov = 80;
-    cam.lookfrom = point3(0, 0, 9);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-void simple_light()
-{
-    hittable_list world;
-
-    auto pertext = make_shared<noise_texture>(4);
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
-    world.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
-
-    auto difflight = make_shared<diffuse_light>(color(4, 4, 4));
-    world.add(make_shared<quad>(point3(3, 1, -2), vec3(2, 0, 0), vec3(0, 2, 0), difflight));
-
-    camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 500;
-    cam.max_depth = 50;
-    cam.background = color(0, 0, 0);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(26, 3, 6);
-    cam.lookat = point3(0, 2, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-void cornell_box()
-{
-    hittable_list world;
-
-    auto red = make_shared<lambertian>(color(.65, .05, .05));
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    auto green = make_shared<lambertian>(color(.12, .45, .15));
-    auto light = make_shared<diffuse_light>(color(15, 15, 15));
-
-    // Cornell box sides
-    world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 0, 555), vec3(0, 555, 0), green));
-    world.add(make_shared<quad>(point3(0, 0, 555), vec3(0, 0, -555), vec3(0, 555, 0), red));
-    world.add(make_shared<quad>(point3(0, 555, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
-    world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 0, -555), white));
-    world.add(make_shared<quad>(point3(555, 0, 555), vec3(-555, 0, 0), vec3(0, 555, 0), white));
 
-    // Light
-    world.add(make_shared<quad>(point3(213, 554, 227), vec3(130, 0, 0), vec3(0, 0, 105), light));
-
-    // Box 1
-    shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
-    box1 = make_shared<rotate>(box1, vec3(0, 15, 0));
-    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-    world.add(box1);
-
-    // Box 2
-    shared_ptr<hittable> box2 = box(point3(0, 0, 0), point3(165, 165, 165), white);
-    box2 = make_shared<rotate>(box2, vec3(0, -18, 0));
-    box2 = make_shared<translate>(box2, vec3(130, 0, 65));
-    world.add(box2);
-
-    camera cam;
-
-    cam.aspect_ratio = 1.0;
-    cam.image_width = 600;
-    cam.samples_per_pixel = 64;
-    cam.max_depth = 50;
-    cam.background = color(0, 0, 0);
-
-    cam.vfov = 40;
-    cam.lookfrom = point3(278, 278, -800);
-    cam.lookat = point3(278, 278, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-void cornell_smoke()
-{
-    hittable_list world;
-
-    auto red = make_shared<lambertian>(color(.65, .05, .05));
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    auto green = make_shared<lambertian>(color(.12, .45, .15));
-    auto light = make_shared<diffuse_light>(color(7, 7, 7));
-
-    world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
-    world.add(make_shared<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
-    world.add(make_shared<quad>(point3(113, 554, 127), vec3(330, 0, 0), vec3(0, 0, 305), light));
-    world.add(make_shared<quad>(point3(0, 555, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
-    world.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
-    world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
-
-    shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
-    box1 = make_shared<rotate>(box1, vec3(0, 15, 0));
-    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-
-    shared_ptr<hittable> box2 = box(point3(0, 0, 0), point3(165, 165, 165), white);
-    box2 = make_shared<rotate>(box2, vec3(0, -18, 0));
-    box2 = make_shared<translate>(box2, vec3(130, 0, 65));
-
-    world.add(make_shared<constant_medium>(box1, 0.01, color(0, 0, 0)));
-    world.add(make_shared<constant_medium>(box2, 0.01, color(1, 1, 1)));
+        if (arg == "-h" || arg == "--help")
+        {
+            help = true;
+            return true;
+        }
 
-    camera cam;
+        std::string value;
+        bool has_value = false;
+        auto equals = arg.find('=');
+        if (arg.compare(0, 2, "--") == 0 && equals != std::string::npos)
+        {
+            value = arg.substr(equals + 1);
+            arg.resize(equals);
+            has_value = true;
+        }
 
-    cam.aspect_ratio = 1.0;
-    cam.image_width = 600;
-    cam.samples_per_pixel = 200;
-    cam.max_depth = 50;
-    cam.background = color(0, 0, 0);
+        static const char *known[] = {"-w", "--width", "-s", "--spp", "-d", "--depth", "--seed", "-t", "--threads",
+                                      "--tile", "-o", "--output", "-f", "--format", "-a", "--accel", "--bvh-cache", "--stats", "--trace", "--heatmaps"};
+        bool is_known = false;
+        for (auto name : known)
+            is_known = is_known || arg == name;
+        if (!is_known)
+        {
+            std::cerr << "ERROR: Unknown option " << arg << ".\n";
+            return false;
+        }
 
-    cam.vfov = 40;
-    cam.lookfrom = point3(278, 278, -800);
-    cam.lookat = point3(278, 278, 0);
-    cam.vup = vec3(0, 1, 0);
+        if (!has_value && i + 1 < argc)
+        {
+            value = argv[i + 1];
+            has_value = true;
+            i++;
+        }
+        if (!has_value)
+        {
+            std::cerr << "ERROR: Option " << arg << " needs a value.\n";
+            return false;
+        }
 
-    cam.defocus_angle = 0;
+        auto read_int = [&](std::optional<int> &out, int min)
+        {
+            int number;
+            if (!parse_number(value, number) || number < min)
+            {
+                std::cerr << "ERROR: Option " << arg << " needs an integer of at least " << min << ", not '"
+                          << value << "'.\n";
+                return false;
+            }
+            out = number;
+            return true;
+        };
+
+        bool ok = true;
+        if (arg == "-w" || arg == "--width")
+            ok = read_int(options.image_width, 1);
+        else if (arg == "-s" || arg == "--spp")
+            ok = read_int(options.samples_per_pixel, 1);
+        else if (arg == "-d" || arg == "--depth")
+            ok = read_int(options.max_depth, 1);
+        else if (arg == "-t" || arg == "--threads")
+            ok = read_int(options.threads, 0);
+        else if (arg == "--tile")
+            ok = read_int(options.tile_size, 1);
+        else if (arg == "--seed")
+        {
+            uint64_t seed;
+            ok = parse_number(value, seed);
+            if (ok)
+                options.seed = seed;
+            else
+                std::cerr << "ERROR: Option --seed needs a non-negative integer, not '" << value << "'.\n";
+        }
+        else if (arg == "-o" || arg == "--output")
+            options.output = value;
+        else if (arg == "--bvh-cache")
+            options.bvh_cache = value;
+        else if (arg == "--stats")
+        {
+            ok = render_stats::enabled;
+            if (ok)
+                options.stats = value;
+            else
+                std::cerr << "ERROR: Option --stats needs a build with RT_STATS (cmake -DRT_STATS=ON).\n";
+        }
+        else if (arg == "--heatmaps")
+            options.heatmaps = value;
+        else if (arg == "--trace")
+        {
+#ifdef RT_TRACE
+            options.trace = value;
+#else
+            std::cerr << "ERROR: Option --trace needs a build with RT_TRACE (cmake -DRT_TRACE=ON).\n";
+            ok = false;
+#endif
+        }
+        else if (arg == "-f" || arg == "--format")
+        {
+            if (value == "ppm")
+                options.format = image_format::ppm;
+            else if (value == "ppm-binary")
+                options.format = image_format::ppm_binary;
+            else if (value == "pfm")
+                options.format = image_format::pfm;
+            else
+            {
+                std::cerr << "ERROR: Unknown image format '" << value << "'; use ppm, ppm-binary or pfm.\n";
+                ok = false;
+            }
+        }
+        else if (arg == "-a" || arg == "--accel")
+        {
+            ok = value == "flat" || value == "bvh" || value == "none";
+            if (ok)
+                options.accelerator = value;
+            else
+                std::cerr << "ERROR: Unknown accelerator '" << value << "'; use flat, bvh or none.\n";
+        }
 
-    cam.render(world);
+        if (!ok)
+            return false;
+    }
+    return true;
 }
 
-void test()
+void apply(const render_options &options, camera &cam)
 {
-    hittable_list world;
-
-    auto checker = make_shared<checker_texture>(2, color(.2, .2, .2), color(.8, .8, .8));
-    auto pertext = make_shared<noise_texture>(1);
-
-    auto block = make_shared<lambertian>(color(.63, .63, .75));
-    auto red = make_shared<lambertian>(color(0.9, 0.5, 0.5));
-    auto ground = make_shared<lambertian>(checker);
-    auto glass = make_shared<dielectric>(1.5);
-    auto light = make_shared<diffuse_light>(color(2, 2, 0.5));
-
-    auto box0 = box(point3(-1, -1, -1), point3(1, 1, 1), glass);
-    auto sphere0 = make_shared<sphere>(point3(0, 0, 0), 0.6, red);
-    auto triangle0 = make_shared<triangle>(point3(-1, -1, 0), point3(2, 0, 0), point3(0, 2, 0), block);
-    auto light_source = make_shared<sphere>(point3(0, -2, -2), 0.2, light);
-    auto pyramid0 = tetrahedron(point3(-1, -1, 0), point3(1, -1, 0), point3(0, -1, 2), point3(0, 1, 0), block);
-
-    auto box1 = make_shared<transform>(box0, vec3(1, 1, 1), vec3(0, 20, 0), vec3(0, -1.5, -5));
-    auto sphere1 = make_shared<transform>(sphere0, vec3(0.5, 1, 0.5), vec3(0, 20, 0), vec3(0, -1.5, -5));
-    auto triangle1 = make_shared<transform>(triangle0, vec3(1, 1, 1), vec3(0, 20, 0), vec3(0, -1, -5));
-    auto pyramid1 = make_shared<transform>(pyramid0, vec3(1, 1, 1), vec3(0, 0, 0), vec3(0, -1, -5));
-    world.add(pyramid1);
-    world.add(make_shared<quad>(point3(20, -2.5, -20), vec3(-40, 0, 0), vec3(0, 0, 40), ground));
-
-    camera cam;
-
-    cam.aspect_ratio = 1.0;
-    cam.image_width = 100;
-    cam.samples_per_pixel = 500;
-    cam.max_depth = 50;
-    cam.background = color(0.5, 0.6, 1.0);
-
-    cam.vfov = 40;
-    cam.lookfrom = point3(0, 0.5, 2);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
+    if (options.image_width)
+        cam.image_width = *options.image_width;
+    if (options.samples_per_pixel)
+        cam.samples_per_pixel = *options.samples_per_pixel;
+    if (options.max_depth)
+        cam.max_depth = *options.max_depth;
+    if (options.seed)
+        cam.seed = *options.seed;
+    if (options.threads)
+        cam.threads = *options.threads;
+    if (options.tile_size)
+        cam.tile_size = *options.tile_size;
+    if (options.bvh_cache)
+        cam.bvh_cache = *options.bvh_cache;
+    if (options.stats)
+        cam.stats_output = *options.stats;
+    if (options.heatmaps)
+        cam.heatmaps = *options.heatmaps;
+
+    if (options.output)
+    {
+        cam.output = *options.output;
+        if (std::filesystem::path(cam.output).extension() == ".pfm")
+            cam.format = image_format::pfm;
+    }
+    if (options.format)
+        cam.format = *options.format;
 
-    cam.render(world);
+    if (options.accelerator)
+    {
+        cam.accelerate = *options.accelerator != "none";
+        cam.typed_leaves = *options.accelerator == "flat";
+    }
 }
+} // namespace
 
-void final_scene(int image_width, int samples_per_pixel, int max_depth)
+int main(int argc, char **argv)
 {
-    hittable_list boxes1;
-    auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
-
-    int boxes_per_side = 20;
-    for (int i = 0; i < boxes_per_side; i++)
+    render_options options;
+    bool help = false;
+    if (!parse_command_line(argc, argv, options, help))
     {
-        for (int j = 0; j < boxes_per_side; j++)
-        {
-            auto w = 100.0;
-            auto x0 = -1000.0 + i * w;
-            auto z0 = -1000.0 + j * w;
-            auto y0 = 0.0;
-            auto x1 = x0 + w;
-            auto y1 = random_double(1, 101);
-            auto z1 = z0 + w;
-
-            boxes1.add(box(point3(x0, y0, z0), point3(x1, y1, z1), ground));
-        }
+        std::cerr << "Run with --help for the list of options.\n";
+        return 2;
     }
-
-    hittable_list world;
-
-    world.add(make_shared<bvh_node>(boxes1));
-
-    auto light = make_shared<diffuse_light>(color(7, 7, 7));
-    world.add(make_shared<quad>(point3(123, 554, 147), vec3(300, 0, 0), vec3(0, 0, 265), light));
-
-    auto center1 = point3(400, 400, 200);
-    auto center2 = center1 + vec3(30, 0, 0);
-    auto sphere_material = make_shared<lambertian>(color(0.7, 0.3, 0.1));
-    world.add(make_shared<sphere>(center1, center2, 50, sphere_material));
-
-    world.add(make_shared<sphere>(point3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
-    world.add(make_shared<sphere>(
-        point3(0, 150, 145), 50, make_shared<metal>(color(0.8, 0.8, 0.9), 1.0)));
-
-    auto boundary = make_shared<sphere>(point3(360, 150, 145), 70, make_shared<dielectric>(1.5));
-    world.add(boundary);
-    world.add(make_shared<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9)));
-    boundary = make_shared<sphere>(point3(0, 0, 0), 5000, make_shared<dielectric>(1.5));
-    world.add(make_shared<constant_medium>(boundary, .0001, color(1, 1, 1)));
-
-    auto emat = make_shared<lambertian>(make_shared<image_texture>("earthmap.jpg"));
-    world.add(make_shared<sphere>(point3(400, 200, 400), 100, emat));
-    auto pertext = make_shared<noise_texture>(0.01);
-    world.add(make_shared<sphere>(point3(220, 280, 300), 80, make_shared<lambertian>(pertext)));
-
-    hittable_list boxes2;
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    int ns = 1000;
-    for (int j = 0; j < ns; j++)
+    if (help)
     {
-        boxes2.add(make_shared<sphere>(point3::random(0, 165), 10, white));
+        std::cout << usage;
+        return 0;
     }
 
-    world.add(make_shared<translate>(
-        make_shared<rotate>(
-            make_shared<bvh_node>(boxes2), vec3(0, 15, 0)),
-        vec3(-100, 270, 395)));
-
-    camera cam;
-
-    cam.aspect_ratio = 1.0;
-    cam.image_width = image_width;
-    cam.samples_per_pixel = samples_per_pixel;
-    cam.max_depth = max_depth;
-    cam.background = color(0, 0, 0);
-
-    cam.vfov = 40;
-    cam.lookfrom = point3(478, 278, -600);
-    cam.lookat = point3(278, 278, 0);
-    cam.vup = vec3(0, 1, 0);
+    auto filename = scene_file::find(options.scene);
+    if (filename.empty())
+    {
+        std::cerr << "ERROR: Could not find scene '" << options.scene << "'.\n";
+        return 1;
+    }
 
-    cam.defocus_angle = 0;
+    RT_TRACE_THREAD("main");
+    bool ok;
+    {
+        scene_file scene;
+        if (!scene.load(filename))
+            return 1;
+        apply(options, scene.cam);
 
-    cam.render(world);
-}
+        scene.print_summary();
+        ok = scene.cam.render(scene.world);
+    }
 
-int main()
-{
-    switch (7)
+#ifdef RT_TRACE
+    if (options.trace && !trace_log::instance().write(*options.trace))
     {
-    case 0:
-        simple_sphere();
-    case 1:
-        bouncing_spheres();
-        break;
-    case 2:
-        checkered_spheres();
-        break;
-    case 3:
-        earth();
-        break;
-    case 4:
-        perlin_spheres();
-        break;
-    case 5:
-        quads();
-        break;
-    case 6:
-        simple_light();
-        break;
-    case 7:
-        cornell_box();
-        break;
-    case 8:
-        cornell_smoke();
-        break;
-    case 9:
-        final_scene(200, 200, 40);
-        break;
-    default:
-        test();
-        break;
+        std::cerr << "ERROR: Could not write trace file '" << *options.trace << "'.\n";
+        ok = false;
     }
+#endif
+    return ok ? 0 : 1;
 }
\ No newline at end of file